@@ -0,0 +1,490 @@
+#pragma once
+
+#include "genesis/genesis.hpp"
+#include "EdgeSelection.hpp"
+#include "FlatGeneTree.hpp"
+#include "GeneTreeInput.hpp"
+#include "Metrics.hpp"
+#include "ProgressReporter.hpp"
+#include "Resampling.hpp"
+#include "QuartetScoreComputer.hpp"
+#include "TreeInformation.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace genesis;
+using namespace tree;
+
+/**
+ * Computes QP-IC and EQP-IC scores without a quartet table. These scores only need, for each pair {u,v} of inner
+ * nodes of the reference tree, the summed counts p1, p2, p3 of the three topologies of the quartets in
+ * S1 x S2 x S3 x S4, where S1, S2 are the subtrees at u and S3, S4 the subtrees at v that do not contain the other node.
+ *
+ * For a gene tree, a quartet ab|cd is resolved at exactly one node w of the gene tree at which a and b are in the
+ * same clade T_i and c and d are in two further, different clades: the end of its inner path on the side of c and d.
+ * With A_i = |S1 ∩ T_i| etc., the number of quartets with topology S1S2|S3S4 is thus
+ *
+ *     p1 = sum over w, i of A_i B_i ((C - C_i)(D - D_i) - sum_{j != i} C_j D_j),
+ *
+ * where C and D are the numbers of taxa of S3 and S4 in the gene tree. p2 and p3 follow by exchanging the subtrees.
+ * The intersection sizes come from a prefix-count table of the gene tree leaves over the Euler order of the reference
+ * tree, so each gene tree needs O(n^2) time and memory for the table and O(n) per node pair for the sums.
+ * Each resolved quartet is counted once instead of twice as in the quartet table, which does not change the scores.
+ *
+ * LQ-IC scores need the counts of single quartets and are not computed. The reference tree has to be bifurcating.
+ *
+ * With resampling, the counts of each gene tree are also added to the counts of every replicate it is drawn in,
+ * weighted by its multiplicity, so that the scores of all replicates only cost one pass over the gene trees.
+ */
+class CladeIntersectionScorer {
+public:
+	CladeIntersectionScorer(Tree const &refTree, std::string const &evalTreesPath, size_t numTrees, int numThreads,
+			std::ostream &log = std::cout);
+	CladeIntersectionScorer(Tree const &refTree, GeneTreeOpener const &openEvalTrees, size_t numTrees, int numThreads,
+			std::ostream &log = std::cout, Resampling const &resampling = Resampling(),
+			EdgeSelection const &selection = EdgeSelection());
+	std::vector<double> const& getQPICScores() const;
+	std::vector<double> const& getEQPICScores() const;
+	void releaseScores(std::vector<double> &qpic, std::vector<double> &eqpic);
+	std::vector<std::vector<double>> const& getReplicateQPICScores() const;
+	std::vector<std::vector<double>> const& getReplicateEQPICScores() const;
+	std::chrono::steady_clock::duration getCountingTime() const;
+	std::chrono::steady_clock::duration getScoringTime() const;
+
+private:
+	/**
+	 * A pair of inner nodes of the reference tree and the links of its four subtrees.
+	 */
+	struct NodePair {
+		size_t u;
+		size_t v;
+		size_t lca;
+		std::array<size_t, 4> rows; /**< rows of the subtrees S1, S2, S3, S4 in the intersection table */
+	};
+
+	void collectNodePairs(EdgeSelection const &selection);
+	void addNodePair(size_t uIdx, size_t vIdx);
+	size_t subtreeRow(size_t linkIdx);
+	void countGeneTree(FlatGeneTree const &tree);
+	void buildIntersections(FlatGeneTree const &tree);
+	void countNodePair(size_t pairIdx);
+	void computeScores(uint64_t const* pairCounts, size_t stride, std::vector<double> &qpicScores,
+			std::vector<double> &eqpicScores);
+
+	Tree referenceTree; /**< the reference tree */
+	size_t rootIdx; /**< ID of the genesis root node in the reference tree */
+	TreeInformation informationReferenceTree;
+	std::vector<size_t> eulerTourLeaves;
+	std::vector<size_t> linkToEulerLeafIndex;
+	std::unordered_map<std::string, size_t> taxonToLookupID; /**< taxon name to its index in eulerTourLeaves */
+
+	std::vector<NodePair> nodePairs;
+	std::vector<size_t> linkToRow; /**< row of the subtree behind each link, or NONE */
+	std::vector<std::pair<size_t, size_t>> rowSubtrees; /**< [start, end) in eulerTourLeaves of each row, cyclic */
+	std::vector<uint64_t> counts; /**< p1, p2, p3 of each node pair, summed over the gene trees */
+	size_t replicates; /**< number of resampled replicates */
+	std::vector<uint64_t> replicateCounts; /**< p1, p2, p3 of each node pair and replicate, node pair by node pair */
+	uint32_t const* treeWeights; /**< multiplicities of the current gene tree in the replicates */
+
+	// per gene tree, reused between the trees
+	std::vector<uint32_t> prefixCounts; /**< (gene leaf index + 1) x (reference leaf index + 1) dominance counts */
+	std::vector<FlatGeneTree::Clade> clades; /**< the clades of all inner nodes of the gene tree, node by node */
+	std::vector<size_t> cladeOffsets; /**< first clade of each inner node, and the total number of clades */
+	std::vector<uint32_t> intersections; /**< row x clade intersection sizes */
+	std::vector<uint32_t> rowTotals; /**< number of gene tree taxa in the subtree of each row */
+
+	std::vector<double> QPICScores;
+	std::vector<double> EQPICScores;
+	std::vector<std::vector<double>> replicateQPICScores; /**< QP-IC scores of each replicate */
+	std::vector<std::vector<double>> replicateEQPICScores; /**< EQP-IC scores of each replicate */
+
+	std::chrono::steady_clock::duration countingTime;
+	std::chrono::steady_clock::duration scoringTime;
+
+	int numThreads; /**< threads for counting and scoring */
+
+	static const size_t NONE = static_cast<size_t>(-1);
+};
+
+/**
+ * @param refTree the reference tree, which has to be bifurcating
+ * @param evalTreesPath path to the file containing the set of evaluation trees
+ * @param numTrees number of evaluation trees, for the progress reports
+ * @param numThreads number of threads, 0 for the OpenMP default
+ * @param log where to print status messages and progress
+ */
+inline CladeIntersectionScorer::CladeIntersectionScorer(Tree const &refTree, std::string const &evalTreesPath,
+		size_t numTrees, int numThreads, std::ostream &log) :
+		CladeIntersectionScorer(refTree, geneTreeFileOpener(evalTreesPath, numThreads), numTrees, numThreads, log) {
+}
+
+/**
+ * @param refTree the reference tree, which has to be bifurcating
+ * @param openEvalTrees opens the set of evaluation trees
+ * @param numTrees number of evaluation trees, for the progress reports
+ * @param numThreads number of threads, 0 for the OpenMP default
+ * @param log where to print status messages and progress, e.g. a stream without buffer to discard them
+ * @param resampling multiplicities of the gene trees in the replicates whose scores are computed as well
+ * @param selection the edges whose scores are computed, all edges if empty. Only the node pairs relevant to them are
+ * counted.
+ */
+inline CladeIntersectionScorer::CladeIntersectionScorer(Tree const &refTree, GeneTreeOpener const &openEvalTrees,
+		size_t numTrees, int numThreads, std::ostream &log, Resampling const &resampling,
+		EdgeSelection const &selection) :
+		replicates(resampling.replicates), treeWeights(nullptr), numThreads(resolveNumThreads(numThreads)) {
+	if (!is_bifurcating(refTree)) {
+		throw std::runtime_error("The table-free scores need a bifurcating reference tree.");
+	}
+	referenceTree = refTree;
+	rootIdx = referenceTree.root_node().index();
+	informationReferenceTree.init(refTree);
+	linkToEulerLeafIndex.resize(referenceTree.link_count());
+	for (auto it : eulertour(referenceTree)) {
+		if (it.node().is_leaf()) {
+			size_t const lookupID = eulerTourLeaves.size();
+			taxonToLookupID[it.node().data<DefaultNodeData>().name] = lookupID;
+			eulerTourLeaves.push_back(it.node().index());
+		}
+		linkToEulerLeafIndex[it.link().index()] = eulerTourLeaves.size();
+	}
+	collectNodePairs(selection);
+	counts.assign(3 * nodePairs.size(), 0);
+	if (replicates > 0) {
+		log << "Counting " << replicates << " resampled replicates in "
+				<< 3 * nodePairs.size() * replicates * sizeof(uint64_t) << " bytes.\n";
+		replicateCounts.assign(3 * nodePairs.size() * replicates, 0);
+	}
+
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	{
+		ProgressReporter progress("Counting metaquartets", "metaquartets", Metrics::METAQUARTETS_SCORED,
+				nodePairs.size() * numTrees, log);
+		std::unique_ptr<GeneTreeSource> source = openEvalTrees(taxonToLookupID);
+		std::vector<FlatGeneTree> batch;
+		size_t treeIdx = 0;
+		while (true) {
+			size_t batchTrees;
+			{
+				MetricsSpan span("reading", "counting");
+				batchTrees = source->nextBatch(batch, 256);
+			}
+			if (batchTrees == 0) {
+				break;
+			}
+			for (FlatGeneTree const &tree : batch) {
+				treeWeights = replicates > 0 ? resampling.treeWeights(treeIdx) : nullptr;
+				++treeIdx;
+				countGeneTree(tree);
+			}
+		}
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	countingTime = end - begin;
+	Metrics::get_instance().addSpan("counting", "phase", begin, end);
+	log << "Finished counting metaquartets.\n";
+	Metrics::get_instance().logTime("countingMetaquartets_time", begin, end);
+
+	begin = std::chrono::steady_clock::now();
+	computeScores(counts.data(), 3, QPICScores, EQPICScores);
+	replicateQPICScores.resize(replicates);
+	replicateEQPICScores.resize(replicates);
+	for (size_t b = 0; b < replicates; ++b) {
+		computeScores(replicateCounts.data() + 3 * b, 3 * replicates, replicateQPICScores[b], replicateEQPICScores[b]);
+	}
+	if (selection.qpicOnly) {
+		// the EQP-IC scores would need all node pairs across the selected edges
+		EQPICScores.clear();
+		replicateEQPICScores.clear();
+	}
+	selection.clearUnselected(QPICScores);
+	selection.clearUnselected(EQPICScores);
+	for (size_t b = 0; b < replicates; ++b) {
+		selection.clearUnselected(replicateQPICScores[b]);
+		if (!replicateEQPICScores.empty()) {
+			selection.clearUnselected(replicateEQPICScores[b]);
+		}
+	}
+	end = std::chrono::steady_clock::now();
+	scoringTime = end - begin;
+	Metrics::get_instance().addSpan("scoring", "phase", begin, end);
+	log << "Finished computing scores.\n";
+	Metrics::get_instance().logTime("computingScores_time", begin, end);
+}
+
+inline std::vector<double> const& CladeIntersectionScorer::getQPICScores() const {
+	return QPICScores;
+}
+
+inline std::vector<double> const& CladeIntersectionScorer::getEQPICScores() const {
+	return EQPICScores;
+}
+
+/**
+ * Return the QP-IC scores of each resampled replicate, indexed by replicate and edge.
+ */
+inline std::vector<std::vector<double>> const& CladeIntersectionScorer::getReplicateQPICScores() const {
+	return replicateQPICScores;
+}
+
+/**
+ * Return the EQP-IC scores of each resampled replicate, indexed by replicate and edge.
+ */
+inline std::vector<std::vector<double>> const& CladeIntersectionScorer::getReplicateEQPICScores() const {
+	return replicateEQPICScores;
+}
+
+/**
+ * Move the QP-IC and EQP-IC scores into the given vectors. The getters return empty vectors afterwards.
+ */
+inline void CladeIntersectionScorer::releaseScores(std::vector<double> &qpic, std::vector<double> &eqpic) {
+	qpic = std::move(QPICScores);
+	eqpic = std::move(EQPICScores);
+	QPICScores.clear();
+	EQPICScores.clear();
+}
+
+inline std::chrono::steady_clock::duration CladeIntersectionScorer::getCountingTime() const {
+	return countingTime;
+}
+
+inline std::chrono::steady_clock::duration CladeIntersectionScorer::getScoringTime() const {
+	return scoringTime;
+}
+
+/**
+ * Collect the pairs of inner nodes with the subtrees of their metaquartets, as in QuartetScoreComputer::processNodePair:
+ * all pairs, or only those relevant to the selected edges.
+ */
+inline void CladeIntersectionScorer::collectNodePairs(EdgeSelection const &selection) {
+	linkToRow.assign(referenceTree.link_count(), NONE);
+	if (!selection.empty()) {
+		// only the rows of the subtrees around these pairs are added to the intersection table
+		for (std::pair<size_t, size_t> const &pair : selection.nodePairs(referenceTree)) {
+			addNodePair(pair.first, pair.second);
+		}
+		return;
+	}
+	for (size_t uIdx = 0; uIdx < referenceTree.node_count(); ++uIdx) {
+		if (!referenceTree.node_at(uIdx).is_inner())
+			continue;
+		for (size_t vIdx = uIdx + 1; vIdx < referenceTree.node_count(); ++vIdx) {
+			if (!referenceTree.node_at(vIdx).is_inner())
+				continue;
+			addNodePair(uIdx, vIdx);
+		}
+	}
+}
+
+/**
+ * Add the pair of inner nodes {u,v} with the rows of its four subtrees.
+ */
+inline void CladeIntersectionScorer::addNodePair(size_t uIdx, size_t vIdx) {
+	NodePair pair;
+	pair.u = uIdx;
+	pair.v = vIdx;
+	pair.lca = informationReferenceTree.lowestCommonAncestorIdx(uIdx, vIdx, rootIdx);
+	std::pair<size_t, size_t> innerLinks = informationReferenceTree.pathInnerLinks(uIdx, vIdx, pair.lca);
+	pair.rows[0] = subtreeRow(referenceTree.link_at(innerLinks.first).next().index());
+	pair.rows[1] = subtreeRow(referenceTree.link_at(innerLinks.first).next().next().index());
+	pair.rows[2] = subtreeRow(referenceTree.link_at(innerLinks.second).next().index());
+	pair.rows[3] = subtreeRow(referenceTree.link_at(innerLinks.second).next().next().index());
+	nodePairs.push_back(pair);
+}
+
+/**
+ * Return the row of the intersection table for the subtree behind the given link, adding it if needed.
+ */
+inline size_t CladeIntersectionScorer::subtreeRow(size_t linkIdx) {
+	if (linkToRow[linkIdx] == NONE) {
+		size_t const n = eulerTourLeaves.size();
+		linkToRow[linkIdx] = rowSubtrees.size();
+		rowSubtrees.emplace_back(linkToEulerLeafIndex[linkIdx] % n,
+				linkToEulerLeafIndex[referenceTree.link_at(linkIdx).outer().index()] % n);
+	}
+	return linkToRow[linkIdx];
+}
+
+/**
+ * Add the metaquartet counts of one gene tree to all node pairs.
+ */
+inline void CladeIntersectionScorer::countGeneTree(FlatGeneTree const &tree) {
+	if (tree.leafCount() < 4) {
+		return;
+	}
+	{
+		MetricsSpan span("intersection", "counting");
+		buildIntersections(tree);
+	}
+	MetricsSpan span("enumeration", "counting");
+#pragma omp parallel for schedule(dynamic, 16) num_threads(numThreads)
+	for (size_t pairIdx = 0; pairIdx < nodePairs.size(); ++pairIdx) {
+		countNodePair(pairIdx);
+	}
+}
+
+/**
+ * Fill the table of intersection sizes between the subtrees of the reference tree and the clades of the gene tree.
+ * The gene tree leaves are lookup IDs, i.e. indices into eulerTourLeaves, so both kinds of clades are cyclic
+ * intervals, and each intersection is a rectangle query on prefix counts.
+ */
+inline void CladeIntersectionScorer::buildIntersections(FlatGeneTree const &tree) {
+	size_t const n = eulerTourLeaves.size();
+	size_t const geneLeaves = tree.leafCount();
+	size_t const width = n + 1;
+	prefixCounts.assign((geneLeaves + 1) * width, 0);
+	for (size_t p = 0; p < geneLeaves; ++p) {
+		uint32_t const* previous = &prefixCounts[p * width];
+		uint32_t* current = &prefixCounts[(p + 1) * width];
+		size_t const leaf = tree.leaves[p];
+		for (size_t r = 0; r < width; ++r) {
+			current[r] = previous[r] + (r > leaf ? 1 : 0);
+		}
+	}
+
+	clades.clear();
+	cladeOffsets.clear();
+	std::vector<FlatGeneTree::Clade> nodeClades;
+	for (size_t j = 0; j < tree.innerNodeCount(); ++j) {
+		cladeOffsets.push_back(clades.size());
+		tree.getClades(j, nodeClades);
+		clades.insert(clades.end(), nodeClades.begin(), nodeClades.end());
+	}
+	cladeOffsets.push_back(clades.size());
+
+	// number of gene leaves in [pLo, pHi) whose reference leaf is in [rLo, rHi)
+	auto rectangle = [&](size_t pLo, size_t pHi, size_t rLo, size_t rHi) -> uint32_t {
+		return prefixCounts[pHi * width + rHi] - prefixCounts[pLo * width + rHi] - prefixCounts[pHi * width + rLo]
+				+ prefixCounts[pLo * width + rLo];
+	};
+	// the same for cyclic intervals
+	auto intersection = [&](FlatGeneTree::Clade const &gene, std::pair<size_t, size_t> const &ref) -> uint32_t {
+		uint32_t result = 0;
+		size_t const geneParts = gene.first < gene.second ? 1 : 2;
+		size_t const refParts = ref.first < ref.second ? 1 : 2;
+		for (size_t g = 0; g < geneParts; ++g) {
+			size_t const pLo = g == 0 ? gene.first : 0;
+			size_t const pHi = geneParts == 1 ? gene.second : g == 0 ? geneLeaves : gene.second;
+			for (size_t r = 0; r < refParts; ++r) {
+				size_t const rLo = r == 0 ? ref.first : 0;
+				size_t const rHi = refParts == 1 ? ref.second : r == 0 ? n : ref.second;
+				result += rectangle(pLo, pHi, rLo, rHi);
+			}
+		}
+		return result;
+	};
+
+	size_t const numClades = clades.size();
+	intersections.resize(rowSubtrees.size() * numClades);
+	rowTotals.resize(rowSubtrees.size());
+#pragma omp parallel for schedule(static) num_threads(numThreads)
+	for (size_t row = 0; row < rowSubtrees.size(); ++row) {
+		for (size_t c = 0; c < numClades; ++c) {
+			intersections[row * numClades + c] = intersection(clades[c], rowSubtrees[row]);
+		}
+		rowTotals[row] = intersection(FlatGeneTree::Clade(0, geneLeaves), rowSubtrees[row]);
+	}
+}
+
+/**
+ * Add the counts p1, p2, p3 of the current gene tree for one node pair.
+ */
+inline void CladeIntersectionScorer::countNodePair(size_t pairIdx) {
+	NodePair const &pair = nodePairs[pairIdx];
+	size_t const numClades = clades.size();
+	uint32_t const* s1 = &intersections[pair.rows[0] * numClades];
+	uint32_t const* s2 = &intersections[pair.rows[1] * numClades];
+	uint32_t const* s3 = &intersections[pair.rows[2] * numClades];
+	uint32_t const* s4 = &intersections[pair.rows[3] * numClades];
+	int64_t const t2 = rowTotals[pair.rows[1]];
+	int64_t const t3 = rowTotals[pair.rows[2]];
+	int64_t const t4 = rowTotals[pair.rows[3]];
+
+	// the sums can become negative in between, so they are computed in signed arithmetic
+	int64_t p1 = 0, p2 = 0, p3 = 0;
+	for (size_t w = 0; w + 1 < cladeOffsets.size(); ++w) {
+		size_t const first = cladeOffsets[w];
+		size_t const last = cladeOffsets[w + 1];
+		int64_t s23 = 0, s24 = 0, s34 = 0;
+		for (size_t i = first; i < last; ++i) {
+			s23 += int64_t(s2[i]) * s3[i];
+			s24 += int64_t(s2[i]) * s4[i];
+			s34 += int64_t(s3[i]) * s4[i];
+		}
+		for (size_t i = first; i < last; ++i) {
+			int64_t const a = s1[i], b = s2[i], c = s3[i], d = s4[i];
+			if (a == 0) {
+				continue;
+			}
+			// a and b together in clade i, c and d in two further clades
+			p1 += a * b * ((t3 - c) * (t4 - d) - s34 + c * d);
+			// a and c together, b and d apart
+			p2 += a * c * ((t2 - b) * (t4 - d) - s24 + b * d);
+			// a and d together, b and c apart
+			p3 += a * d * ((t2 - b) * (t3 - c) - s23 + b * c);
+		}
+	}
+	counts[3 * pairIdx] += p1;
+	counts[3 * pairIdx + 1] += p2;
+	counts[3 * pairIdx + 2] += p3;
+	if (treeWeights != nullptr) {
+		uint64_t* pairReplicates = &replicateCounts[3 * replicates * pairIdx];
+		for (size_t b = 0; b < replicates; ++b) {
+			uint64_t const weight = treeWeights[b];
+			pairReplicates[3 * b] += weight * p1;
+			pairReplicates[3 * b + 1] += weight * p2;
+			pairReplicates[3 * b + 2] += weight * p3;
+		}
+	}
+	Metrics::get_instance().add(Metrics::METAQUARTETS_SCORED, 1);
+}
+
+/**
+ * Compute the QP-IC and EQP-IC scores from the summed counts of all node pairs. Each thread keeps the EQP-IC minima
+ * of its pairs, which are merged at the end.
+ * @param pairCounts p1, p2, p3 of the first node pair
+ * @param stride distance between the counts of two consecutive node pairs
+ */
+inline void CladeIntersectionScorer::computeScores(uint64_t const* pairCounts, size_t stride,
+		std::vector<double> &qpicScores, std::vector<double> &eqpicScores) {
+	double const inf = std::numeric_limits<double>::infinity();
+	qpicScores.assign(referenceTree.edge_count(), inf);
+	eqpicScores.assign(referenceTree.edge_count(), inf);
+
+#pragma omp parallel num_threads(numThreads)
+	{
+		std::vector<double> eqpic(referenceTree.edge_count(), inf);
+#pragma omp for schedule(dynamic)
+		for (size_t pairIdx = 0; pairIdx < nodePairs.size(); ++pairIdx) {
+			NodePair const &pair = nodePairs[pairIdx];
+			uint64_t const* pc = pairCounts + stride * pairIdx;
+			double qpic = quartetLogScore(pc[0], pc[1], pc[2]);
+
+			// if u and v are neighbors, this is the QP-IC score of the edge connecting them, which no other pair sets
+			auto const& u_link = referenceTree.node_at(pair.u).link();
+			auto const& v_link = referenceTree.node_at(pair.v).link();
+			if (u_link.outer().node().index() == pair.v) {
+				qpicScores[u_link.edge().index()] = qpic;
+			} else if (v_link.outer().node().index() == pair.u) {
+				qpicScores[v_link.edge().index()] = qpic;
+			}
+
+			informationReferenceTree.forEachPathEdge(pair.u, pair.v, pair.lca, [&](size_t edgeIdx) {
+				eqpic[edgeIdx] = std::min(eqpic[edgeIdx], qpic);
+			});
+		}
+#pragma omp critical
+		for (size_t e = 0; e < referenceTree.edge_count(); ++e) {
+			eqpicScores[e] = std::min(eqpicScores[e], eqpic[e]);
+		}
+	}
+}
@@ -0,0 +1,327 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef QUARTETSCORES_ZLIB
+#include <zlib.h>
+#endif
+#ifdef QUARTETSCORES_ZSTD
+#include <zstd.h>
+#endif
+
+#include "FlatGeneTree.hpp"
+#include "GeneTreeSource.hpp"
+
+/**
+ * Compression formats of evaluation tree files.
+ */
+enum class Compression {
+	NONE, GZIP, ZSTD
+};
+
+/**
+ * Detect the compression of a file from its magic bytes.
+ */
+inline Compression detectCompression(std::string const &path) {
+	std::ifstream input(path, std::ios::binary);
+	if (!input) {
+		throw std::runtime_error("Cannot open file " + path);
+	}
+	unsigned char magic[4] = { 0, 0, 0, 0 };
+	input.read(reinterpret_cast<char*>(magic), 4);
+	if (input.gcount() >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+		return Compression::GZIP;
+	}
+	if (input.gcount() == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+		return Compression::ZSTD;
+	}
+	return Compression::NONE;
+}
+
+/**
+ * Decompresses a gzip or zstd file in a background thread. The decompressed data is handed over in chunks
+ * through a bounded queue, so that decompression runs ahead of parsing by at most maxChunks chunks.
+ */
+class DecompressionStream {
+public:
+	DecompressionStream(std::string const &path, Compression compression, size_t chunkSize = size_t(4) << 20,
+			size_t maxChunks = 4) :
+			path(path), compression(compression), chunkSize(chunkSize), maxChunks(maxChunks), finished(false),
+			stopped(false) {
+#ifndef QUARTETSCORES_ZLIB
+		if (compression == Compression::GZIP) {
+			throw std::runtime_error("Cannot read " + path + ": compiled without gzip support.");
+		}
+#endif
+#ifndef QUARTETSCORES_ZSTD
+		if (compression == Compression::ZSTD) {
+			throw std::runtime_error("Cannot read " + path + ": compiled without zstd support.");
+		}
+#endif
+		worker = std::thread(&DecompressionStream::run, this);
+	}
+
+	~DecompressionStream() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+		}
+		notFull.notify_all();
+		worker.join();
+	}
+
+	DecompressionStream(DecompressionStream const&) = delete;
+	DecompressionStream& operator=(DecompressionStream const&) = delete;
+
+	/**
+	 * Wait for the next chunk of decompressed data and store it in chunk.
+	 * Returns false at the end of the file. Errors of the background thread are rethrown here.
+	 */
+	bool next(std::string &chunk) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this] {return !chunks.empty() || finished;});
+		if (chunks.empty()) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+			return false;
+		}
+		chunk.swap(chunks.front());
+		chunks.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+private:
+	/**
+	 * Hand a decompressed chunk to the consumer. Returns false if the consumer is gone.
+	 */
+	bool push(std::string &chunk) {
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this] {return chunks.size() < maxChunks || stopped;});
+		if (stopped) {
+			return false;
+		}
+		chunks.emplace_back();
+		chunks.back().swap(chunk);
+		notEmpty.notify_one();
+		return true;
+	}
+
+	void run() {
+		try {
+			if (compression == Compression::GZIP) {
+				runGzip();
+			} else if (compression == Compression::ZSTD) {
+				runZstd();
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			error = std::current_exception();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		finished = true;
+		notEmpty.notify_all();
+	}
+
+	void runGzip() {
+#ifdef QUARTETSCORES_ZLIB
+		gzFile file = gzopen(path.c_str(), "rb");
+		if (file == nullptr) {
+			throw std::runtime_error("Cannot open file " + path);
+		}
+		gzbuffer(file, 1 << 20);
+		std::string chunk;
+		while (true) {
+			chunk.resize(chunkSize);
+			int const bytes = gzread(file, &chunk[0], chunk.size());
+			if (bytes < 0) {
+				int code;
+				std::string message = gzerror(file, &code);
+				gzclose(file);
+				throw std::runtime_error("Error while decompressing " + path + ": " + message);
+			}
+			if (bytes == 0) {
+				// the end of the file before the end of the gzip stream
+				int code;
+				std::string const message = gzerror(file, &code);
+				if (code == Z_BUF_ERROR) {
+					gzclose(file);
+					throw std::runtime_error("Error while decompressing " + path + ": " + message);
+				}
+				break;
+			}
+			chunk.resize(bytes);
+			if (!push(chunk)) {
+				break;
+			}
+		}
+		gzclose(file);
+#endif
+	}
+
+	void runZstd() {
+#ifdef QUARTETSCORES_ZSTD
+		FILE* file = std::fopen(path.c_str(), "rb");
+		if (file == nullptr) {
+			throw std::runtime_error("Cannot open file " + path);
+		}
+		ZSTD_DStream* stream = ZSTD_createDStream();
+		ZSTD_initDStream(stream);
+		std::vector<char> input(ZSTD_DStreamInSize());
+		std::string chunk;
+		bool consumerGone = false;
+		// 0 once a frame is completely decoded and flushed
+		size_t lastResult = 0;
+		size_t read;
+		while (!consumerGone && (read = std::fread(input.data(), 1, input.size(), file)) > 0) {
+			ZSTD_inBuffer in = { input.data(), read, 0 };
+			while (in.pos < in.size) {
+				size_t const used = chunk.size();
+				chunk.resize(std::max(chunkSize, used + ZSTD_DStreamOutSize()));
+				ZSTD_outBuffer out = { &chunk[0] + used, chunk.size() - used, 0 };
+				size_t const result = ZSTD_decompressStream(stream, &out, &in);
+				if (ZSTD_isError(result)) {
+					ZSTD_freeDStream(stream);
+					std::fclose(file);
+					throw std::runtime_error(
+							"Error while decompressing " + path + ": " + ZSTD_getErrorName(result));
+				}
+				lastResult = result;
+				chunk.resize(used + out.pos);
+				if (chunk.size() >= chunkSize && !push(chunk)) {
+					consumerGone = true;
+					break;
+				}
+			}
+		}
+		ZSTD_freeDStream(stream);
+		std::fclose(file);
+		if (!consumerGone && lastResult != 0) {
+			throw std::runtime_error("Error while decompressing " + path + ": the file ends within a zstd frame.");
+		}
+		if (!consumerGone && !chunk.empty()) {
+			push(chunk);
+		}
+#endif
+	}
+
+	std::string path;
+	Compression compression;
+	size_t chunkSize; /**< size of the decompressed chunks */
+	size_t maxChunks; /**< maximum number of chunks waiting in the queue */
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	std::deque<std::string> chunks;
+	bool finished; /**< the worker has decompressed the whole file */
+	bool stopped; /**< the consumer is gone, the worker should stop */
+	std::exception_ptr error;
+};
+
+/**
+ * Evaluation trees from a gzip or zstd compressed Newick file, decompressed in a background thread
+ * while the trees of the previous chunks are parsed. The trees of a batch are parsed concurrently.
+ */
+class CompressedNewickSource : public GeneTreeSource {
+public:
+	/**
+	 * @param path path to the compressed Newick file containing the evaluation trees
+	 * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+	 * @param numThreads number of parsing threads, 0 for the OpenMP default
+	 */
+	CompressedNewickSource(std::string const &path, std::unordered_map<std::string, size_t> const &taxonToLookupID,
+			int numThreads) :
+			stream(path, detectCompression(path)), parser(taxonToLookupID, numThreads), chunkPos(0), exhausted(false) {
+	}
+
+	size_t nextBatch(std::vector<FlatGeneTree> &batch, size_t maxTrees) override {
+		size_t count = 0;
+		while (count < maxTrees && nextTreeText(count)) {
+			++count;
+		}
+		texts.clear();
+		for (size_t i = 0; i < count; ++i) {
+			texts.emplace_back(treeTexts[i].data(), treeTexts[i].data() + treeTexts[i].size());
+		}
+		parser.parse(texts, batch);
+		return count;
+	}
+
+	/**
+	 * Count the trees in a compressed Newick file, without parsing them.
+	 */
+	static size_t countTrees(std::string const &path) {
+		DecompressionStream stream(path, detectCompression(path));
+		NewickScanState state;
+		std::string chunk;
+		size_t count = 0;
+		bool pendingText = false;
+		while (stream.next(chunk)) {
+			for (char c : chunk) {
+				if (state.step(c)) {
+					++count;
+					pendingText = false;
+				} else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+					pendingText = true;
+				}
+			}
+		}
+		return count + (pendingText ? 1 : 0);
+	}
+
+private:
+	/**
+	 * Collect the text of the next tree into treeTexts[index], fetching further chunks as needed.
+	 * Returns false if there is no further tree.
+	 */
+	bool nextTreeText(size_t index) {
+		if (treeTexts.size() <= index) {
+			treeTexts.resize(index + 1);
+		}
+		std::string &text = treeTexts[index];
+		text.clear();
+		while (true) {
+			if (chunkPos == chunk.size()) {
+				if (exhausted || !stream.next(chunk)) {
+					exhausted = true;
+					chunk.clear();
+					chunkPos = 0;
+					// text after the last semicolon is a tree as well, if it is not just whitespace
+					return text.find_first_not_of(" \t\n\r") != std::string::npos;
+				}
+				chunkPos = 0;
+			}
+			size_t const begin = chunkPos;
+			while (chunkPos < chunk.size()) {
+				if (state.step(chunk[chunkPos++])) {
+					text.append(chunk, begin, chunkPos - begin);
+					return true;
+				}
+			}
+			text.append(chunk, begin, chunkPos - begin);
+		}
+	}
+
+	DecompressionStream stream;
+	ParallelTreeParser parser;
+	NewickScanState state; /**< scan state at chunkPos */
+	std::string chunk; /**< current chunk of decompressed data */
+	size_t chunkPos; /**< position of the next unscanned character in chunk */
+	bool exhausted; /**< all chunks have been consumed */
+	std::vector<std::string> treeTexts; /**< texts of the trees of the current batch, reused between batches */
+	std::vector<ParallelTreeParser::TreeText> texts;
+};
@@ -0,0 +1,787 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#	include <omp.h>
+#endif
+
+#include <stxxl/vector>
+#include <stxxl/parallel_sorter_synchron>
+
+#include "FlatGeneTree.hpp"
+#include "Metrics.hpp"
+#include "TaxonPresence.hpp"
+#include "huge_page_array.hpp"
+#include "quartet_lookup_table.hpp"
+#include "packed_quartet_lookup_table.hpp"
+
+/*
+ * Storage strategies for the quartet topology counts. QuartetCounterLookup and QuartetScoreComputer take the backend
+ * as a template parameter, so that the counting and scoring loops are compiled for each backend and the backend is
+ * chosen only once, in main. Every backend provides
+ *
+ *   Backend(size_t numTaxa, HugePageMode hugePages, int numThreads, int internalMemory);
+ *   void addTree(FlatGeneTree const &tree, size_t treeIdx);    // before the quartets of each tree, from a serial section
+ *   void add(size_t a, size_t b, size_t c, size_t d, int t);  // count one occurrence of ab|cd, from thread t
+ *   void flush();                                              // after a number of trees, from a serial section
+ *   void finish(std::ostream &log);                            // after the last tree, reports the size
+ *   std::tuple<CINT, CINT, CINT> counts(size_t a, size_t b, size_t c, size_t d) const;  // ab|cd, ac|bd, ad|bc
+ *   void prefetch(size_t a, size_t b, size_t c, size_t d) const;  // hint that counts() of {a,b,c,d} follows
+ *   void countsRun(std::array<size_t, 4> quartet, size_t position, size_t const *taxa, size_t count,
+ *           std::tuple<CINT, CINT, CINT> *out) const;          // counts() with quartet[position] = each of the taxa
+ *   size_t size() const;                                       // bytes of the counts
+ *   std::vector<size_t> pagesPerNode() const;                  // see HugePageArray::pages_per_node()
+ *   static char const* name();
+ *   static const size_t PUSHED_BYTES;                          // bytes pushed into the external sorter per add()
+ *   static const bool STORES_ALL_QUARTETS;                     // needs the whole lookup table while counting
+ *   static size_t tableBytes(size_t numTaxa, size_t numTrees);  // bytes of that table, if it does
+ *
+ * The taxa are the lookup IDs of QuartetCounterLookup, i.e. the positions of the leaves in the Euler tour of the
+ * reference tree.
+ */
+
+enum class CountingBackend {
+	DENSE, /**< increment the lookup table in place */
+	SORTER, /**< push the occurrences into the external sorter and reduce the sorted runs into the lookup table */
+	PACKED, /**< like SORTER, but keep the counts bit-packed after counting */
+	SPARSE, /**< count in hash maps, which only hold the quartets that occur */
+	TILED, /**< buffer the occurrences per thread and apply them to the lookup table one tile at a time */
+	RESOLVED /**< like DENSE, but store only two counts per quartet and derive the third from the taxa of the trees */
+};
+
+inline CountingBackend parseCountingBackend(std::string const& backend) {
+	if (backend == "dense") {
+		return CountingBackend::DENSE;
+	} else if (backend == "sorter") {
+		return CountingBackend::SORTER;
+	} else if (backend == "packed") {
+		return CountingBackend::PACKED;
+	} else if (backend == "sparse") {
+		return CountingBackend::SPARSE;
+	} else if (backend == "tiled") {
+		return CountingBackend::TILED;
+	} else if (backend == "resolved") {
+		return CountingBackend::RESOLVED;
+	}
+	throw std::runtime_error("Invalid counting backend '" + backend
+			+ "'. Use dense, sorter, packed, sparse, tiled or resolved.");
+}
+
+template <typename T>
+struct my_comparator
+{
+   bool operator () (const T& a, const T& b) const
+   {
+       return a < b;
+   }
+
+   T min_value() const
+   {
+       return std::numeric_limits<T>::min();
+   }
+
+   T max_value() const
+   {
+       return std::numeric_limits<T>::max();
+   }
+};
+
+/**
+ * The number of threads to use for numThreads, which is 0 for the OpenMP default.
+ */
+inline int resolveNumThreads(int numThreads) {
+#ifdef GENESIS_OPENMP
+	if (numThreads <= 0) {
+		numThreads = omp_get_max_threads();
+	}
+#endif
+	return std::max(numThreads, 1);
+}
+
+namespace counting_backend_detail {
+
+/**
+ * Bytes of a lookup table with the given number of counts per quartet.
+ */
+template<typename CINT>
+size_t lookupTableBytes(size_t numTaxa, size_t storedCounts) {
+	return (numTaxa * (numTaxa - 1) * (numTaxa - 2) * (numTaxa - 3) / 24) * storedCounts * sizeof(CINT);
+}
+
+/**
+ * Pick the counts of ab|cd, ac|bd, and ad|bc out of the tuple of the quartet {a,b,c,d}.
+ */
+template<typename CINT, size_t StoredCounts>
+std::tuple<CINT, CINT, CINT> orderCounts(QuartetLookupTable<CINT, StoredCounts> const &index,
+		std::array<CINT, 3> const &tuple, size_t a, size_t b, size_t c, size_t d) {
+	return std::tuple<CINT, CINT, CINT>(tuple[index.tuple_index(a, b, c, d)], tuple[index.tuple_index(a, c, b, d)],
+			tuple[index.tuple_index(a, d, b, c)]);
+}
+
+/**
+ * Look up the counts of a run of quartets that differ in one taxon, one quartet at a time.
+ */
+template<typename CINT, typename Backend>
+void countsRun(Backend const &backend, std::array<size_t, 4> quartet, size_t position, size_t const *taxa,
+		size_t count, std::tuple<CINT, CINT, CINT> *out) {
+	for (size_t i = 0; i < count; ++i) {
+		quartet[position] = taxa[i];
+		out[i] = backend.counts(quartet[0], quartet[1], quartet[2], quartet[3]);
+	}
+}
+
+/**
+ * Start loading the cache line at address, without waiting for it.
+ */
+inline void prefetchRead(void const* address) {
+#if defined(__GNUC__)
+	__builtin_prefetch(address, 0, 1);
+#else
+	(void) address;
+#endif
+}
+
+} // namespace counting_backend_detail
+
+// =================================================================================================
+//     Dense
+// =================================================================================================
+
+/**
+ * Increments the counts in the O(n^4) lookup table directly. Needs no memory besides the table, but each occurrence
+ * is a random atomic update, so this is only fast while the table is small enough for the caches.
+ */
+template<typename CINT>
+class DenseBackend {
+public:
+	static const size_t PUSHED_BYTES = 0;
+	static const bool STORES_ALL_QUARTETS = true;
+
+	static size_t tableBytes(size_t numTaxa, size_t numTrees) {
+		(void) numTrees;
+		return counting_backend_detail::lookupTableBytes<CINT>(numTaxa, 3);
+	}
+
+	static char const* name() {
+		return "dense";
+	}
+
+	DenseBackend(size_t numTaxa, HugePageMode hugePages, int numThreads, int internalMemory) {
+		(void) internalMemory;
+		lookupTable.init(numTaxa, hugePages, numThreads);
+	}
+
+	void addTree(FlatGeneTree const &tree, size_t treeIdx) {
+		(void) tree;
+		(void) treeIdx;
+	}
+
+	void add(size_t a, size_t b, size_t c, size_t d, int t) {
+		(void) t;
+		CINT &count = lookupTable.get_tuple(a, b, c, d)[lookupTable.tuple_index(a, b, c, d)];
+#pragma omp atomic
+		++count;
+	}
+
+	void flush() {
+	}
+
+	void finish(std::ostream &log) {
+		log << "lookup table size in bytes: " << lookupTable.size() << "\n";
+	}
+
+	std::tuple<CINT, CINT, CINT> counts(size_t a, size_t b, size_t c, size_t d) const {
+		return counting_backend_detail::orderCounts(lookupTable, lookupTable.get_tuple(a, b, c, d), a, b, c, d);
+	}
+
+	void prefetch(size_t a, size_t b, size_t c, size_t d) const {
+		counting_backend_detail::prefetchRead(&lookupTable.get_tuple(a, b, c, d));
+	}
+
+	void countsRun(std::array<size_t, 4> const &quartet, size_t position, size_t const *taxa, size_t count,
+			std::tuple<CINT, CINT, CINT> *out) const {
+		counting_backend_detail::countsRun(*this, quartet, position, taxa, count, out);
+	}
+
+	size_t size() const {
+		return lookupTable.size();
+	}
+
+	std::vector<size_t> pagesPerNode() const {
+		return lookupTable.pages_per_node();
+	}
+
+private:
+	QuartetLookupTable<CINT> lookupTable;
+};
+
+// =================================================================================================
+//     External Sorter
+// =================================================================================================
+
+/**
+ * Pushes each occurrence as (lookup ID << 2 | tuple index) into the external sorter and reduces the sorted runs
+ * into the lookup table, so that the table is written sequentially. The sorter spills to disk beyond
+ * 2^internalMemory bytes.
+ */
+template<typename CINT>
+class SorterBackend {
+public:
+	static const size_t PUSHED_BYTES = sizeof(uint64_t);
+	static const bool STORES_ALL_QUARTETS = true;
+
+	static size_t tableBytes(size_t numTaxa, size_t numTrees) {
+		(void) numTrees;
+		return counting_backend_detail::lookupTableBytes<CINT>(numTaxa, 3);
+	}
+
+	static char const* name() {
+		return "sorter";
+	}
+
+	SorterBackend(size_t numTaxa, HugePageMode hugePages, int numThreads, int internalMemory) :
+			quartetSorter(my_comparator<uint64_t>(), static_cast<size_t>(1) << internalMemory, numThreads),
+			statsBegin(*stxxl::stats::get_instance()) {
+		lookupTable.init(numTaxa, hugePages, numThreads);
+	}
+
+	void addTree(FlatGeneTree const &tree, size_t treeIdx) {
+		(void) tree;
+		(void) treeIdx;
+	}
+
+	void add(size_t a, size_t b, size_t c, size_t d, int t) {
+		uint64_t const tuple = lookupTable.get_tuple_id(a, b, c, d);
+		quartetSorter.push((tuple << 2) + lookupTable.tuple_index(a, b, c, d), t);
+	}
+
+	void flush();
+
+	void finish(std::ostream &log) {
+		flush();
+		stxxl::stats_data statsEnd(*stxxl::stats::get_instance());
+		Metrics::get_instance().logLine("run_volumeWritten", (statsEnd - statsBegin).get_written_volume(), "bytes");
+		Metrics::get_instance().setValue("sorter_bytes_written", (statsEnd - statsBegin).get_written_volume());
+		Metrics::get_instance().setValue("sorter_bytes_read", (statsEnd - statsBegin).get_read_volume());
+		Metrics::get_instance().setValue("sorter_io_wait_seconds", (statsEnd - statsBegin).get_io_wait_time());
+		log << "lookup table size in bytes: " << lookupTable.size() << "\n";
+	}
+
+	std::tuple<CINT, CINT, CINT> counts(size_t a, size_t b, size_t c, size_t d) const {
+		return counting_backend_detail::orderCounts(lookupTable, lookupTable.get_tuple(a, b, c, d), a, b, c, d);
+	}
+
+	void prefetch(size_t a, size_t b, size_t c, size_t d) const {
+		counting_backend_detail::prefetchRead(&lookupTable.get_tuple(a, b, c, d));
+	}
+
+	void countsRun(std::array<size_t, 4> const &quartet, size_t position, size_t const *taxa, size_t count,
+			std::tuple<CINT, CINT, CINT> *out) const {
+		counting_backend_detail::countsRun(*this, quartet, position, taxa, count, out);
+	}
+
+	size_t size() const {
+		return lookupTable.size();
+	}
+
+	std::vector<size_t> pagesPerNode() const {
+		return lookupTable.pages_per_node();
+	}
+
+protected:
+	QuartetLookupTable<CINT> lookupTable;
+
+private:
+	stxxl::parallel_sorter_synchron<uint64_t, my_comparator<uint64_t> > quartetSorter;
+	stxxl::stats_data statsBegin;
+};
+
+/**
+ * Sort the occurrences pushed so far and add their counts to the lookup table.
+ */
+template<typename CINT>
+void SorterBackend<CINT>::flush() {
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point end;
+	quartetSorter.sort();
+	end = std::chrono::steady_clock::now();
+	Metrics::get_instance().logTime("sorting_time", begin, end);
+	Metrics::get_instance().addSpan("sorting", "counting", begin, end);
+	Metrics::get_instance().add(Metrics::SORTER_FLUSHES, 1);
+	begin = std::chrono::steady_clock::now();
+
+	if (quartetSorter.empty()) {
+		quartetSorter.clear();
+		return;
+	}
+
+	uint64_t tmp = *quartetSorter;
+	uint64_t mask = 3;
+	CINT counter = 0;
+	CINT counter_q1 = 0;
+	CINT counter_q2 = 0;
+	CINT counter_q3 = 0;
+	uint64_t tupleIndex = 0;
+
+	for(;!quartetSorter.empty();++quartetSorter)
+	{
+		if(tmp == *quartetSorter){
+			counter++;
+		}
+		else if((tmp >> 2) - (*quartetSorter >> 2) == 0){
+			tupleIndex = tmp & mask;
+			switch(tupleIndex){
+				case 0:
+					counter_q1 = counter;
+					break;
+				case 1:
+					counter_q2 = counter;
+					break;
+				case 2:
+					counter_q3 = counter;
+					break;
+			}
+			counter = 1;
+			tmp = *quartetSorter;
+		}
+		else{
+			tupleIndex = tmp & mask;
+			switch(tupleIndex){
+				case 0:
+					counter_q1 = counter;
+					break;
+				case 1:
+					counter_q2 = counter;
+					break;
+				case 2:
+					counter_q3 = counter;
+					break;
+			}
+			tmp &= ~(mask);
+			tmp = tmp >> 2;
+			lookupTable.update_quartet(tmp, counter_q1, counter_q2, counter_q3);
+			counter = 1;
+			counter_q1 = counter_q2 = counter_q3 = 0;
+			tmp = *quartetSorter;
+		}
+	}
+	tupleIndex = tmp & mask;
+	switch(tupleIndex){
+		case 0:
+			counter_q1 = counter;
+			break;
+		case 1:
+			counter_q2 = counter;
+			break;
+		case 2:
+			counter_q3 = counter;
+			break;
+	}
+	tmp &= ~(mask);
+	tmp = tmp >> 2;
+	lookupTable.update_quartet(tmp, counter_q1, counter_q2, counter_q3);
+	quartetSorter.clear();
+	end = std::chrono::steady_clock::now();
+	Metrics::get_instance().logTime("readingSorter_time", begin, end);
+	Metrics::get_instance().addSpan("reduction", "counting", begin, end);
+}
+
+/**
+ * Counts like SorterBackend, then moves the counts into a PackedQuartetLookupTable.
+ */
+template<typename CINT>
+class PackedBackend : public SorterBackend<CINT> {
+public:
+	static char const* name() {
+		return "packed";
+	}
+
+	PackedBackend(size_t numTaxa, HugePageMode hugePages, int numThreads, int internalMemory) :
+			SorterBackend<CINT>(numTaxa, hugePages, numThreads, internalMemory) {
+	}
+
+	void finish(std::ostream &log) {
+		SorterBackend<CINT>::finish(log);
+		packedLookupTable.init(this->lookupTable);
+		this->lookupTable.release();
+		log << "packed lookup table size in bytes: " << packedLookupTable.size() << "\n";
+	}
+
+	std::tuple<CINT, CINT, CINT> counts(size_t a, size_t b, size_t c, size_t d) const {
+		return counting_backend_detail::orderCounts(this->lookupTable,
+				packedLookupTable.get_tuple(this->lookupTable.get_tuple_id(a, b, c, d)), a, b, c, d);
+	}
+
+	void prefetch(size_t a, size_t b, size_t c, size_t d) const {
+		counting_backend_detail::prefetchRead(packedLookupTable.block_words(this->lookupTable.get_tuple_id(a, b, c, d)));
+	}
+
+	/**
+	 * The scoring loops pass runs of consecutive lookup IDs, so the counts are decoded a whole block at a time.
+	 */
+	void countsRun(std::array<size_t, 4> quartet, size_t position, size_t const *taxa, size_t count,
+			std::tuple<CINT, CINT, CINT> *out) const {
+		size_t const blockSize = PackedQuartetLookupTable<CINT>::BLOCK_SIZE;
+		std::array<std::array<CINT, 3>, PackedQuartetLookupTable<CINT>::BLOCK_SIZE> decoded;
+		size_t decodedBlock = std::numeric_limits<size_t>::max();
+		for (size_t i = 0; i < count; ++i) {
+			quartet[position] = taxa[i];
+			size_t const id = this->lookupTable.get_tuple_id(quartet[0], quartet[1], quartet[2], quartet[3]);
+			std::array<CINT, 3> tuple;
+			if (id / blockSize == decodedBlock) {
+				tuple = decoded[id % blockSize];
+			} else if (count - i >= MIN_DECODED_RUN) {
+				decodedBlock = id / blockSize;
+				packedLookupTable.decode_block(decodedBlock, decoded.data());
+				tuple = decoded[id % blockSize];
+			} else {
+				tuple = packedLookupTable.get_tuple(id);
+			}
+			out[i] = counting_backend_detail::orderCounts(this->lookupTable, tuple, quartet[0], quartet[1], quartet[2],
+					quartet[3]);
+		}
+	}
+
+	size_t size() const {
+		return packedLookupTable.size();
+	}
+
+private:
+	static const size_t MIN_DECODED_RUN = 8; /**< shorter rests of a run are decoded one quartet at a time */
+
+	PackedQuartetLookupTable<CINT> packedLookupTable;
+};
+
+// =================================================================================================
+//     Sparse
+// =================================================================================================
+
+/**
+ * Counts in a hash map per thread, which are merged into one map keyed by the lookup ID at each flush. Only the
+ * quartets that occur in some evaluation tree take memory, which pays off when the evaluation trees cover few
+ * quartets of the reference tree, e.g. with many missing taxa.
+ */
+template<typename CINT>
+class SparseBackend {
+public:
+	static const size_t PUSHED_BYTES = 0;
+	static const bool STORES_ALL_QUARTETS = false;
+
+	static size_t tableBytes(size_t numTaxa, size_t numTrees) {
+		(void) numTaxa;
+		(void) numTrees;
+		return 0;
+	}
+
+	static char const* name() {
+		return "sparse";
+	}
+
+	SparseBackend(size_t numTaxa, HugePageMode hugePages, int numThreads, int internalMemory) {
+		(void) hugePages;
+		(void) internalMemory;
+		index.init_index(numTaxa);
+		threadCounts.resize(resolveNumThreads(numThreads));
+	}
+
+	void addTree(FlatGeneTree const &tree, size_t treeIdx) {
+		(void) tree;
+		(void) treeIdx;
+	}
+
+	void add(size_t a, size_t b, size_t c, size_t d, int t) {
+		uint64_t const tuple = index.get_tuple_id(a, b, c, d);
+		++threadCounts[t][(tuple << 2) + index.tuple_index(a, b, c, d)];
+	}
+
+	void flush() {
+		MetricsSpan span("reduction", "counting");
+		for (auto &counts : threadCounts) {
+			for (auto const &entry : counts) {
+				quartetCounts[entry.first >> 2][entry.first & 3] += entry.second;
+			}
+			counts = std::unordered_map<uint64_t, CINT>();
+		}
+	}
+
+	void finish(std::ostream &log) {
+		flush();
+		log << "sparse table holds " << quartetCounts.size() << " quartets, about " << size() << " bytes\n";
+	}
+
+	std::tuple<CINT, CINT, CINT> counts(size_t a, size_t b, size_t c, size_t d) const {
+		auto it = quartetCounts.find(index.get_tuple_id(a, b, c, d));
+		if (it == quartetCounts.end()) {
+			return std::tuple<CINT, CINT, CINT>(0, 0, 0);
+		}
+		return counting_backend_detail::orderCounts(index, it->second, a, b, c, d);
+	}
+
+	void prefetch(size_t a, size_t b, size_t c, size_t d) const {
+		// the buckets of a hash map have no order to exploit
+		(void) a;
+		(void) b;
+		(void) c;
+		(void) d;
+	}
+
+	void countsRun(std::array<size_t, 4> const &quartet, size_t position, size_t const *taxa, size_t count,
+			std::tuple<CINT, CINT, CINT> *out) const {
+		counting_backend_detail::countsRun(*this, quartet, position, taxa, count, out);
+	}
+
+	std::vector<size_t> pagesPerNode() const {
+		return std::vector<size_t>();
+	}
+
+	size_t size() const {
+		// key, counts and the node and bucket pointers of each entry
+		return quartetCounts.size() * (sizeof(uint64_t) + sizeof(QuartetTuple) + 2 * sizeof(void*));
+	}
+
+private:
+	using QuartetTuple = std::array<CINT, 3>;
+
+	QuartetLookupTable<CINT> index; /**< only used for the lookup IDs */
+	std::vector<std::unordered_map<uint64_t, CINT> > threadCounts; /**< (lookup ID << 2 | tuple index) to count */
+	std::unordered_map<uint64_t, QuartetTuple> quartetCounts;
+};
+
+// =================================================================================================
+//     Tiled
+// =================================================================================================
+
+/**
+ * Buffers the occurrences per thread. A full buffer is bucketed by tiles of the lookup table, which fit into the
+ * cache, and applied tile by tile. This needs no external sorter, and the random updates of DenseBackend become
+ * updates within one tile at a time. Each thread buffers about 2^internalMemory / numThreads bytes.
+ */
+template<typename CINT>
+class TiledBackend {
+public:
+	static const size_t PUSHED_BYTES = 0;
+	static const bool STORES_ALL_QUARTETS = true;
+	static const size_t TILE_BYTES = size_t(1) << 20; /**< smallest tile of the lookup table */
+	static const size_t MAX_TILES = 4096; /**< bounds the size of the bucket histogram */
+
+	static size_t tableBytes(size_t numTaxa, size_t numTrees) {
+		(void) numTrees;
+		return counting_backend_detail::lookupTableBytes<CINT>(numTaxa, 3);
+	}
+
+	static char const* name() {
+		return "tiled";
+	}
+
+	TiledBackend(size_t numTaxa, HugePageMode hugePages, int numThreads, int internalMemory) {
+		lookupTable.init(numTaxa, hugePages, numThreads);
+
+		size_t const numQuartets = std::max(lookupTable.num_quartets(), size_t(1));
+		tileShift = 0;
+		while ((size_t(1) << tileShift) * sizeof(std::array<CINT, 3>) < TILE_BYTES
+				|| (numQuartets >> tileShift) >= MAX_TILES) {
+			++tileShift;
+		}
+		numTiles = (numQuartets >> tileShift) + 1;
+
+		buffers.resize(resolveNumThreads(numThreads));
+		// the keys and their bucketed copy
+		bufferCapacity = std::max(size_t(1) << 16,
+				(size_t(1) << internalMemory) / (2 * sizeof(uint64_t) * buffers.size()));
+	}
+
+	void addTree(FlatGeneTree const &tree, size_t treeIdx) {
+		(void) tree;
+		(void) treeIdx;
+	}
+
+	void add(size_t a, size_t b, size_t c, size_t d, int t) {
+		Buffer &buffer = buffers[t];
+		uint64_t const tuple = lookupTable.get_tuple_id(a, b, c, d);
+		buffer.keys.push_back((tuple << 2) + lookupTable.tuple_index(a, b, c, d));
+		if (buffer.keys.size() >= bufferCapacity) {
+			apply(buffer);
+		}
+	}
+
+	void flush() {
+		MetricsSpan span("reduction", "counting");
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < buffers.size(); ++i) {
+			apply(buffers[i]);
+		}
+	}
+
+	void finish(std::ostream &log) {
+		flush();
+		buffers.clear();
+		log << "lookup table size in bytes: " << lookupTable.size() << "\n";
+	}
+
+	std::tuple<CINT, CINT, CINT> counts(size_t a, size_t b, size_t c, size_t d) const {
+		return counting_backend_detail::orderCounts(lookupTable, lookupTable.get_tuple(a, b, c, d), a, b, c, d);
+	}
+
+	void prefetch(size_t a, size_t b, size_t c, size_t d) const {
+		counting_backend_detail::prefetchRead(&lookupTable.get_tuple(a, b, c, d));
+	}
+
+	void countsRun(std::array<size_t, 4> const &quartet, size_t position, size_t const *taxa, size_t count,
+			std::tuple<CINT, CINT, CINT> *out) const {
+		counting_backend_detail::countsRun(*this, quartet, position, taxa, count, out);
+	}
+
+	size_t size() const {
+		return lookupTable.size();
+	}
+
+	std::vector<size_t> pagesPerNode() const {
+		return lookupTable.pages_per_node();
+	}
+
+private:
+	struct Buffer {
+		std::vector<uint64_t> keys; /**< (lookup ID << 2 | tuple index) of each occurrence */
+		std::vector<uint64_t> bucketed;
+		std::vector<size_t> tileStart;
+	};
+
+	/**
+	 * Bucket the keys of a buffer by tile (a counting sort on the high bits of the lookup ID) and apply them.
+	 * Other threads may update the same tile, so the increments stay atomic.
+	 */
+	void apply(Buffer &buffer) {
+		buffer.tileStart.assign(numTiles + 1, 0);
+		for (uint64_t key : buffer.keys) {
+			++buffer.tileStart[(key >> (tileShift + 2)) + 1];
+		}
+		for (size_t tile = 0; tile < numTiles; ++tile) {
+			buffer.tileStart[tile + 1] += buffer.tileStart[tile];
+		}
+		buffer.bucketed.resize(buffer.keys.size());
+		for (uint64_t key : buffer.keys) {
+			buffer.bucketed[buffer.tileStart[key >> (tileShift + 2)]++] = key;
+		}
+		for (uint64_t key : buffer.bucketed) {
+			CINT &count = lookupTable.tuple_at(key >> 2)[key & 3];
+#pragma omp atomic
+			++count;
+		}
+		buffer.keys.clear();
+	}
+
+	QuartetLookupTable<CINT> lookupTable;
+	std::vector<Buffer> buffers; /**< one per thread */
+	size_t bufferCapacity; /**< occurrences per buffer */
+	unsigned tileShift; /**< a tile holds 2^tileShift quartets */
+	size_t numTiles;
+};
+
+// =================================================================================================
+//     Resolved
+// =================================================================================================
+
+/**
+ * Like DenseBackend, but keeps only the counts of the first two topologies of each quartet, which cuts the lookup
+ * table by a third. In a bifurcating evaluation tree, every quartet of its taxa has exactly one topology, which is
+ * enumerated at both ends of its inner path. So the three counts of a quartet sum up to twice the number of trees
+ * that contain its four taxa, which the presence bitsets of the taxa give. Throws if an evaluation tree has a
+ * multifurcation, as the counts of its unresolved quartets would be missing from the sum.
+ *
+ * The memory saved is paid for on every lookup: counts() intersects four bitsets of numTrees / 64 words each, so a
+ * lookup costs O(numTrees / 64) instead of O(1), which MemoryPlanner adds to the scoring time.
+ */
+template<typename CINT>
+class ResolvedBackend {
+public:
+	static const size_t PUSHED_BYTES = 0;
+	static const bool STORES_ALL_QUARTETS = true;
+
+	/**
+	 * Two counts per quartet, and one bit per taxon and tree.
+	 */
+	static size_t tableBytes(size_t numTaxa, size_t numTrees) {
+		return counting_backend_detail::lookupTableBytes<CINT>(numTaxa, 2)
+				+ numTaxa * ((numTrees + 63) / 64) * sizeof(uint64_t);
+	}
+
+	static char const* name() {
+		return "resolved";
+	}
+
+	ResolvedBackend(size_t numTaxa, HugePageMode hugePages, int numThreads, int internalMemory) :
+			presence(numTaxa) {
+		(void) internalMemory;
+		lookupTable.init(numTaxa, hugePages, numThreads);
+	}
+
+	void addTree(FlatGeneTree const &tree, size_t treeIdx) {
+		for (size_t node = 0; node < tree.innerNodeCount(); ++node) {
+			tree.getClades(node, clades);
+			if (clades.size() > 3) {
+				throw std::runtime_error("Evaluation tree " + std::to_string(treeIdx)
+						+ " is not bifurcating, which the resolved backend needs. Use another backend.");
+			}
+		}
+		presence.add(tree, treeIdx);
+	}
+
+	void add(size_t a, size_t b, size_t c, size_t d, int t) {
+		(void) t;
+		size_t const r = lookupTable.tuple_index(a, b, c, d);
+		if (r == 2) {
+			return;
+		}
+		CINT &count = lookupTable.get_tuple(a, b, c, d)[r];
+#pragma omp atomic
+		++count;
+	}
+
+	void flush() {
+	}
+
+	void finish(std::ostream &log) {
+		log << "lookup table size in bytes: " << lookupTable.size() << "\n";
+		log << "taxon presence size in bytes: " << presence.size() << "\n";
+	}
+
+	std::tuple<CINT, CINT, CINT> counts(size_t a, size_t b, size_t c, size_t d) const {
+		std::array<CINT, 2> const &stored = lookupTable.get_tuple(a, b, c, d);
+		size_t const total = 2 * presence.common(a, b, c, d);
+		std::array<CINT, 3> const tuple { { stored[0], stored[1], static_cast<CINT>(total - stored[0] - stored[1]) } };
+		return counting_backend_detail::orderCounts(lookupTable, tuple, a, b, c, d);
+	}
+
+	void prefetch(size_t a, size_t b, size_t c, size_t d) const {
+		counting_backend_detail::prefetchRead(&lookupTable.get_tuple(a, b, c, d));
+	}
+
+	void countsRun(std::array<size_t, 4> const &quartet, size_t position, size_t const *taxa, size_t count,
+			std::tuple<CINT, CINT, CINT> *out) const {
+		counting_backend_detail::countsRun(*this, quartet, position, taxa, count, out);
+	}
+
+	size_t size() const {
+		return lookupTable.size() + presence.size();
+	}
+
+	std::vector<size_t> pagesPerNode() const {
+		return lookupTable.pages_per_node();
+	}
+
+private:
+	QuartetLookupTable<CINT, 2> lookupTable;
+	TaxonPresence presence;
+	std::vector<FlatGeneTree::Clade> clades; /**< buffer of addTree() */
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "genesis/genesis.hpp"
+
+using namespace genesis;
+using namespace tree;
+
+/**
+ * The edges of the reference tree whose scores are computed, so that only the node pairs relevant to them are
+ * counted and scored. The QP-IC score of an edge only needs the node pair at its ends. The LQ-IC and EQP-IC scores of
+ * an edge are minima over all node pairs whose path contains the edge, i.e. all pairs of inner nodes on its two
+ * sides, unless only QP-IC scores are requested.
+ */
+struct EdgeSelection {
+	std::vector<size_t> edges; /**< indices of the selected edges, empty for all edges */
+	bool qpicOnly = false; /**< compute only the QP-IC scores of the selected edges */
+
+	bool empty() const {
+		return edges.empty();
+	}
+
+	/**
+	 * Select the edges given as edge indices or as clades. Each spec is either a comma-separated list of edge
+	 * indices, e.g. "edges:12,57", or a comma-separated list of the taxa on one side of an edge, e.g. "clade:A,B,C".
+	 * Without one of these prefixes, a spec of only digits is taken as edge indices, so that taxa named by numbers
+	 * need the "clade:" prefix.
+	 */
+	static EdgeSelection parse(Tree const &tree, std::vector<std::string> const &specs, bool qpicOnly) {
+		std::string const edgesPrefix = "edges:";
+		std::string const cladePrefix = "clade:";
+		EdgeSelection selection;
+		selection.qpicOnly = qpicOnly;
+		for (std::string const &original : specs) {
+			std::string spec = original;
+			bool indices;
+			if (spec.compare(0, edgesPrefix.size(), edgesPrefix) == 0) {
+				spec.erase(0, edgesPrefix.size());
+				indices = true;
+			} else if (spec.compare(0, cladePrefix.size(), cladePrefix) == 0) {
+				spec.erase(0, cladePrefix.size());
+				indices = false;
+			} else {
+				indices = std::all_of(spec.begin(), spec.end(), [](char c) {
+					return (c >= '0' && c <= '9') || c == ',' || c == ' ';
+				});
+			}
+			std::vector<std::string> items = split(spec);
+			if (items.empty()) {
+				// selecting nothing would score all edges
+				throw std::runtime_error("The edge selection '" + original + "' contains no edges.");
+			}
+			if (indices) {
+				for (std::string const &item : items) {
+					if (item.find_first_not_of("0123456789") != std::string::npos) {
+						throw std::runtime_error("'" + item + "' is not an edge index.");
+					}
+					size_t const edge = std::stoul(item);
+					if (edge >= tree.edge_count()) {
+						throw std::runtime_error("There is no edge " + item + " in the reference tree.");
+					}
+					selection.edges.push_back(edge);
+				}
+			} else {
+				selection.edges.push_back(cladeEdge(tree, items));
+			}
+		}
+		std::sort(selection.edges.begin(), selection.edges.end());
+		selection.edges.erase(std::unique(selection.edges.begin(), selection.edges.end()), selection.edges.end());
+		return selection;
+	}
+
+	/**
+	 * The pairs {u,v} of inner nodes with u < v that are relevant to the selected edges.
+	 */
+	std::vector<std::pair<size_t, size_t>> nodePairs(Tree const &tree) const {
+		std::vector<std::pair<size_t, size_t>> pairs;
+		for (size_t edgeIdx : edges) {
+			TreeEdge const &edge = tree.edge_at(edgeIdx);
+			if (qpicOnly) {
+				size_t const u = edge.primary_link().node().index();
+				size_t const v = edge.secondary_link().node().index();
+				if (tree.node_at(u).is_inner() && tree.node_at(v).is_inner()) {
+					pairs.emplace_back(std::min(u, v), std::max(u, v));
+				}
+				continue;
+			}
+			std::vector<size_t> const sideA = innerNodesBehind(edge.secondary_link());
+			std::vector<size_t> const sideB = innerNodesBehind(edge.primary_link());
+			for (size_t u : sideA) {
+				for (size_t v : sideB) {
+					pairs.emplace_back(std::min(u, v), std::max(u, v));
+				}
+			}
+		}
+		std::sort(pairs.begin(), pairs.end());
+		pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+		return pairs;
+	}
+
+	/**
+	 * Set the scores of all edges that are not selected to infinity, i.e. to not computed.
+	 */
+	void clearUnselected(std::vector<double> &scores) const {
+		if (empty()) {
+			return;
+		}
+		std::vector<double> selected(scores.size(), std::numeric_limits<double>::infinity());
+		for (size_t edge : edges) {
+			if (edge < scores.size()) {
+				selected[edge] = scores[edge];
+			}
+		}
+		scores.swap(selected);
+	}
+
+private:
+	static std::vector<std::string> split(std::string const &spec) {
+		std::vector<std::string> items;
+		std::istringstream input(spec);
+		std::string item;
+		while (std::getline(input, item, ',')) {
+			item.erase(0, item.find_first_not_of(' '));
+			item.erase(item.find_last_not_of(' ') + 1);
+			if (!item.empty()) {
+				items.push_back(item);
+			}
+		}
+		return items;
+	}
+
+	/**
+	 * The inner nodes of the subtree that is entered through the given link, including its node.
+	 */
+	static std::vector<size_t> innerNodesBehind(TreeLink const &entry) {
+		std::vector<size_t> nodes;
+		std::vector<TreeLink const*> stack { &entry };
+		while (!stack.empty()) {
+			TreeLink const &link = *stack.back();
+			stack.pop_back();
+			if (link.node().is_inner()) {
+				nodes.push_back(link.node().index());
+			}
+			for (TreeLink const* next = &link.next(); next != &link; next = &next->next()) {
+				stack.push_back(&next->outer());
+			}
+		}
+		return nodes;
+	}
+
+	/**
+	 * Find the edge that separates the given taxa from the other taxa of the tree.
+	 */
+	static size_t cladeEdge(Tree const &tree, std::vector<std::string> const &taxa) {
+		std::unordered_map<std::string, size_t> leafByName;
+		for (size_t i = 0; i < tree.node_count(); ++i) {
+			if (tree.node_at(i).is_leaf()) {
+				leafByName[tree.node_at(i).data<DefaultNodeData>().name] = i;
+			}
+		}
+		std::vector<bool> inClade(tree.node_count(), false);
+		for (std::string const &taxon : taxa) {
+			auto it = leafByName.find(taxon);
+			if (it == leafByName.end()) {
+				throw std::runtime_error("Taxon '" + taxon + "' of an edge clade is not in the reference tree.");
+			}
+			inClade[it->second] = true;
+		}
+		size_t const cladeSize = std::count(inClade.begin(), inClade.end(), true);
+		size_t const numLeaves = leafByName.size();
+
+		// the number of clade taxa and of all taxa below each node, as seen from the root
+		std::vector<size_t> cladeBelow(tree.node_count(), 0);
+		std::vector<size_t> leavesBelow(tree.node_count(), 0);
+		for (auto it : postorder(tree)) {
+			size_t const node = it.node().index();
+			if (it.node().is_leaf()) {
+				cladeBelow[node] += inClade[node];
+				leavesBelow[node] += 1;
+			}
+			if (it.is_last_iteration()) {
+				break;
+			}
+			TreeEdge const &edge = it.edge();
+			if ((cladeBelow[node] == cladeSize && leavesBelow[node] == cladeSize)
+					|| (cladeBelow[node] == 0 && leavesBelow[node] == numLeaves - cladeSize)) {
+				return edge.index();
+			}
+			size_t const parent = edge.primary_link().node().index();
+			cladeBelow[parent] += cladeBelow[node];
+			leavesBelow[parent] += leavesBelow[node];
+		}
+		throw std::runtime_error("No edge of the reference tree separates the clade " + joinTaxa(taxa) + ".");
+	}
+
+	static std::string joinTaxa(std::vector<std::string> const &taxa) {
+		std::string text;
+		for (std::string const &taxon : taxa) {
+			text += (text.empty() ? "" : ",") + taxon;
+		}
+		return text;
+	}
+};
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal representation of an evaluation tree, containing only what is needed for counting quartets.
+ *
+ * The leaves are stored as lookup IDs of the reference taxa, in the order of an Euler tour. Every clade
+ * of the tree is then a range of consecutive leaf indices. For each inner node, the boundaries s_0 < ... < s_k
+ * of its k child clades [s_0, s_1), ..., [s_{k-1}, s_k) are stored. The remaining clade of an inner node,
+ * pointing away from the root, is the cyclic range [s_k, s_0), which is empty for the root itself.
+ */
+struct FlatGeneTree {
+	using LeafId = uint32_t;
+	using Clade = std::pair<size_t, size_t>;
+
+	std::vector<LeafId> leaves; /**< lookup IDs of the leaves in Euler tour order */
+	std::vector<uint32_t> cladeOffsets; /**< for inner node i, its boundaries are at cladeBounds[cladeOffsets[i]] to cladeBounds[cladeOffsets[i+1]] */
+	std::vector<uint32_t> cladeBounds; /**< boundaries of the child clades of all inner nodes, in post order */
+
+	void clear() {
+		leaves.clear();
+		cladeOffsets.clear();
+		cladeBounds.clear();
+	}
+
+	size_t leafCount() const {
+		return leaves.size();
+	}
+
+	size_t innerNodeCount() const {
+		return cladeOffsets.empty() ? 0 : cladeOffsets.size() - 1;
+	}
+
+	/**
+	 * Store the clades induced by the given inner node in clades, as [start, end) leaf indices modulo leafCount(),
+	 * which has to be positive.
+	 * The buffer is reused, so that no allocation happens in the counting loops.
+	 */
+	void getClades(size_t innerNode, std::vector<Clade> &clades) const {
+		clades.clear();
+		size_t const first = cladeOffsets[innerNode];
+		size_t const last = cladeOffsets[innerNode + 1] - 1;
+		size_t const n = leaves.size();
+		for (size_t i = first; i < last; ++i) {
+			clades.emplace_back(cladeBounds[i] % n, cladeBounds[i + 1] % n);
+		}
+		size_t const covered = cladeBounds[last] - cladeBounds[first];
+		if (covered < n) {
+			clades.emplace_back(cladeBounds[last] % n, cladeBounds[first] % n);
+		}
+	}
+};
+
+/**
+ * Tracks quotes, comments and parentheses while scanning Newick text, so that the end of a tree
+ * (a semicolon on the top level) can be found without parsing it.
+ */
+struct NewickScanState {
+	bool inQuote = false;
+	bool inComment = false;
+	int depth = 0;
+
+	/**
+	 * Process the next character and return true if it ends a tree.
+	 */
+	bool step(char c) {
+		if (inQuote) {
+			inQuote = (c != '\'');
+		} else if (inComment) {
+			inComment = (c != ']');
+		} else if (c == '\'') {
+			inQuote = true;
+		} else if (c == '[') {
+			inComment = true;
+		} else if (c == '(') {
+			++depth;
+		} else if (c == ')') {
+			--depth;
+		} else if (c == ';' && depth == 0) {
+			return true;
+		}
+		return false;
+	}
+};
+
+/**
+ * Reads Newick trees directly into FlatGeneTree objects, bypassing the construction of genesis trees.
+ * Branch lengths, inner node labels and comments are skipped. Leaf names are mapped to lookup IDs
+ * through the interned names of the reference taxa.
+ */
+class FlatNewickReader {
+public:
+	/**
+	 * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+	 */
+	explicit FlatNewickReader(std::unordered_map<std::string, size_t> const &taxonToLookupID) :
+			taxonToLookupID(taxonToLookupID) {
+	}
+
+	/**
+	 * Read the next tree from the stream. Returns false if there is no further tree.
+	 */
+	bool readTree(std::istream &input, FlatGeneTree &tree) {
+		buffer.clear();
+		NewickScanState state;
+		std::istreambuf_iterator<char> it(input);
+		std::istreambuf_iterator<char> end;
+		for (; it != end; ++it) {
+			char const c = *it;
+			buffer.push_back(c);
+			if (state.step(c)) {
+				++it;
+				return parse(buffer.data(), buffer.data() + buffer.size(), tree);
+			}
+		}
+		return parse(buffer.data(), buffer.data() + buffer.size(), tree);
+	}
+
+	/**
+	 * Parse the first tree in [begin, end). Returns false if the text does not contain a tree.
+	 */
+	bool parse(char const* begin, char const* end, FlatGeneTree &tree) {
+		tree.clear();
+		openBounds.clear();
+		openFrames.clear();
+		char const* pos = skipSpaceAndComments(begin, end);
+		if (pos == end || *pos == ';') {
+			return false;
+		}
+
+		while (pos != end) {
+			char const c = *pos;
+			if (c == '(') {
+				openFrames.push_back(openBounds.size());
+				openBounds.push_back(tree.leaves.size());
+				++pos;
+			} else if (c == ',') {
+				if (openFrames.empty()) {
+					throw std::runtime_error("Invalid Newick tree: ',' outside of parentheses.");
+				}
+				openBounds.push_back(tree.leaves.size());
+				++pos;
+			} else if (c == ')') {
+				if (openFrames.empty()) {
+					throw std::runtime_error("Invalid Newick tree: unbalanced parentheses.");
+				}
+				openBounds.push_back(tree.leaves.size());
+				size_t const frame = openFrames.back();
+				openFrames.pop_back();
+				if (tree.cladeOffsets.empty()) {
+					tree.cladeOffsets.push_back(0);
+				}
+				tree.cladeBounds.insert(tree.cladeBounds.end(), openBounds.begin() + frame, openBounds.end());
+				tree.cladeOffsets.push_back(tree.cladeBounds.size());
+				openBounds.resize(frame);
+				// inner node labels (e.g. support values) are not needed
+				pos = skipLabel(pos + 1, end);
+				pos = skipBranchLength(pos, end);
+			} else if (c == ';') {
+				break;
+			} else {
+				pos = readLeaf(pos, end, tree);
+				pos = skipBranchLength(pos, end);
+			}
+			pos = skipSpaceAndComments(pos, end);
+		}
+		if (!openFrames.empty()) {
+			throw std::runtime_error("Invalid Newick tree: unbalanced parentheses.");
+		}
+		if (tree.leaves.empty()) {
+			// e.g. "();", whose clades cannot be taken modulo the number of leaves
+			tree.clear();
+		}
+		return true;
+	}
+
+private:
+	static bool isDelimiter(char c) {
+		return c == ',' || c == '(' || c == ')' || c == ':' || c == ';' || c == '[' || c == ' ' || c == '\t'
+				|| c == '\n' || c == '\r';
+	}
+
+	static char const* skipSpaceAndComments(char const* pos, char const* end) {
+		while (pos != end) {
+			if (*pos == '[') {
+				while (pos != end && *pos != ']') {
+					++pos;
+				}
+				if (pos != end) {
+					++pos;
+				}
+			} else if (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r') {
+				++pos;
+			} else {
+				break;
+			}
+		}
+		return pos;
+	}
+
+	/**
+	 * Read a quoted or unquoted label into the name buffer.
+	 */
+	char const* readLabel(char const* pos, char const* end) {
+		name.clear();
+		pos = skipSpaceAndComments(pos, end);
+		if (pos != end && *pos == '\'') {
+			++pos;
+			while (pos != end) {
+				if (*pos == '\'') {
+					// two single quotes are an escaped quote
+					if (pos + 1 != end && *(pos + 1) == '\'') {
+						name.push_back('\'');
+						pos += 2;
+						continue;
+					}
+					++pos;
+					break;
+				}
+				name.push_back(*pos);
+				++pos;
+			}
+		} else {
+			while (pos != end && !isDelimiter(*pos)) {
+				name.push_back(*pos);
+				++pos;
+			}
+		}
+		return skipSpaceAndComments(pos, end);
+	}
+
+	char const* skipLabel(char const* pos, char const* end) {
+		return readLabel(pos, end);
+	}
+
+	static char const* skipBranchLength(char const* pos, char const* end) {
+		pos = skipSpaceAndComments(pos, end);
+		if (pos != end && *pos == ':') {
+			++pos;
+			pos = skipSpaceAndComments(pos, end);
+			while (pos != end && !isDelimiter(*pos)) {
+				++pos;
+			}
+		}
+		return skipSpaceAndComments(pos, end);
+	}
+
+	char const* readLeaf(char const* pos, char const* end, FlatGeneTree &tree) {
+		pos = readLabel(pos, end);
+		auto it = taxonToLookupID.find(name);
+		if (it == taxonToLookupID.end()) {
+			throw std::runtime_error("Taxon '" + name + "' of an evaluation tree is not in the reference tree.");
+		}
+		tree.leaves.push_back(static_cast<FlatGeneTree::LeafId>(it->second));
+		return pos;
+	}
+
+	std::unordered_map<std::string, size_t> const &taxonToLookupID; /**< interned reference taxon names */
+	std::string buffer; /**< text of the current tree, reused between trees */
+	std::string name; /**< current label, reused between leaves */
+	std::vector<uint32_t> openBounds; /**< boundaries of the child clades of the currently open inner nodes */
+	std::vector<size_t> openFrames; /**< start of each open inner node in openBounds */
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CompressedNewickSource.hpp"
+#include "GeneTreeSource.hpp"
+#include "MappedNewickSource.hpp"
+#include "PreparedGeneTreeFile.hpp"
+
+/**
+ * Open the evaluation trees file, choosing the source by the file contents:
+ * prepared gene tree files are memory-mapped and copied without parsing, gzip or zstd compressed
+ * Newick files are decompressed while reading, and plain Newick files are memory-mapped.
+ * @param path path to the file containing the evaluation trees
+ * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+ * @param numThreads number of threads for reading, 0 for the OpenMP default
+ */
+inline std::unique_ptr<GeneTreeSource> openGeneTreeSource(std::string const &path,
+		std::unordered_map<std::string, size_t> const &taxonToLookupID, int numThreads) {
+	if (prepared_gene_trees::isPreparedFile(path)) {
+		return std::unique_ptr<GeneTreeSource>(new PreparedGeneTreeSource(path, taxonToLookupID));
+	}
+	if (detectCompression(path) != Compression::NONE) {
+		return std::unique_ptr<GeneTreeSource>(new CompressedNewickSource(path, taxonToLookupID, numThreads));
+	}
+	return std::unique_ptr<GeneTreeSource>(new MappedNewickSource(path, taxonToLookupID, numThreads));
+}
+
+/**
+ * Open the evaluation trees file with openGeneTreeSource(), once the lookup IDs are known.
+ */
+inline GeneTreeOpener geneTreeFileOpener(std::string const &path, int numThreads) {
+	return [path, numThreads](std::unordered_map<std::string, size_t> const &taxonToLookupID) {
+		return openGeneTreeSource(path, taxonToLookupID, numThreads);
+	};
+}
+
+/**
+ * Count the trees in the evaluation trees file, without parsing them.
+ * @param path path to the file containing the evaluation trees
+ * @param numThreads number of threads for splitting uncompressed files, 0 for the OpenMP default
+ */
+inline size_t countGeneTrees(std::string const &path, int numThreads) {
+	if (prepared_gene_trees::isPreparedFile(path)) {
+		return prepared_gene_trees::countTrees(path);
+	}
+	if (detectCompression(path) != Compression::NONE) {
+		return CompressedNewickSource::countTrees(path);
+	}
+	MappedFile file(path);
+	return findTreeEnds(file.data(), file.size(), numThreads).size();
+}
+
+/**
+ * The evaluation trees file, read once to count its trees. The sources opened by opener() reuse what the count
+ * needed: plain Newick files are not split into trees again, and prepared files only have their header read.
+ * Compressed files are decompressed again by each source, as the decompressed text is not kept.
+ */
+class CountedGeneTreeFile {
+public:
+	/**
+	 * @param path path to the file containing the evaluation trees
+	 * @param numThreads number of threads for reading, 0 for the OpenMP default
+	 */
+	CountedGeneTreeFile(std::string const &path, int numThreads) :
+			path(path), numThreads(numThreads) {
+		if (prepared_gene_trees::isPreparedFile(path)) {
+			numTrees = prepared_gene_trees::countTrees(path);
+		} else if (detectCompression(path) != Compression::NONE) {
+			numTrees = CompressedNewickSource::countTrees(path);
+		} else {
+			MappedFile file(path);
+			treeEnds = std::make_shared<std::vector<size_t> const>(findTreeEnds(file.data(), file.size(), numThreads));
+			numTrees = treeEnds->size();
+		}
+	}
+
+	size_t treeCount() const {
+		return numTrees;
+	}
+
+	/**
+	 * Open the file like geneTreeFileOpener(), once the lookup IDs are known.
+	 */
+	GeneTreeOpener opener() const {
+		if (!treeEnds) {
+			return geneTreeFileOpener(path, numThreads);
+		}
+		std::string const path = this->path;
+		std::shared_ptr<std::vector<size_t> const> const treeEnds = this->treeEnds;
+		int const numThreads = this->numThreads;
+		return [path, treeEnds, numThreads](std::unordered_map<std::string, size_t> const &taxonToLookupID) {
+			return std::unique_ptr<GeneTreeSource>(new MappedNewickSource(path, *treeEnds, taxonToLookupID, numThreads));
+		};
+	}
+
+private:
+	std::string path;
+	int numThreads;
+	size_t numTrees;
+	std::shared_ptr<std::vector<size_t> const> treeEnds; /**< end positions of the trees of a plain Newick file */
+};
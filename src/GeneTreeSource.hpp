@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#	include <omp.h>
+#endif
+
+#include "FlatGeneTree.hpp"
+
+/**
+ * A source of evaluation trees in their flat representation, read in batches.
+ * The trees are delivered in the order in which they appear in the input.
+ */
+class GeneTreeSource {
+public:
+	virtual ~GeneTreeSource() = default;
+
+	/**
+	 * Read up to maxTrees further trees into batch, which is resized to the number of trees read.
+	 * Trees that are empty in the input are delivered with leafCount() == 0.
+	 * Returns the number of trees read, which is 0 once the input is exhausted.
+	 */
+	virtual size_t nextBatch(std::vector<FlatGeneTree> &batch, size_t maxTrees) = 0;
+};
+
+/**
+ * Opens the evaluation trees for the given mapping of the reference taxon names to their lookup IDs, which is only
+ * known once the reference tree has been traversed.
+ */
+using GeneTreeOpener = std::function<std::unique_ptr<GeneTreeSource>(
+		std::unordered_map<std::string, size_t> const &taxonToLookupID)>;
+
+/**
+ * Parses the texts of a batch of trees concurrently, each thread with its own reader.
+ * The trees are stored at the position of their text, so that the input order is kept.
+ */
+class ParallelTreeParser {
+public:
+	using TreeText = std::pair<char const*, char const*>;
+
+	/**
+	 * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+	 * @param numThreads number of parsing threads, 0 for the OpenMP default
+	 */
+	ParallelTreeParser(std::unordered_map<std::string, size_t> const &taxonToLookupID, int numThreads) {
+		size_t numReaders = 1;
+#ifdef GENESIS_OPENMP
+		numReaders = numThreads > 0 ? numThreads : omp_get_max_threads();
+#else
+		(void) numThreads;
+#endif
+		for (size_t i = 0; i < numReaders; ++i) {
+			readers.emplace_back(new FlatNewickReader(taxonToLookupID));
+		}
+	}
+
+	/**
+	 * Parse texts[i] into batch[i]. Empty texts result in trees with leafCount() == 0.
+	 */
+	void parse(std::vector<TreeText> const &texts, std::vector<FlatGeneTree> &batch) {
+		batch.resize(texts.size());
+		int const numReaders = readers.size();
+		std::exception_ptr error;
+
+#pragma omp parallel for schedule(dynamic) num_threads(numReaders)
+		for (size_t i = 0; i < texts.size(); ++i) {
+			int tid = 0;
+#ifdef GENESIS_OPENMP
+			tid = omp_get_thread_num();
+#endif
+			try {
+				if (!readers[tid]->parse(texts[i].first, texts[i].second, batch[i])) {
+					batch[i].clear();
+				}
+			} catch (...) {
+				// exceptions must not leave the parallel region
+#pragma omp critical
+				error = std::current_exception();
+			}
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+private:
+	std::vector<std::unique_ptr<FlatNewickReader>> readers; /**< one reader per thread, as readers keep buffers */
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#	include <omp.h>
+#endif
+
+#include "genesis/genesis.hpp"
+#include "FlatGeneTree.hpp"
+#include "GeneTreeSource.hpp"
+
+using namespace genesis;
+using namespace tree;
+
+/**
+ * Converts genesis trees into FlatGeneTree objects, with the same leaf order and clades as FlatNewickReader
+ * produces for the Newick text of the tree. The traversal uses an explicit stack, so that deep trees do not
+ * overflow the call stack.
+ */
+class GeneTreeFlattener {
+public:
+	/**
+	 * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+	 */
+	explicit GeneTreeFlattener(std::unordered_map<std::string, size_t> const &taxonToLookupID) :
+			taxonToLookupID(taxonToLookupID) {
+	}
+
+	/**
+	 * Store the given tree in flat. Empty trees result in flat.leafCount() == 0.
+	 */
+	void flatten(Tree const &tree, FlatGeneTree &flat) {
+		flat.clear();
+		openBounds.clear();
+		frames.clear();
+		if (tree.empty()) {
+			return;
+		}
+		// all links of the root lead to children, the entry link of any other node leads to its parent
+		TreeLink const &rootLink = tree.root_link();
+		frames.push_back(Frame { &rootLink, &rootLink, 0 });
+		while (!frames.empty()) {
+			Frame &frame = frames.back();
+			openBounds.push_back(flat.leaves.size());
+			if (frame.next == nullptr) {
+				if (flat.cladeOffsets.empty()) {
+					flat.cladeOffsets.push_back(0);
+				}
+				flat.cladeBounds.insert(flat.cladeBounds.end(), openBounds.begin() + frame.bounds, openBounds.end());
+				flat.cladeOffsets.push_back(flat.cladeBounds.size());
+				openBounds.resize(frame.bounds);
+				frames.pop_back();
+				continue;
+			}
+			TreeLink const &child = frame.next->outer();
+			frame.next = (&frame.next->next() == frame.stop) ? nullptr : &frame.next->next();
+			if (&child.next() == &child) {
+				addLeaf(child, flat);
+			} else {
+				frames.push_back(Frame { &child.next(), &child, openBounds.size() });
+			}
+		}
+	}
+
+private:
+	/**
+	 * An open inner node: the link to its next child, or nullptr once all children are done.
+	 */
+	struct Frame {
+		TreeLink const* next;
+		TreeLink const* stop; /**< the link after the last child */
+		size_t bounds; /**< start of the node in openBounds */
+	};
+
+	void addLeaf(TreeLink const &link, FlatGeneTree &flat) {
+		std::string const &name = link.node().data<DefaultNodeData>().name;
+		auto it = taxonToLookupID.find(name);
+		if (it == taxonToLookupID.end()) {
+			throw std::runtime_error("Taxon '" + name + "' of an evaluation tree is not in the reference tree.");
+		}
+		flat.leaves.push_back(static_cast<FlatGeneTree::LeafId>(it->second));
+	}
+
+	std::unordered_map<std::string, size_t> const &taxonToLookupID;
+	std::vector<uint32_t> openBounds; /**< boundaries of the child clades of the currently open inner nodes */
+	std::vector<Frame> frames;
+};
+
+/**
+ * Delivers the evaluation trees of a range of genesis trees, which have to stay alive while the source is used.
+ * The trees of a batch are converted concurrently, each thread with its own flattener.
+ */
+template<typename Iterator>
+class TreeRangeSource : public GeneTreeSource {
+public:
+	/**
+	 * @param first begin of the range of genesis trees
+	 * @param last end of the range of genesis trees
+	 * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+	 * @param numThreads number of threads for converting the trees, 0 for the OpenMP default
+	 */
+	TreeRangeSource(Iterator first, Iterator last, std::unordered_map<std::string, size_t> const &taxonToLookupID,
+			int numThreads) :
+			current(first), last(last) {
+		size_t numFlatteners = 1;
+#ifdef GENESIS_OPENMP
+		numFlatteners = numThreads > 0 ? numThreads : omp_get_max_threads();
+#else
+		(void) numThreads;
+#endif
+		for (size_t i = 0; i < numFlatteners; ++i) {
+			flatteners.emplace_back(new GeneTreeFlattener(taxonToLookupID));
+		}
+	}
+
+	size_t nextBatch(std::vector<FlatGeneTree> &batch, size_t maxTrees) override {
+		trees.clear();
+		for (; current != last && trees.size() < maxTrees; ++current) {
+			trees.push_back(&*current);
+		}
+		batch.resize(trees.size());
+		int const numFlatteners = flatteners.size();
+		std::exception_ptr error;
+
+#pragma omp parallel for schedule(dynamic) num_threads(numFlatteners)
+		for (size_t i = 0; i < trees.size(); ++i) {
+			int tid = 0;
+#ifdef GENESIS_OPENMP
+			tid = omp_get_thread_num();
+#endif
+			try {
+				flatteners[tid]->flatten(*trees[i], batch[i]);
+			} catch (...) {
+				// exceptions must not leave the parallel region
+#pragma omp critical
+				error = std::current_exception();
+			}
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+		return trees.size();
+	}
+
+private:
+	Iterator current;
+	Iterator last;
+	std::vector<Tree const*> trees; /**< the trees of the current batch */
+	std::vector<std::unique_ptr<GeneTreeFlattener>> flatteners; /**< one per thread, as they keep buffers */
+};
+
+/**
+ * Delivers the evaluation trees of a range of Newick strings, one tree per string, which have to stay alive while
+ * the source is used. The strings are parsed in place, without copying them.
+ */
+template<typename Iterator>
+class NewickRangeSource : public GeneTreeSource {
+public:
+	/**
+	 * @param first begin of the range of Newick strings
+	 * @param last end of the range of Newick strings
+	 * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+	 * @param numThreads number of parsing threads, 0 for the OpenMP default
+	 */
+	NewickRangeSource(Iterator first, Iterator last, std::unordered_map<std::string, size_t> const &taxonToLookupID,
+			int numThreads) :
+			current(first), last(last), parser(taxonToLookupID, numThreads) {
+	}
+
+	size_t nextBatch(std::vector<FlatGeneTree> &batch, size_t maxTrees) override {
+		texts.clear();
+		for (; current != last && texts.size() < maxTrees; ++current) {
+			std::string const &text = *current;
+			texts.emplace_back(text.data(), text.data() + text.size());
+		}
+		parser.parse(texts, batch);
+		return texts.size();
+	}
+
+private:
+	Iterator current;
+	Iterator last;
+	ParallelTreeParser parser;
+	std::vector<ParallelTreeParser::TreeText> texts; /**< the texts of the current batch */
+};
+
+/**
+ * Open the genesis trees in [first, last) as evaluation trees, once the lookup IDs are known.
+ */
+template<typename Iterator>
+GeneTreeOpener treeRangeOpener(Iterator first, Iterator last, int numThreads) {
+	return [first, last, numThreads](std::unordered_map<std::string, size_t> const &taxonToLookupID) {
+		return std::unique_ptr<GeneTreeSource>(
+				new TreeRangeSource<Iterator>(first, last, taxonToLookupID, numThreads));
+	};
+}
+
+/**
+ * Open the Newick strings in [first, last) as evaluation trees, once the lookup IDs are known.
+ */
+template<typename Iterator>
+GeneTreeOpener newickRangeOpener(Iterator first, Iterator last, int numThreads) {
+	return [first, last, numThreads](std::unordered_map<std::string, size_t> const &taxonToLookupID) {
+		return std::unique_ptr<GeneTreeSource>(
+				new NewickRangeSource<Iterator>(first, last, taxonToLookupID, numThreads));
+	};
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "genesis/genesis.hpp"
+#include "Metrics.hpp"
+#include "QuartetCounterLookup.hpp"
+#include "QuartetScoreComputer.hpp"
+
+using namespace genesis;
+using namespace tree;
+
+/**
+ * Scores a bifurcating reference tree and keeps the scores of all its node pairs, so that the tree can be changed by
+ * nearest neighbor interchanges (NNI) and rescored without scoring the node pairs the move does not change, e.g.
+ * inside a tree search.
+ *
+ * An NNI around the inner edge {x,y} swaps a subtree of x with a subtree of y. The four subtrees of every node pair
+ * without x and y keep their taxa, so only the metaquartets of the node pairs with x or y are scored again. The paths
+ * between the nodes change as well, so the minima of the edges are recomputed from the stored scores of the node
+ * pairs, which needs no quartet lookups. The stored scores take 16 bytes per pair of inner nodes.
+ */
+template<typename CINT, template<typename > class Backend>
+class IncrementalScorer {
+public:
+	using Counter = QuartetCounterLookup<CINT, Backend>;
+
+	IncrementalScorer(Tree const &refTree, std::shared_ptr<Counter const> counter, int numThreads = 0);
+
+	size_t applyNNI(size_t edgeIdx, size_t swap);
+
+	/**
+	 * The current reference tree, whose edges the scores are indexed by.
+	 */
+	Tree const& tree() const {
+		return computer.referenceTree;
+	}
+
+	std::vector<double> const& getLQICScores() const {
+		return LQICScores;
+	}
+
+	std::vector<double> const& getQPICScores() const {
+		return QPICScores;
+	}
+
+	std::vector<double> const& getEQPICScores() const {
+		return EQPICScores;
+	}
+
+private:
+	/**
+	 * Position of the node pair {u,v} in pairScores, given the ranks of u and v among the inner nodes.
+	 */
+	static size_t pairIndex(size_t uRank, size_t vRank) {
+		if (uRank > vRank) {
+			std::swap(uRank, vRank);
+		}
+		return vRank * (vRank - 1) / 2 + uRank;
+	}
+
+	static void swapSubtrees(TreeLink &first, TreeLink &second);
+	void scorePairs(std::vector<std::pair<size_t, size_t>> const &pairs);
+	void updateEdgeScores();
+
+	QuartetScoreComputer<CINT, Backend> computer; /**< holds the reference tree and scores single node pairs */
+	std::vector<size_t> innerNodes; /**< IDs of the inner nodes of the reference tree */
+	std::vector<size_t> innerRank; /**< rank of each node among the inner nodes */
+	std::vector<NodePairScore> pairScores; /**< scores of all pairs of inner nodes, see pairIndex() */
+
+	std::vector<double> LQICScores;
+	std::vector<double> QPICScores;
+	std::vector<double> EQPICScores;
+};
+
+/**
+ * Score all node pairs of the reference tree.
+ * @param refTree the bifurcating reference tree, whose taxa have to be a subset of the taxa the quartets were counted for
+ * @param counter the quartet counts of the evaluation trees
+ * @param numThreads number of threads, 0 for the OpenMP default
+ */
+template<typename CINT, template<typename > class Backend>
+IncrementalScorer<CINT, Backend>::IncrementalScorer(Tree const &refTree, std::shared_ptr<Counter const> counter,
+		int numThreads) :
+		computer(std::move(counter), numThreads) {
+	if (!is_bifurcating(refTree)) {
+		throw std::runtime_error("Incremental scoring needs a bifurcating reference tree.");
+	}
+	computer.initReferenceTree(refTree);
+	computer.refIdToLookupId = computer.quartetCounterLookup->lookupIDs(computer.referenceTree);
+
+	Tree const &tree = computer.referenceTree;
+	innerRank.assign(tree.node_count(), std::numeric_limits<size_t>::max());
+	for (size_t i = 0; i < tree.node_count(); ++i) {
+		if (tree.node_at(i).is_inner()) {
+			innerRank[i] = innerNodes.size();
+			innerNodes.push_back(i);
+		}
+	}
+	pairScores.resize(innerNodes.empty() ? 0 : innerNodes.size() * (innerNodes.size() - 1) / 2);
+
+	std::vector<std::pair<size_t, size_t>> pairs;
+	pairs.reserve(pairScores.size());
+	for (size_t i = 0; i < innerNodes.size(); ++i) {
+		for (size_t j = i + 1; j < innerNodes.size(); ++j) {
+			pairs.emplace_back(innerNodes[i], innerNodes[j]);
+		}
+	}
+	scorePairs(pairs);
+	updateEdgeScores();
+}
+
+/**
+ * Apply a nearest neighbor interchange to the reference tree and update the scores. The inner edge {x,y}, with x
+ * towards the root, is kept, and the first subtree of x that is not towards the root is swapped with a subtree of y.
+ * The edges move with their subtrees, so all edges except edgeIdx keep their splits. Applying the same move again
+ * undoes it. An SPR move can be applied as a sequence of NNIs.
+ * @param edgeIdx index of the inner edge
+ * @param swap which of the two subtrees of y is swapped, 0 or 1
+ * @return the number of node pairs that were scored again
+ */
+template<typename CINT, template<typename > class Backend>
+size_t IncrementalScorer<CINT, Backend>::applyNNI(size_t edgeIdx, size_t swap) {
+	Tree &tree = computer.referenceTree;
+	if (edgeIdx >= tree.edge_count()) {
+		throw std::runtime_error("There is no edge " + std::to_string(edgeIdx) + " in the reference tree.");
+	}
+	if (swap > 1) {
+		throw std::runtime_error("An NNI swaps with one of two subtrees.");
+	}
+	TreeEdge &edge = tree.edge_at(edgeIdx);
+	TreeLink &xLink = edge.primary_link();
+	TreeLink &yLink = edge.secondary_link();
+	TreeNode &x = xLink.node();
+	TreeNode &y = yLink.node();
+	if (!x.is_inner() || !y.is_inner()) {
+		throw std::runtime_error("An NNI needs an inner edge, but edge " + std::to_string(edgeIdx) + " is a leaf edge.");
+	}
+
+	TreeLink *xSubtree = &xLink.next();
+	if (!x.is_root() && xSubtree == &x.primary_link()) {
+		xSubtree = &xSubtree->next();
+	}
+	TreeLink &ySubtree = swap == 0 ? yLink.next() : yLink.next().next();
+	swapSubtrees(*xSubtree, ySubtree);
+	computer.indexReferenceTree();
+
+	// the metaquartets of all node pairs with x or y changed
+	std::vector<std::pair<size_t, size_t>> pairs;
+	for (size_t node : innerNodes) {
+		if (node != x.index()) {
+			pairs.emplace_back(x.index(), node);
+		}
+		if (node != x.index() && node != y.index()) {
+			pairs.emplace_back(y.index(), node);
+		}
+	}
+	scorePairs(pairs);
+	updateEdgeScores();
+	return pairs.size();
+}
+
+/**
+ * Swap the subtrees behind two links, together with the edges leading to them.
+ */
+template<typename CINT, template<typename > class Backend>
+void IncrementalScorer<CINT, Backend>::swapSubtrees(TreeLink &first, TreeLink &second) {
+	TreeLink &firstOuter = first.outer();
+	TreeLink &secondOuter = second.outer();
+	TreeEdge &firstEdge = first.edge();
+	TreeEdge &secondEdge = second.edge();
+
+	first.reset_outer(&secondOuter);
+	secondOuter.reset_outer(&first);
+	first.reset_edge(&secondEdge);
+	secondEdge.reset_primary_link(&first);
+
+	second.reset_outer(&firstOuter);
+	firstOuter.reset_outer(&second);
+	second.reset_edge(&firstEdge);
+	firstEdge.reset_primary_link(&second);
+}
+
+/**
+ * Score the metaquartets of the given node pairs of the current reference tree.
+ */
+template<typename CINT, template<typename > class Backend>
+void IncrementalScorer<CINT, Backend>::scorePairs(std::vector<std::pair<size_t, size_t>> const &pairs) {
+	std::vector<NodePairScore> const scores = computer.scoreNodePairs(pairs);
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		pairScores[pairIndex(innerRank[pairs[i].first], innerRank[pairs[i].second])] = scores[i];
+	}
+}
+
+/**
+ * Recompute the scores of all edges from the stored scores of the node pairs.
+ */
+template<typename CINT, template<typename > class Backend>
+void IncrementalScorer<CINT, Backend>::updateEdgeScores() {
+	Tree const &tree = computer.referenceTree;
+	double const infinity = std::numeric_limits<double>::infinity();
+	LQICScores.assign(tree.edge_count(), infinity);
+	QPICScores.assign(tree.edge_count(), infinity);
+	EQPICScores.assign(tree.edge_count(), infinity);
+
+	for (size_t i = 0; i < tree.edge_count(); ++i) {
+		size_t const u = tree.edge_at(i).primary_link().node().index();
+		size_t const v = tree.edge_at(i).secondary_link().node().index();
+		if (tree.node_at(u).is_inner() && tree.node_at(v).is_inner()) {
+			QPICScores[i] = pairScores[pairIndex(innerRank[u], innerRank[v])].qpic;
+		}
+	}
+
+#pragma omp parallel num_threads(computer.numThreads)
+	{
+		// minima of the pairs of this thread, merged at the end
+		std::vector<double> lqic(tree.edge_count(), infinity);
+		std::vector<double> eqpic(tree.edge_count(), infinity);
+#pragma omp for schedule(dynamic)
+		for (size_t j = 1; j < innerNodes.size(); ++j) {
+			for (size_t i = 0; i < j; ++i) {
+				NodePairScore const &score = pairScores[pairIndex(i, j)];
+				size_t const lcaIdx = computer.informationReferenceTree.lowestCommonAncestorIdx(innerNodes[i],
+						innerNodes[j], computer.rootIdx);
+				computer.informationReferenceTree.forEachPathEdge(innerNodes[i], innerNodes[j], lcaIdx,
+						[&](size_t edgeIdx) {
+					lqic[edgeIdx] = std::min(lqic[edgeIdx], score.lqic);
+					eqpic[edgeIdx] = std::min(eqpic[edgeIdx], score.qpic);
+				});
+			}
+		}
+#pragma omp critical
+		for (size_t e = 0; e < tree.edge_count(); ++e) {
+			LQICScores[e] = std::min(LQICScores[e], lqic[e]);
+			EQPICScores[e] = std::min(EQPICScores[e], eqpic[e]);
+		}
+	}
+	Metrics::get_instance().add(Metrics::PATH_WALKS, pairScores.size());
+}
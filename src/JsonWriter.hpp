@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Minimal streaming JSON writer for the machine-readable reports of the tools.
+ * Commas and indentation are handled by the writer, so values can be written in any order of calls
+ * that forms valid JSON: a key() before each value inside an object, no key() inside an array.
+ */
+class JsonWriter {
+public:
+	explicit JsonWriter(std::ostream &output) :
+			output(output), afterKey(false) {
+	}
+
+	JsonWriter& beginObject() {
+		open('{');
+		return *this;
+	}
+
+	JsonWriter& endObject() {
+		close('}');
+		return *this;
+	}
+
+	JsonWriter& beginArray() {
+		open('[');
+		return *this;
+	}
+
+	JsonWriter& endArray() {
+		close(']');
+		return *this;
+	}
+
+	JsonWriter& key(std::string const &name) {
+		separate();
+		writeString(name);
+		output << ": ";
+		afterKey = true;
+		return *this;
+	}
+
+	JsonWriter& value(std::string const &text) {
+		separate();
+		writeString(text);
+		return *this;
+	}
+
+	JsonWriter& value(char const* text) {
+		return value(std::string(text));
+	}
+
+	JsonWriter& value(double number) {
+		separate();
+		// JSON has no infinity or NaN
+		if (std::isfinite(number)) {
+			char buffer[32];
+			std::snprintf(buffer, sizeof(buffer), "%.17g", number);
+			output << buffer;
+		} else {
+			output << "null";
+		}
+		return *this;
+	}
+
+	JsonWriter& value(size_t number) {
+		separate();
+		output << number;
+		return *this;
+	}
+
+	JsonWriter& value(int number) {
+		separate();
+		output << number;
+		return *this;
+	}
+
+	JsonWriter& value(bool flag) {
+		separate();
+		output << (flag ? "true" : "false");
+		return *this;
+	}
+
+	template<typename T>
+	JsonWriter& field(std::string const &name, T const &fieldValue) {
+		key(name);
+		return value(fieldValue);
+	}
+
+private:
+	void open(char bracket) {
+		separate();
+		output << bracket;
+		firstInScope.push_back(true);
+	}
+
+	void close(char bracket) {
+		bool const empty = firstInScope.back();
+		firstInScope.pop_back();
+		if (!empty) {
+			newline();
+		}
+		output << bracket;
+		if (firstInScope.empty()) {
+			output << "\n";
+		}
+	}
+
+	/**
+	 * Write the comma and line break before the next key or value.
+	 */
+	void separate() {
+		if (afterKey) {
+			afterKey = false;
+			return;
+		}
+		if (!firstInScope.empty()) {
+			if (!firstInScope.back()) {
+				output << ",";
+			}
+			firstInScope.back() = false;
+			newline();
+		}
+	}
+
+	void newline() {
+		output << "\n" << std::string(2 * firstInScope.size(), ' ');
+	}
+
+	void writeString(std::string const &text) {
+		output << '"';
+		for (char c : text) {
+			switch (c) {
+			case '"':
+				output << "\\\"";
+				break;
+			case '\\':
+				output << "\\\\";
+				break;
+			case '\n':
+				output << "\\n";
+				break;
+			case '\t':
+				output << "\\t";
+				break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20) {
+					char buffer[8];
+					std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+					output << buffer;
+				} else {
+					output << c;
+				}
+			}
+		}
+		output << '"';
+	}
+
+	std::ostream &output;
+	std::vector<bool> firstInScope; /**< for each open object or array, whether nothing was written into it yet */
+	bool afterKey; /**< a key was written, so the next value follows it directly */
+};
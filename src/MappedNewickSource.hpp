@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined( _WIN32 ) || defined(  _WIN64  )
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef GENESIS_OPENMP
+#	include <omp.h>
+#endif
+
+#include "FlatGeneTree.hpp"
+#include "GeneTreeSource.hpp"
+
+/**
+ * Read-only view of a whole file. The file is memory-mapped where possible, and read into memory otherwise.
+ */
+class MappedFile {
+public:
+	explicit MappedFile(std::string const &path) :
+			data_(nullptr), size_(0), mapped_(false) {
+#if defined( _WIN32 ) || defined(  _WIN64  )
+		readIntoBuffer(path);
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("Cannot open file " + path);
+		}
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			close(fd);
+			throw std::runtime_error("Cannot stat file " + path);
+		}
+		size_ = info.st_size;
+		if (size_ > 0) {
+			void* ptr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr == MAP_FAILED) {
+				close(fd);
+				readIntoBuffer(path);
+				return;
+			}
+			madvise(ptr, size_, MADV_SEQUENTIAL);
+			data_ = static_cast<char const*>(ptr);
+			mapped_ = true;
+		}
+		close(fd);
+#endif
+	}
+
+	~MappedFile() {
+#if defined( _WIN32 ) || defined(  _WIN64  )
+#else
+		if (mapped_) {
+			munmap(const_cast<char*>(data_), size_);
+		}
+#endif
+	}
+
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+
+	char const* data() const {
+		return data_;
+	}
+
+	size_t size() const {
+		return size_;
+	}
+
+private:
+	void readIntoBuffer(std::string const &path) {
+		std::ifstream input(path, std::ios::binary);
+		if (!input) {
+			throw std::runtime_error("Cannot open file " + path);
+		}
+		buffer_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+		data_ = buffer_.data();
+		size_ = buffer_.size();
+	}
+
+	char const* data_;
+	size_t size_;
+	bool mapped_;
+	std::string buffer_; /**< file contents if mapping is not possible */
+};
+
+/**
+ * Find the end positions (one past the terminating semicolon) of all trees in a Newick text, in parallel.
+ *
+ * The text is cut into one chunk per thread. As a chunk might start within a quoted label or a comment,
+ * each chunk is scanned once for each possible start state. Afterwards, the true start states are
+ * chained from the first chunk on, and the matching scan results are concatenated.
+ * Non-whitespace text after the last semicolon counts as a further tree.
+ */
+inline std::vector<size_t> findTreeEnds(char const* data, size_t size, int numThreads) {
+	enum ScanStart { NORMAL = 0, QUOTE = 1, COMMENT = 2 };
+	struct ChunkScan {
+		std::vector<size_t> ends[3];
+		int endState[3];
+	};
+
+#ifdef GENESIS_OPENMP
+	if (numThreads <= 0) {
+		numThreads = omp_get_max_threads();
+	}
+#endif
+	size_t numChunks = numThreads > 0 ? numThreads : 1;
+	size_t const minChunkSize = size_t(1) << 20;
+	if (size / numChunks < minChunkSize) {
+		numChunks = size / minChunkSize + 1;
+	}
+	size_t const chunkSize = (size + numChunks - 1) / numChunks;
+	std::vector<ChunkScan> scans(numChunks);
+
+#pragma omp parallel for schedule(static) num_threads(numChunks)
+	for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+		size_t const begin = std::min(chunk * chunkSize, size);
+		size_t const end = std::min(begin + chunkSize, size);
+		for (int start = NORMAL; start <= COMMENT; ++start) {
+			// Only the first chunk is known to start in the normal state.
+			if (chunk == 0 && start != NORMAL) {
+				continue;
+			}
+			NewickScanState state;
+			state.inQuote = (start == QUOTE);
+			state.inComment = (start == COMMENT);
+			for (size_t pos = begin; pos < end; ++pos) {
+				// The depth is not known within a chunk, but a semicolon outside of quotes
+				// and comments can only occur at the end of a tree anyway.
+				state.depth = 0;
+				if (state.step(data[pos])) {
+					scans[chunk].ends[start].push_back(pos + 1);
+				}
+			}
+			scans[chunk].endState[start] = state.inQuote ? QUOTE : (state.inComment ? COMMENT : NORMAL);
+		}
+	}
+
+	std::vector<size_t> treeEnds;
+	int state = NORMAL;
+	for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+		treeEnds.insert(treeEnds.end(), scans[chunk].ends[state].begin(), scans[chunk].ends[state].end());
+		state = scans[chunk].endState[state];
+	}
+
+	size_t const lastEnd = treeEnds.empty() ? 0 : treeEnds.back();
+	for (size_t pos = lastEnd; pos < size; ++pos) {
+		char const c = data[pos];
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+			treeEnds.push_back(size);
+			break;
+		}
+	}
+	return treeEnds;
+}
+
+/**
+ * Evaluation trees from a memory-mapped Newick file. The trees of a batch are parsed concurrently.
+ */
+class MappedNewickSource : public GeneTreeSource {
+public:
+	/**
+	 * @param path path to the Newick file containing the evaluation trees
+	 * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+	 * @param numThreads number of threads for splitting and parsing, 0 for the OpenMP default
+	 */
+	MappedNewickSource(std::string const &path, std::unordered_map<std::string, size_t> const &taxonToLookupID,
+			int numThreads) :
+			file(path), nextTree(0), parser(taxonToLookupID, numThreads) {
+		treeEnds = findTreeEnds(file.data(), file.size(), numThreads);
+	}
+
+	/**
+	 * Open the file with the tree ends found by an earlier findTreeEnds(), so that the file is not split again.
+	 * @param path path to the Newick file containing the evaluation trees
+	 * @param treeEnds end position of each tree in the file
+	 * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+	 * @param numThreads number of parsing threads, 0 for the OpenMP default
+	 */
+	MappedNewickSource(std::string const &path, std::vector<size_t> treeEnds,
+			std::unordered_map<std::string, size_t> const &taxonToLookupID, int numThreads) :
+			file(path), treeEnds(std::move(treeEnds)), nextTree(0), parser(taxonToLookupID, numThreads) {
+		if (!this->treeEnds.empty() && this->treeEnds.back() > file.size()) {
+			throw std::runtime_error("The evaluation trees file " + path + " changed while it was read.");
+		}
+	}
+
+	size_t treeCount() const {
+		return treeEnds.size();
+	}
+
+	size_t nextBatch(std::vector<FlatGeneTree> &batch, size_t maxTrees) override {
+		size_t const count = std::min(maxTrees, treeEnds.size() - nextTree);
+		texts.clear();
+		for (size_t tree = nextTree; tree < nextTree + count; ++tree) {
+			size_t const begin = tree == 0 ? 0 : treeEnds[tree - 1];
+			texts.emplace_back(file.data() + begin, file.data() + treeEnds[tree]);
+		}
+		parser.parse(texts, batch);
+		nextTree += count;
+		return count;
+	}
+
+private:
+	MappedFile file;
+	std::vector<size_t> treeEnds; /**< end position of each tree in the file */
+	size_t nextTree; /**< index of the first tree of the next batch */
+	ParallelTreeParser parser;
+	std::vector<ParallelTreeParser::TreeText> texts; /**< texts of the trees of the current batch */
+};
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined( _WIN32 ) || defined(  _WIN64  )
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * The memory a run may use, from the system and from the memory controller of the cgroup the process runs in.
+ * Values that could not be read are left at the maximum.
+ */
+struct MemoryLimit {
+	size_t physical = std::numeric_limits<size_t>::max(); /**< total physical memory */
+	size_t available = std::numeric_limits<size_t>::max(); /**< MemAvailable of /proc/meminfo */
+	size_t cgroupLimit = std::numeric_limits<size_t>::max(); /**< memory limit of the cgroup, including its parents */
+	size_t cgroupUsage = 0; /**< memory charged to the cgroup that cannot be reclaimed */
+
+	/**
+	 * The memory that can be allocated without being OOM-killed or swapping.
+	 */
+	size_t effective() const {
+		size_t const cgroupFree = cgroupLimit > cgroupUsage ? cgroupLimit - cgroupUsage : 0;
+		return std::min(std::min(physical, available), cgroupFree);
+	}
+
+	bool hasCgroupLimit() const {
+		return cgroupLimit < physical;
+	}
+};
+
+namespace memory_limit_detail {
+
+/**
+ * Read the first number of a file, or return false if it does not exist or holds no number (e.g. "max").
+ */
+inline bool readNumber(std::string const &path, size_t &value) {
+	std::ifstream input(path);
+	unsigned long long number;
+	if (!(input >> number)) {
+		return false;
+	}
+	value = number;
+	return true;
+}
+
+/**
+ * Read a "key value" line of a file like memory.stat or /proc/meminfo.
+ */
+inline bool readKey(std::string const &path, std::string const &key, size_t &value) {
+	std::ifstream input(path);
+	std::string name;
+	unsigned long long number;
+	while (input >> name >> number) {
+		if (name == key) {
+			value = number;
+			return true;
+		}
+		input.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+	}
+	return false;
+}
+
+/**
+ * Return the path of the cgroup of this process for the given controller ("" for cgroup v2), or "-" if there is none.
+ */
+inline std::string cgroupPath(std::string const &controller) {
+	std::ifstream input("/proc/self/cgroup");
+	std::string line;
+	while (std::getline(input, line)) {
+		size_t const first = line.find(':');
+		size_t const second = line.find(':', first + 1);
+		if (first == std::string::npos || second == std::string::npos) {
+			continue;
+		}
+		std::string const controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+		if ((controller.empty() && controllers == ",,") || controllers.find("," + controller + ",") != std::string::npos) {
+			return line.substr(second + 1);
+		}
+	}
+	return "-";
+}
+
+/**
+ * Apply the limits of the cgroup directory and all of its parents below the mount point. Inside a container, the
+ * path in /proc/self/cgroup usually does not exist, and the mount point is the cgroup of the container itself.
+ */
+inline void readCgroup(std::string const &mount, std::string path, std::string const &limitFile,
+		std::string const &usageFile, std::string const &reclaimableKey, MemoryLimit &limit) {
+	while (true) {
+		std::string const dir = mount + path;
+		size_t value;
+		if (readNumber(dir + "/" + limitFile, value) && value < limit.cgroupLimit) {
+			limit.cgroupLimit = value;
+			size_t usage = 0;
+			size_t reclaimable = 0;
+			if (readNumber(dir + "/" + usageFile, usage)) {
+				readKey(dir + "/memory.stat", reclaimableKey, reclaimable);
+				limit.cgroupUsage = usage > reclaimable ? usage - reclaimable : 0;
+			}
+		}
+		if (path.empty() || path == "/") {
+			return;
+		}
+		size_t const slash = path.find_last_of('/');
+		path = slash == std::string::npos ? "" : path.substr(0, slash);
+	}
+}
+
+} // namespace memory_limit_detail
+
+/**
+ * Read the memory limits of the system and of the cgroup (v1 or v2) the process runs in.
+ */
+inline MemoryLimit readMemoryLimit() {
+	MemoryLimit limit;
+#if defined( _WIN32 ) || defined(  _WIN64  )
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	GlobalMemoryStatusEx(&status);
+	limit.physical = status.ullTotalPhys;
+	limit.available = status.ullAvailPhys;
+#else
+	using namespace memory_limit_detail;
+	limit.physical = static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+	size_t availableKiB;
+	if (readKey("/proc/meminfo", "MemAvailable:", availableKiB)) {
+		limit.available = availableKiB * 1024;
+	}
+
+	std::string const v2Path = cgroupPath("");
+	if (v2Path != "-") {
+		readCgroup("/sys/fs/cgroup", v2Path, "memory.max", "memory.current", "inactive_file", limit);
+	}
+	std::string const v1Path = cgroupPath("memory");
+	if (v1Path != "-") {
+		readCgroup("/sys/fs/cgroup/memory", v1Path, "memory.limit_in_bytes", "memory.usage_in_bytes",
+				"total_inactive_file", limit);
+	}
+	// cgroup v1 reports "no limit" as a huge number
+	if (limit.cgroupLimit >= limit.physical) {
+		limit.cgroupLimit = std::numeric_limits<size_t>::max();
+		limit.cgroupUsage = 0;
+	}
+#endif
+	return limit;
+}
+
+/**
+ * A configuration of the counting engine with its predicted peak memory and runtime.
+ */
+struct EnginePlan {
+	std::string engine; /**< the counting backend, as for --backend */
+	int internalMemory; /**< -i, the sorter or buffer memory is 2^internalMemory bytes, 0 if the backend has none */
+	size_t countingBytes; /**< peak memory while counting */
+	size_t scoringBytes; /**< peak memory while scoring */
+	double countingSeconds;
+	double scoringSeconds;
+	bool fits; /**< the peak memory is below the effective limit */
+	bool automatic = true; /**< the engine may be chosen by best(), false if it has to be asked for explicitly */
+
+	size_t peakBytes() const {
+		return std::max(countingBytes, scoringBytes);
+	}
+
+	double totalSeconds() const {
+		return countingSeconds + scoringSeconds;
+	}
+};
+
+/**
+ * Predicts the memory and runtime of the counting backends and their budgets for n taxa and m evaluation trees,
+ * and picks the fastest configuration that fits into the memory limit.
+ *
+ * The work is bounded from above by assuming that every evaluation tree is bifurcating and has all n taxa, i.e.
+ * 2 * C(n,4) quartet occurrences per tree. The costs per operation are rough figures for a current x86 core;
+ * QuartetScoresBench measures the actual ones.
+ */
+class MemoryPlanner {
+public:
+	static constexpr double PUSH_NS = 4; /**< push of one quartet occurrence into the sorter, per thread */
+	static constexpr double SORT_NS = 2; /**< per element and level of the parallel in-memory sort */
+	static constexpr double REDUCE_NS = 3; /**< serial readout of one sorted occurrence into the table */
+	static constexpr double DISK_BYTES_PER_SECOND = 200e6; /**< external sorter I/O when a run does not fit */
+	static const size_t SORTER_BLOCK_BYTES = size_t(2) << 20; /**< block size of the stxxl sorter */
+	static constexpr double DENSE_CACHED_NS = 3; /**< atomic increment of a table that fits into the cache, per thread */
+	static constexpr double DENSE_RANDOM_NS = 40; /**< atomic increment that misses the cache, per thread */
+	static const size_t CACHE_BYTES = size_t(32) << 20; /**< last level cache */
+	static constexpr double TILED_NS = 6; /**< bucketing of one buffered occurrence and its update in a tile */
+	static const size_t TILED_MIN_BUFFER = size_t(1) << 20; /**< smallest buffer per thread in bytes */
+	static constexpr double SPARSE_NS = 40; /**< hash map increment, per thread */
+	static constexpr double SPARSE_MERGE_NS = 50; /**< serial merge of one hash map entry at a flush */
+	static const size_t HASH_ENTRY_BYTES = 32; /**< key, pointers and allocation overhead of a hash map entry */
+	static constexpr double SCORE_NS = 60; /**< lookup, LCA queries and path walk of one quartet, per thread */
+	static constexpr double PACKED_SCORE_FACTOR = 1.2; /**< bit unpacking on each lookup */
+	static constexpr double SPARSE_SCORE_FACTOR = 2; /**< hash map instead of table lookups */
+	static constexpr double PRESENCE_WORD_NS = 0.5; /**< AND and popcount of one 64-tree word of four presence bitsets */
+	static constexpr double HEADROOM = 0.9; /**< part of the limit that is planned for */
+	static const size_t TREES_PER_REDUCTION = 250; /**< as in QuartetCounterLookup::countQuartets */
+	static const int MIN_INTERNAL_MEMORY = 24;
+	static const int MAX_INTERNAL_MEMORY = 40;
+
+	/**
+	 * @param numTaxa number of taxa in the reference tree
+	 * @param numTrees number of evaluation trees
+	 * @param countBytes size of one quartet count (sizeof(CINT))
+	 * @param numThreads number of threads
+	 * @param limit the memory limits
+	 */
+	MemoryPlanner(size_t numTaxa, size_t numTrees, size_t countBytes, int numThreads, MemoryLimit const &limit) :
+			numTaxa(numTaxa), numTrees(numTrees), countBytes(countBytes), numThreads(std::max(numThreads, 1)),
+			limit(limit) {
+		plans.push_back(predict("dense", 0));
+		for (char const *engine : { "sorter", "packed", "tiled" }) {
+			EnginePlan best;
+			bool found = false;
+			for (int internalMemory = MIN_INTERNAL_MEMORY; internalMemory <= MAX_INTERNAL_MEMORY; ++internalMemory) {
+				EnginePlan plan = predict(engine, internalMemory);
+				// prefer fitting plans, then faster ones, then smaller ones
+				if (!found || (plan.fits && !best.fits)
+						|| (plan.fits == best.fits && plan.totalSeconds() < best.totalSeconds() * 0.999)) {
+					best = plan;
+					found = true;
+				}
+			}
+			plans.push_back(best);
+		}
+		plans.push_back(predict("sparse", 0));
+		plans.push_back(predict("resolved", 0));
+	}
+
+	/**
+	 * The best configuration of each engine.
+	 */
+	std::vector<EnginePlan> const& candidates() const {
+		return plans;
+	}
+
+	/**
+	 * The fastest configuration that fits, or the smallest one if none fits. Only automatic plans are chosen.
+	 */
+	EnginePlan const& best() const {
+		size_t bestIdx = 0;
+		for (size_t i = 1; i < plans.size(); ++i) {
+			EnginePlan const &plan = plans[i];
+			EnginePlan const &current = plans[bestIdx];
+			if (!plan.automatic) {
+				continue;
+			}
+			bool const better = current.fits ?
+					plan.fits && plan.totalSeconds() < current.totalSeconds() : plan.fits
+							|| plan.peakBytes() < current.peakBytes();
+			if (better) {
+				bestIdx = i;
+			}
+		}
+		return plans[bestIdx];
+	}
+
+	/**
+	 * Predict the memory and runtime of one configuration.
+	 * @param engine the counting backend
+	 * @param internalMemory log2 of the sorter or buffer memory, ignored by the dense and sparse backends
+	 */
+	EnginePlan predict(std::string const &engine, int internalMemory) const {
+		bool const sorter = (engine == "sorter" || engine == "packed");
+		bool const packed = (engine == "packed");
+		EnginePlan plan;
+		plan.engine = engine;
+		plan.internalMemory = (sorter || engine == "tiled") ? internalMemory : 0;
+
+		double const n = numTaxa;
+		double const quartets = n * (n - 1) * (n - 2) * (n - 3) / 24;
+		size_t const tableBytes = quartets * 3 * countBytes;
+		size_t const packedBytes = quartets * 3 * countBits() / 8;
+		double const occurrences = 2 * quartets * numTrees;
+		size_t const treesPerRun = numTrees < TREES_PER_REDUCTION ? numTrees : TREES_PER_REDUCTION;
+		double const runOccurrences = 2 * quartets * treesPerRun;
+		double seconds = 0;
+
+		if (sorter) {
+			size_t const sorterBytes = size_t(1) << internalMemory;
+			// the unpacked table is only released after the packed copy is built
+			plan.countingBytes = tableBytes + std::max(sorterBytes, packed ? packedBytes : 0);
+			plan.scoringBytes = packed ? packedBytes : tableBytes;
+
+			double const runBytes = runOccurrences * sizeof(uint64_t);
+			seconds += occurrences * PUSH_NS * 1e-9 / numThreads;
+			seconds += occurrences * SORT_NS * 1e-9 * std::log2(std::max(runOccurrences, 2.0)) / numThreads;
+			seconds += occurrences * REDUCE_NS * 1e-9;
+			if (runBytes > sorterBytes) {
+				// the sorter writes runs of its memory size and merges them in passes, each reading and writing all data
+				double const runs = std::ceil(runBytes / sorterBytes);
+				double const fanIn = std::max(2.0, static_cast<double>(sorterBytes / SORTER_BLOCK_BYTES));
+				double const passes = std::ceil(std::log(runs) / std::log(fanIn));
+				seconds += 2 * (1 + passes) * occurrences * sizeof(uint64_t) / DISK_BYTES_PER_SECOND;
+			}
+		} else if (engine == "tiled") {
+			// each thread holds its keys and their bucketed copy
+			size_t const bufferBytes = std::max(size_t(1) << internalMemory, numThreads * 2 * TILED_MIN_BUFFER);
+			plan.countingBytes = tableBytes + bufferBytes;
+			plan.scoringBytes = tableBytes;
+			seconds += occurrences * (PUSH_NS + TILED_NS) * 1e-9 / numThreads;
+		} else if (engine == "sparse") {
+			// every quartet may occur; each thread holds at most the distinct occurrences of one run
+			double const threadEntries = std::min(3 * quartets, runOccurrences / numThreads);
+			plan.scoringBytes = quartets * (HASH_ENTRY_BYTES + 3 * countBytes);
+			plan.countingBytes = plan.scoringBytes + numThreads * threadEntries * (HASH_ENTRY_BYTES + countBytes);
+			double const runs = std::ceil(static_cast<double>(numTrees) / TREES_PER_REDUCTION);
+			seconds += occurrences * SPARSE_NS * 1e-9 / numThreads;
+			seconds += runs * numThreads * threadEntries * SPARSE_MERGE_NS * 1e-9;
+		} else if (engine == "resolved") {
+			// two of the three counts, and one bit per taxon and tree
+			size_t const resolvedBytes = quartets * 2 * countBytes + numTaxa * presenceWords() * sizeof(uint64_t);
+			plan.countingBytes = resolvedBytes;
+			plan.scoringBytes = resolvedBytes;
+			seconds += occurrences * (resolvedBytes <= CACHE_BYTES ? DENSE_CACHED_NS : DENSE_RANDOM_NS) * 1e-9
+					/ numThreads;
+			// needs bifurcating evaluation trees, which are only known to be while counting
+			plan.automatic = false;
+		} else {
+			plan.countingBytes = tableBytes;
+			plan.scoringBytes = tableBytes;
+			seconds += occurrences * (tableBytes <= CACHE_BYTES ? DENSE_CACHED_NS : DENSE_RANDOM_NS) * 1e-9 / numThreads;
+		}
+		plan.fits = plan.peakBytes() <= HEADROOM * limit.effective();
+		plan.countingSeconds = seconds;
+		plan.scoringSeconds = quartets * SCORE_NS * 1e-9 / numThreads;
+		if (packed) {
+			plan.scoringSeconds *= PACKED_SCORE_FACTOR;
+		} else if (engine == "sparse") {
+			plan.scoringSeconds *= SPARSE_SCORE_FACTOR;
+		} else if (engine == "resolved") {
+			// each lookup intersects the presence bitsets of the four taxa
+			plan.scoringSeconds += quartets * presenceWords() * PRESENCE_WORD_NS * 1e-9 / numThreads;
+		}
+		return plan;
+	}
+
+	/**
+	 * Print the limits and the predictions of all backends, marking the chosen one.
+	 */
+	void print(std::ostream &output) const {
+		output << "Memory limit (bytes):\n";
+		output << "  Physical: " << limit.physical << "\n";
+		output << "  Available: " << limit.available << "\n";
+		if (limit.hasCgroupLimit()) {
+			output << "  cgroup limit: " << limit.cgroupLimit << " (" << limit.cgroupUsage << " in use)\n";
+		} else {
+			output << "  cgroup limit: none\n";
+		}
+		output << "  Effective: " << limit.effective() << "\n";
+		output << "Predicted for " << numTaxa << " taxa, " << numTrees << " evaluation trees and " << numThreads
+				<< " threads:\n";
+		EnginePlan const &chosen = best();
+		for (EnginePlan const &plan : plans) {
+			char line[256];
+			std::snprintf(line, sizeof(line),
+					"  %c %-8s %5s  counting %8.2f GiB %10.1f s   scoring %8.2f GiB %10.1f s  %s%s\n",
+					&plan == &chosen ? '*' : ' ', plan.engine.c_str(), internalMemoryColumn(plan).c_str(),
+					plan.countingBytes / 1073741824.0, plan.countingSeconds, plan.scoringBytes / 1073741824.0,
+					plan.scoringSeconds, plan.fits ? "fits" : "does not fit",
+					plan.automatic ? "" : ", only with --backend");
+			output << line;
+		}
+	}
+
+private:
+	static std::string internalMemoryColumn(EnginePlan const &plan) {
+		return plan.internalMemory > 0 ? "-i " + std::to_string(plan.internalMemory) : "";
+	}
+
+	/**
+	 * Bits of the largest count, which bound the width of the packed blocks.
+	 */
+	unsigned countBits() const {
+		unsigned bits = 1;
+		while (bits < 64 && (uint64_t(1) << bits) <= 2 * numTrees) {
+			++bits;
+		}
+		return bits;
+	}
+
+	/**
+	 * Words of the presence bitset of a taxon, one bit per evaluation tree.
+	 */
+	size_t presenceWords() const {
+		return (numTrees + 63) / 64;
+	}
+
+	size_t numTaxa;
+	size_t numTrees;
+	size_t countBytes;
+	int numThreads;
+	MemoryLimit limit;
+	std::vector<EnginePlan> plans;
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#	include <omp.h>
+#endif
+
+#include "JsonWriter.hpp"
+
+/**
+ * Collects counters and timed phases of a run, for a JSON summary and a Chrome trace-event file
+ * (to be opened in chrome://tracing or Perfetto).
+ *
+ * Counters are kept per OpenMP thread number and padded against false sharing, so that the counting and scoring
+ * loops update them without contention. They are added to atomically, as the computations of different std::threads,
+ * e.g. concurrent library calls, share the thread numbers. The loops add their work in bulk (e.g. once per clade
+ * triple or node pair), never per quartet. Phases are recorded as spans, which are only created a few times per batch
+ * or thread, and only while recordSpans() is on, so that long-running processes do not accumulate them.
+ * The timings of the main phases are also passed as lines to the function set with setTimingLog(), if any.
+ */
+class Metrics {
+public:
+	enum Counter {
+		QUARTETS_ENUMERATED, /**< quartet occurrences pushed while counting */
+		BYTES_PUSHED, /**< bytes pushed into the external sorter */
+		SORTER_FLUSHES, /**< flushes of the sorter, each sorting its pushed quartets into the lookup table */
+		TABLE_LOOKUPS, /**< quartet count lookups while scoring */
+		PATH_WALKS, /**< walks along a path of the reference tree to update scores */
+		METAQUARTETS_SCORED, /**< node pairs of the reference tree processed while scoring */
+		NUM_COUNTERS
+	};
+
+	/**
+	 * The process-wide instance, as for stxxl::stats.
+	 */
+	static Metrics& get_instance() {
+		static Metrics instance;
+		return instance;
+	}
+
+	/**
+	 * Clear all counters and spans and restart the clock.
+	 * @param numThreads number of threads that will update counters, 0 for the OpenMP default
+	 */
+	void reset(int numThreads = 0) {
+#ifdef GENESIS_OPENMP
+		if (numThreads <= 0) {
+			numThreads = omp_get_max_threads();
+		}
+#endif
+		numThreadCounters = std::max(numThreads, 1);
+		threadCounters.reset(new ThreadCounters[numThreadCounters]);
+		for (int counter = 0; counter < NUM_COUNTERS; ++counter) {
+			for (size_t i = 0; i < numThreadCounters; ++i) {
+				threadCounters[i].values[counter].store(0, std::memory_order_relaxed);
+			}
+			overflow[counter].store(0, std::memory_order_relaxed);
+		}
+		spans.clear();
+		values.clear();
+		start = std::chrono::steady_clock::now();
+	}
+
+	/**
+	 * Record the phases from now on, for writeSummary() and writeTrace(). Off by default.
+	 */
+	void recordSpans(bool on) {
+		recording.store(on, std::memory_order_relaxed);
+	}
+
+	/**
+	 * Add to a counter of the calling thread.
+	 */
+	void add(Counter counter, uint64_t value) {
+		int const tid = threadId();
+		if (static_cast<size_t>(tid) < numThreadCounters) {
+			threadCounters[tid].values[counter].fetch_add(value, std::memory_order_relaxed);
+		} else {
+			// more threads than announced in reset()
+			overflow[counter].fetch_add(value, std::memory_order_relaxed);
+		}
+	}
+
+	static char const* counterName(int counter) {
+		static char const* const names[NUM_COUNTERS] = { "quartets_enumerated", "bytes_pushed", "sorter_flushes",
+				"table_lookups", "path_walks", "metaquartets_scored" };
+		return names[counter];
+	}
+
+	uint64_t total(Counter counter) const {
+		uint64_t sum = overflow[counter].load(std::memory_order_relaxed);
+		for (size_t i = 0; i < numThreadCounters; ++i) {
+			sum += threadCounters[i].values[counter].load(std::memory_order_relaxed);
+		}
+		return sum;
+	}
+
+	/**
+	 * Record a phase that ran from begin to end on the calling thread.
+	 */
+	void addSpan(std::string const &name, std::string const &category, std::chrono::steady_clock::time_point begin,
+			std::chrono::steady_clock::time_point end) {
+		if (!recording.load(std::memory_order_relaxed)) {
+			return;
+		}
+		Span span { name, category, microseconds(begin), microseconds(end) - microseconds(begin), threadId() };
+		std::lock_guard<std::mutex> lock(mutex);
+		spans.push_back(span);
+	}
+
+	/**
+	 * Record a single measured value, e.g. an I/O volume.
+	 */
+	void setValue(std::string const &name, double value) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto &entry : values) {
+			if (entry.first == name) {
+				entry.second = value;
+				return;
+			}
+		}
+		values.emplace_back(name, value);
+	}
+
+	/**
+	 * Pass the timing lines, e.g. "[counting_time] [42 us]", to a log function from now on, or to none for an empty
+	 * one (the default). The programs send them to easylogging, which the library neither configures nor uses.
+	 */
+	void setTimingLog(std::function<void(std::string const &)> timingLog) {
+		std::lock_guard<std::mutex> lock(mutex);
+		this->timingLog = std::move(timingLog);
+	}
+
+	/**
+	 * Log the time of a phase that ran from begin to end.
+	 */
+	void logTime(std::string const &name, std::chrono::steady_clock::time_point begin,
+			std::chrono::steady_clock::time_point end) {
+		logLine(name, std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count(), "us");
+	}
+
+	/**
+	 * Log a measured amount, e.g. an I/O volume in bytes.
+	 */
+	void logLine(std::string const &name, uint64_t amount, std::string const &unit) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (timingLog) {
+			timingLog("[" + name + "] [" + std::to_string(amount) + " " + unit + "]");
+		}
+	}
+
+	/**
+	 * Write the totals of the phases and counters, the counters per thread, and the recorded values.
+	 */
+	void writeSummary(JsonWriter &json) const {
+		std::vector<std::string> names;
+		std::vector<double> seconds;
+		std::vector<size_t> counts;
+		for (Span const &span : spans) {
+			size_t const pos = std::find(names.begin(), names.end(), span.name) - names.begin();
+			if (pos == names.size()) {
+				names.push_back(span.name);
+				seconds.push_back(0);
+				counts.push_back(0);
+			}
+			seconds[pos] += span.duration / 1e6;
+			++counts[pos];
+		}
+
+		json.beginObject();
+		json.key("phases").beginObject();
+		for (size_t i = 0; i < names.size(); ++i) {
+			json.key(names[i]).beginObject();
+			// spans of several threads overlap, so this is the summed time of all threads
+			json.field("seconds", seconds[i]);
+			json.field("count", counts[i]);
+			json.endObject();
+		}
+		json.endObject();
+		json.key("counters").beginObject();
+		for (int counter = 0; counter < NUM_COUNTERS; ++counter) {
+			json.field(counterName(counter), static_cast<size_t>(total(static_cast<Counter>(counter))));
+		}
+		json.endObject();
+		json.key("threads").beginArray();
+		for (size_t i = 0; i < numThreadCounters; ++i) {
+			json.beginObject();
+			for (int counter = 0; counter < NUM_COUNTERS; ++counter) {
+				json.field(counterName(counter), static_cast<size_t>(threadCounters[i].values[counter].load()));
+			}
+			json.endObject();
+		}
+		json.endArray();
+		json.key("values").beginObject();
+		for (auto const &entry : values) {
+			json.field(entry.first, entry.second);
+		}
+		json.endObject();
+		json.endObject();
+	}
+
+	void writeSummary(std::string const &path) const {
+		std::ofstream output(path);
+		if (!output) {
+			throw std::runtime_error("Cannot write file " + path);
+		}
+		JsonWriter json(output);
+		writeSummary(json);
+	}
+
+	/**
+	 * Write all spans in the Chrome trace-event format, one complete event per span.
+	 */
+	void writeTrace(std::string const &path) const {
+		std::ofstream output(path);
+		if (!output) {
+			throw std::runtime_error("Cannot write file " + path);
+		}
+		JsonWriter json(output);
+		json.beginObject();
+		json.key("traceEvents").beginArray();
+		for (Span const &span : spans) {
+			json.beginObject();
+			json.field("name", span.name);
+			json.field("cat", span.category);
+			json.field("ph", "X");
+			json.field("ts", span.begin);
+			json.field("dur", span.duration);
+			json.field("pid", 1);
+			json.field("tid", span.tid);
+			json.endObject();
+		}
+		json.endArray();
+		json.field("displayTimeUnit", "ms");
+		json.endObject();
+	}
+
+private:
+	struct ThreadCounters {
+		std::atomic<uint64_t> values[NUM_COUNTERS];
+		char padding[64]; /**< keeps the counters of different threads in different cache lines */
+	};
+
+	struct Span {
+		std::string name;
+		std::string category;
+		size_t begin; /**< microseconds since reset() */
+		size_t duration; /**< microseconds */
+		int tid;
+	};
+
+	Metrics() :
+			recording(false) {
+		reset();
+	}
+
+	static int threadId() {
+#ifdef GENESIS_OPENMP
+		return omp_get_thread_num();
+#else
+		return 0;
+#endif
+	}
+
+	size_t microseconds(std::chrono::steady_clock::time_point time) const {
+		return std::chrono::duration_cast<std::chrono::microseconds>(time - start).count();
+	}
+
+	std::unique_ptr<ThreadCounters[]> threadCounters;
+	size_t numThreadCounters;
+	std::atomic<uint64_t> overflow[NUM_COUNTERS]; /**< counters of threads beyond those announced in reset() */
+	std::atomic<bool> recording; /**< whether addSpan() records */
+	std::vector<Span> spans;
+	std::vector<std::pair<std::string, double>> values;
+	std::function<void(std::string const &)> timingLog; /**< receives the lines of logTime() and logLine() */
+	std::mutex mutex; /**< guards spans, values and timingLog */
+	std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * Records the lifetime of the object as a phase of the calling thread.
+ */
+class MetricsSpan {
+public:
+	MetricsSpan(std::string const &name, std::string const &category) :
+			name(name), category(category), begin(std::chrono::steady_clock::now()) {
+	}
+
+	~MetricsSpan() {
+		Metrics::get_instance().addSpan(name, category, begin, std::chrono::steady_clock::now());
+	}
+
+	MetricsSpan(MetricsSpan const&) = delete;
+	MetricsSpan& operator=(MetricsSpan const&) = delete;
+
+private:
+	std::string name;
+	std::string category;
+	std::chrono::steady_clock::time_point begin;
+};
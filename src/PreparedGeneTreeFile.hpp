@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "FlatGeneTree.hpp"
+#include "GeneTreeSource.hpp"
+#include "MappedNewickSource.hpp"
+
+/**
+ * Binary file of evaluation trees that were already parsed into their flat representation.
+ *
+ * Layout, all integers in native byte order:
+ *   header:  magic "QSGTREE1", uint32 number of taxa, uint32 reserved, uint64 number of trees
+ *   taxa:    for each lookup ID, uint32 name length and the name, padded to a multiple of 4 bytes
+ *   trees:   for each tree, uint32 leaf count L, uint32 offset count O, uint32 bound count B,
+ *            followed by L leaves, O clade offsets and B clade bounds, each as uint32
+ *
+ * The taxon names make the file independent of the order of the reference taxa, so it can be used
+ * with any reference tree on the same taxa.
+ */
+namespace prepared_gene_trees {
+
+static char const MAGIC[8] = { 'Q', 'S', 'G', 'T', 'R', 'E', 'E', '1' };
+static size_t const HEADER_SIZE = 24;
+
+/**
+ * Return true if the file starts with the magic bytes of a prepared gene tree file.
+ */
+inline bool isPreparedFile(std::string const &path) {
+	std::ifstream input(path, std::ios::binary);
+	if (!input) {
+		throw std::runtime_error("Cannot open file " + path);
+	}
+	char magic[8];
+	input.read(magic, 8);
+	return input.gcount() == 8 && std::memcmp(magic, MAGIC, 8) == 0;
+}
+
+/**
+ * Convert the evaluation trees read from source into a prepared gene tree file.
+ * @param source the evaluation trees, with leaves given as lookup IDs
+ * @param taxa taxon names, indexed by lookup ID
+ * @param outputPath path of the file to write
+ * @return the number of trees written
+ */
+inline size_t write(GeneTreeSource &source, std::vector<std::string> const &taxa, std::string const &outputPath) {
+	std::ofstream output(outputPath, std::ios::binary);
+	if (!output) {
+		throw std::runtime_error("Cannot write file " + outputPath);
+	}
+	auto writeU32 = [&output](uint32_t value) {
+		output.write(reinterpret_cast<char const*>(&value), sizeof(value));
+	};
+	auto writeArray = [&output](std::vector<uint32_t> const &values) {
+		output.write(reinterpret_cast<char const*>(values.data()), values.size() * sizeof(uint32_t));
+	};
+
+	uint64_t numTrees = 0;
+	output.write(MAGIC, 8);
+	writeU32(taxa.size());
+	writeU32(0);
+	output.write(reinterpret_cast<char const*>(&numTrees), sizeof(numTrees));
+	for (std::string const &name : taxa) {
+		writeU32(name.size());
+		output.write(name.data(), name.size());
+		char const padding[4] = { 0, 0, 0, 0 };
+		output.write(padding, (4 - name.size() % 4) % 4);
+	}
+
+	std::vector<FlatGeneTree> batch;
+	while (source.nextBatch(batch, 256) > 0) {
+		for (FlatGeneTree const &tree : batch) {
+			writeU32(tree.leaves.size());
+			writeU32(tree.cladeOffsets.size());
+			writeU32(tree.cladeBounds.size());
+			writeArray(tree.leaves);
+			writeArray(tree.cladeOffsets);
+			writeArray(tree.cladeBounds);
+			++numTrees;
+		}
+	}
+
+	// the number of trees is only known now
+	output.seekp(16);
+	output.write(reinterpret_cast<char const*>(&numTrees), sizeof(numTrees));
+	if (!output) {
+		throw std::runtime_error("Error while writing " + outputPath);
+	}
+	return numTrees;
+}
+
+/**
+ * Read the number of trees from the header of a prepared gene tree file.
+ */
+inline size_t countTrees(std::string const &path) {
+	std::ifstream input(path, std::ios::binary);
+	char header[HEADER_SIZE];
+	input.read(header, HEADER_SIZE);
+	if (input.gcount() != static_cast<std::streamsize>(HEADER_SIZE) || std::memcmp(header, MAGIC, 8) != 0) {
+		throw std::runtime_error("Invalid prepared gene tree file " + path);
+	}
+	uint64_t numTrees;
+	std::memcpy(&numTrees, header + 16, sizeof(numTrees));
+	return numTrees;
+}
+
+} // namespace prepared_gene_trees
+
+/**
+ * Evaluation trees from a memory-mapped prepared gene tree file. The trees are copied out of the mapping
+ * without any parsing; leaf IDs are only translated if the reference tree orders its taxa differently.
+ */
+class PreparedGeneTreeSource : public GeneTreeSource {
+public:
+	/**
+	 * @param path path to the prepared gene tree file
+	 * @param taxonToLookupID mapping of the reference taxon names to their lookup IDs
+	 */
+	PreparedGeneTreeSource(std::string const &path, std::unordered_map<std::string, size_t> const &taxonToLookupID) :
+			path(path), file(path), pos(prepared_gene_trees::HEADER_SIZE), nextTree(0), identity(true) {
+		if (file.size() < prepared_gene_trees::HEADER_SIZE
+				|| std::memcmp(file.data(), prepared_gene_trees::MAGIC, 8) != 0) {
+			throw std::runtime_error("Invalid prepared gene tree file " + path);
+		}
+		uint32_t numTaxa;
+		std::memcpy(&numTaxa, file.data() + 8, sizeof(numTaxa));
+		std::memcpy(&numTrees, file.data() + 16, sizeof(numTrees));
+
+		fileIdToLookupID.resize(numTaxa);
+		for (uint32_t id = 0; id < numTaxa; ++id) {
+			uint32_t const length = readU32();
+			require(length);
+			std::string name(file.data() + pos, length);
+			pos += (length + 3) / 4 * 4;
+			auto it = taxonToLookupID.find(name);
+			if (it == taxonToLookupID.end()) {
+				throw std::runtime_error("Taxon '" + name + "' of the prepared gene trees is not in the reference tree.");
+			}
+			fileIdToLookupID[id] = it->second;
+			identity = identity && (it->second == id);
+		}
+	}
+
+	size_t treeCount() const {
+		return numTrees;
+	}
+
+	size_t nextBatch(std::vector<FlatGeneTree> &batch, size_t maxTrees) override {
+		size_t const count = std::min<uint64_t>(maxTrees, numTrees - nextTree);
+		batch.resize(count);
+		for (FlatGeneTree &tree : batch) {
+			uint32_t const numLeaves = readU32();
+			uint32_t const numOffsets = readU32();
+			uint32_t const numBounds = readU32();
+			readArray(numLeaves, tree.leaves);
+			readArray(numOffsets, tree.cladeOffsets);
+			readArray(numBounds, tree.cladeBounds);
+			for (FlatGeneTree::LeafId &leaf : tree.leaves) {
+				if (leaf >= fileIdToLookupID.size()) {
+					throw std::runtime_error("Invalid leaf in prepared gene tree file " + path);
+				}
+				if (!identity) {
+					leaf = fileIdToLookupID[leaf];
+				}
+			}
+			checkClades(tree);
+		}
+		nextTree += count;
+		return count;
+	}
+
+private:
+	/**
+	 * Check that the tree has leaves if it has inner nodes, and that the clades of each inner node are increasing leaf
+	 * ranges, so that the counting loops cannot index outside of the tree.
+	 */
+	void checkClades(FlatGeneTree const &tree) const {
+		std::vector<uint32_t> const &offsets = tree.cladeOffsets;
+		std::vector<uint32_t> const &bounds = tree.cladeBounds;
+		// the clades are taken modulo the number of leaves, so inner nodes need at least one leaf
+		bool valid = offsets.empty() ? bounds.empty()
+				: (!tree.leaves.empty() && offsets.front() == 0 && offsets.back() == bounds.size());
+		for (size_t node = 0; valid && node + 1 < offsets.size(); ++node) {
+			// every inner node has at least one boundary
+			valid = offsets[node] < offsets[node + 1];
+			for (size_t i = offsets[node]; valid && i < offsets[node + 1]; ++i) {
+				valid = bounds[i] <= tree.leaves.size() && (i == offsets[node] || bounds[i - 1] <= bounds[i]);
+			}
+		}
+		if (!valid) {
+			throw std::runtime_error("Invalid prepared gene tree file " + path);
+		}
+	}
+
+	void require(size_t bytes) const {
+		if (pos + bytes > file.size()) {
+			throw std::runtime_error("Truncated prepared gene tree file " + path);
+		}
+	}
+
+	uint32_t readU32() {
+		require(sizeof(uint32_t));
+		uint32_t value;
+		std::memcpy(&value, file.data() + pos, sizeof(value));
+		pos += sizeof(value);
+		return value;
+	}
+
+	void readArray(size_t count, std::vector<uint32_t> &values) {
+		size_t const bytes = count * sizeof(uint32_t);
+		require(bytes);
+		values.resize(count);
+		std::memcpy(values.data(), file.data() + pos, bytes);
+		pos += bytes;
+	}
+
+	std::string path;
+	MappedFile file;
+	size_t pos; /**< read position in the file */
+	uint64_t numTrees;
+	uint64_t nextTree; /**< index of the next tree to read */
+	std::vector<uint32_t> fileIdToLookupID; /**< lookup ID of each taxon of the file */
+	bool identity; /**< the file uses the lookup IDs of the reference tree */
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Metrics.hpp"
+
+/**
+ * Prints the progress of a phase at a fixed interval from a separate thread, so that the worker threads only
+ * update their Metrics counters. The progress is the increase of one counter since the reporter was created,
+ * against a total that may be refined while the phase runs. Each line shows the throughput and the estimated
+ * time until the total is reached.
+ */
+class ProgressReporter {
+public:
+	/**
+	 * Start reporting, unless the interval is 0.
+	 * @param label name of the phase, e.g. "Counting quartets"
+	 * @param unit name of the unit of work, e.g. "quartets"
+	 * @param counter the counter that measures the work done
+	 * @param total the total amount of work, or an estimate of it
+	 * @param output where to print, no reports are printed if it has no stream buffer
+	 */
+	ProgressReporter(std::string const &label, std::string const &unit, Metrics::Counter counter, uint64_t total,
+			std::ostream &output = std::cout) :
+			label(label), unit(unit), counter(counter), start(Metrics::get_instance().total(counter)),
+			total(total), begin(std::chrono::steady_clock::now()), output(output), stopped(false) {
+		if (interval().count() > 0 && output.rdbuf()) {
+			reporter = std::thread(&ProgressReporter::run, this);
+		}
+	}
+
+	~ProgressReporter() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+		}
+		wakeup.notify_one();
+		if (reporter.joinable()) {
+			reporter.join();
+		}
+	}
+
+	ProgressReporter(ProgressReporter const&) = delete;
+	ProgressReporter& operator=(ProgressReporter const&) = delete;
+
+	/**
+	 * Replace the total amount of work, e.g. when the sizes of more gene trees are known.
+	 */
+	void setTotal(uint64_t newTotal) {
+		total.store(newTotal, std::memory_order_relaxed);
+	}
+
+	/**
+	 * The work done since the reporter was created.
+	 */
+	uint64_t done() const {
+		return Metrics::get_instance().total(counter) - start;
+	}
+
+	/**
+	 * Time between two progress lines, 0 to disable them. Applies to reporters created afterwards.
+	 */
+	static std::chrono::milliseconds& interval() {
+		static std::chrono::milliseconds value(10000);
+		return value;
+	}
+
+private:
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!wakeup.wait_for(lock, interval(), [this] {return stopped;})) {
+			print();
+		}
+	}
+
+	void print() const {
+		uint64_t const workDone = done();
+		uint64_t const workTotal = std::max(total.load(std::memory_order_relaxed), workDone);
+		double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		double const rate = workDone / seconds;
+
+		char line[256];
+		int length = std::snprintf(line, sizeof(line), "%s... %.1f%% (%llu of %llu %s, %.3g %s/s", label.c_str(),
+				workTotal > 0 ? 100.0 * workDone / workTotal : 0.0, static_cast<unsigned long long>(workDone),
+				static_cast<unsigned long long>(workTotal), unit.c_str(), rate, unit.c_str());
+		if (rate > 0 && length > 0 && static_cast<size_t>(length) < sizeof(line)) {
+			unsigned long long const eta = (workTotal - workDone) / rate + 0.5;
+			std::snprintf(line + length, sizeof(line) - length, ", ETA %lluh %02llum %02llus", eta / 3600,
+					eta / 60 % 60, eta % 60);
+		}
+		output << line << ")" << std::endl;
+	}
+
+	std::string label;
+	std::string unit;
+	Metrics::Counter counter;
+	uint64_t start; /**< value of the counter when the reporter was created */
+	std::atomic<uint64_t> total;
+	std::chrono::steady_clock::time_point begin;
+	std::ostream &output;
+
+	std::thread reporter;
+	std::mutex mutex; /**< guards stopped */
+	std::condition_variable wakeup;
+	bool stopped;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * Compute qic = 1 + p_q1 * log(p_q1) + p_q2 * log(p_q2) + p_q3 * log(p_q3)
+ * Take into account corner cases when one or more values are zero.
+ * Let ab|cd be the topology of the quartet {a,b,c,d} in the reference tree.
+ * @param q1 count of the quartet topology ab|cd
+ * @param q2 count of the quartet topology ac|bd
+ * @param q3 count of the quartet topology ad|bc
+ */
+inline double quartetLogScore(size_t q1, size_t q2, size_t q3) {
+	if (q1 == 0 && q2 == 0 && q3 == 0)
+		return 0;
+
+	size_t sum = q1 + q2 + q3;
+	double p_q1 = (double) q1 / sum;
+	double p_q2 = (double) q2 / sum;
+	double p_q3 = (double) q3 / sum;
+
+	// qic = 1 + p_q1 * log(p_q1) + p_q2 * log(p_q2) + p_q3 * log(p_q3);
+	double qic = 1;
+	if (p_q1 != 0)
+		qic += p_q1 * log(p_q1) / log(3);
+	if (p_q2 != 0)
+		qic += p_q2 * log(p_q2) / log(3);
+	if (p_q3 != 0)
+		qic += p_q3 * log(p_q3) / log(3);
+
+	if (q1 < q2 || q1 < q3) {
+		return qic * -1;
+	} else {
+		return qic;
+	}
+}
+
+/**
+ * Computes the QIC scores of quartets from their counts without calling log(), see quartetLogScore().
+ *
+ * With s = q1 + q2 + q3 and p_i = q_i / s, the sum of p_i * log(p_i) is (q1 log q1 + q2 log q2 + q3 log q3 - s log s) / s.
+ * The counts are integers and their sum is at most m, so x log x is tabulated for x = 0, ..., m, and a score costs
+ * four table lookups and one division. The scores of a block of quartets are computed from count arrays, one per
+ * topology, in a loop without branches that the compiler can vectorize. Beyond MAX_TABLE entries, the scores are
+ * computed by quartetLogScore() instead.
+ */
+class QicKernel {
+public:
+	static const size_t BLOCK = 256; /**< quartets per block of minScore() */
+	static const size_t MAX_TABLE = size_t(1) << 20; /**< 8 MiB of x log x */
+
+	QicKernel() = default;
+
+	/**
+	 * @param maxSum the largest sum of the three counts of a quartet, i.e. m
+	 */
+	explicit QicKernel(size_t maxSum) {
+		if (maxSum < MAX_TABLE) {
+			xLogX.resize(maxSum + 1);
+			xLogX[0] = 0;
+			for (size_t x = 1; x <= maxSum; ++x) {
+				xLogX[x] = x * std::log(static_cast<double>(x));
+			}
+		}
+	}
+
+	/**
+	 * The QIC score of one quartet, the same as quartetLogScore() up to rounding.
+	 */
+	double score(uint64_t q1, uint64_t q2, uint64_t q3) const {
+		uint64_t const sum = q1 + q2 + q3;
+		if (sum >= xLogX.size()) {
+			return quartetLogScore(q1, q2, q3);
+		}
+		return signedScore(q1, q2, q3, sum);
+	}
+
+	/**
+	 * The lowest QIC score of count quartets, given as the counts q1[i], q2[i], q3[i] of each quartet i.
+	 */
+	double minScore(uint64_t const *q1, uint64_t const *q2, uint64_t const *q3, size_t count) const {
+		double lowest = std::numeric_limits<double>::infinity();
+		bool tabulated = true;
+		for (size_t i = 0; i < count; ++i) {
+			tabulated &= q1[i] + q2[i] + q3[i] < xLogX.size();
+		}
+		if (!tabulated) {
+			for (size_t i = 0; i < count; ++i) {
+				lowest = std::min(lowest, quartetLogScore(q1[i], q2[i], q3[i]));
+			}
+			return lowest;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			double const qic = signedScore(q1[i], q2[i], q3[i], q1[i] + q2[i] + q3[i]);
+			lowest = qic < lowest ? qic : lowest;
+		}
+		return lowest;
+	}
+
+private:
+	double signedScore(uint64_t q1, uint64_t q2, uint64_t q3, uint64_t sum) const {
+		double const entropy = xLogX[q1] + xLogX[q2] + xLogX[q3] - xLogX[sum];
+		// no topology occurs, which scores 0
+		double const divisor = sum == 0 ? 1 : sum * LOG_3;
+		double const qic = sum == 0 ? 0 : 1 + entropy / divisor;
+		return (q1 < q2 || q1 < q3) ? -qic : qic;
+	}
+
+	static constexpr double LOG_3 = 1.0986122886681098;
+
+	std::vector<double> xLogX; /**< x log x at index x, empty if m is at least MAX_TABLE */
+};
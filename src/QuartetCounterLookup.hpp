@@ -2,20 +2,24 @@
 
 
 #include "genesis/genesis.hpp"
+#include <array>
 #include <vector>
 #include <cassert>
 #include <algorithm>
 #include <memory>
 #include "TreeInformation.hpp"
-#include "quartet_lookup_table.hpp"
+#include "FlatGeneTree.hpp"
+#include "GeneTreeInput.hpp"
+#include "CountingBackends.hpp"
+#include "Metrics.hpp"
+#include "ProgressReporter.hpp"
+#include "QicKernel.hpp"
 #include "QuartetScoreComputer.hpp"
 #include "metaquartet_lookup_table.hpp"
 #include <unordered_map>
 #include <cstdint>
-#include <stxxl/vector>
-#include <stxxl/parallel_sorter_synchron>
-#include "easylogging++.h"
-//#include <stxxl/sorter>
+#include <fstream>
+#include <iostream>
 
 using namespace genesis;
 using namespace tree;
@@ -24,62 +28,63 @@ using namespace std;
 
 template class std::vector<size_t>;
 
-#define CO(a,b,c,d) (a) * n_cube + (b) * n_square + (c) * n + (d)
-
-template <typename T>
-struct my_comparator
-{
-   bool operator () (const T& a, const T& b) const
-   {
-       return a < b;
-   }
-
-   T min_value() const
-   {
-       return std::numeric_limits<T>::min();
-   }
-
-   T max_value() const
-   {
-       return std::numeric_limits<T>::max();
-   }
-};
-
 /**
  * Let n be the number of taxa in the reference tree.
  * Count occurrences of quartet topologies in the set of evaluation trees using a O(n^4) lookup table with O(1) lookup cost.
+ * The counts are stored by the Backend, see CountingBackends.hpp.
  */
-template<typename CINT>
+template<typename CINT, template<typename > class Backend = SorterBackend>
 class QuartetCounterLookup {
 public:
-	QuartetCounterLookup(const Tree &refTree, const std::string &evalTreesPath, size_t m, bool savemem, int num_threads, int internalMemory);
+	QuartetCounterLookup(const Tree &refTree, const std::string &evalTreesPath, size_t m, HugePageMode hugePages,
+			int num_threads, int internalMemory, std::ostream &log = std::cout);
+	QuartetCounterLookup(const Tree &refTree, GeneTreeOpener const &openEvalTrees, size_t m, HugePageMode hugePages,
+			int num_threads, int internalMemory, std::ostream &log = std::cout);
 	~QuartetCounterLookup() = default;
 	std::tuple<CINT, CINT, CINT> countQuartetOccurrences(size_t aIdx, size_t bIdx, size_t cIdx, size_t dIdx) const;
+	std::tuple<CINT, CINT, CINT> countLookupQuartetOccurrences(size_t a, size_t b, size_t c, size_t d) const;
+	void countLookupQuartetRun(std::array<size_t, 4> const &quartet, size_t position, size_t const *taxa, size_t count,
+			std::tuple<CINT, CINT, CINT> *out) const;
+	void prefetchLookup(size_t a, size_t b, size_t c, size_t d) const;
+	std::vector<size_t> lookupIDs(const Tree &tree) const;
+
+	/**
+	 * Scores the counts of single quartets, whose sums are at most m.
+	 */
+	QicKernel const& qicKernel() const {
+		return qic;
+	}
+
 private:
-	void countQuartets(const std::string &evalTreesPath, size_t m,
-			const std::unordered_map<std::string, size_t> &taxonToReferenceID);
-	void updateQuartets(const Tree &tree, size_t nodeIdx, const std::vector<int> &eulerTourLeaves,
-			const std::vector<int> &linkToEulerLeafIndex, int t);
-	void updateQuartetsThreeLinks(size_t link1, size_t link2, size_t link3, const Tree &tree,
-			const std::vector<int> &eulerTourLeaves, const std::vector<int> &linkToEulerLeafIndex, int t);
+	friend class QuartetScoresBench; /**< checks and times the kernels */
+
+	void countQuartets(GeneTreeOpener const &openEvalTrees, size_t m,
+			const std::unordered_map<std::string, size_t> &taxonToLookupID, std::ostream &log);
+	/**
+	 * The triples of clades of an inner node of an evaluation tree with the given first clade.
+	 */
+	struct CountingTask {
+		uint32_t tree; /**< index of the tree in the batch */
+		uint32_t node; /**< index of the inner node */
+		uint32_t clade; /**< index of the first clade */
+		uint64_t work; /**< number of quartet occurrences */
+	};
+
+	void countBatch(std::vector<FlatGeneTree> const &batch, std::vector<CountingTask> &tasks,
+			std::vector<std::pair<size_t, size_t>> &chunks);
+	void updateQuartets(const FlatGeneTree &tree, size_t innerNode, std::vector<FlatGeneTree::Clade> &clades, int t);
+	void updateQuartetsFirstClade(const FlatGeneTree &tree, std::vector<FlatGeneTree::Clade> const &clades, size_t i,
+			int t);
+	static uint64_t firstCladeWork(std::vector<uint64_t> const &cladeSizes, size_t i);
 	void updateQuartetsThreeClades(size_t startLeafIndexS1, size_t endLeafIndexS1, size_t startLeafIndexS2,
 			size_t endLeafIndexS2, size_t startLeafIndexS3, size_t endLeafIndexS3,
-			const std::vector<int> &eulerTourLeaves, int t);
-	std::pair<size_t, size_t> subtreeLeafIndices(size_t linkIdx, const Tree &tree,
-			const std::vector<int> &linkToEulerLeafIndex);
-
-	CINT lookupQuartetCount(size_t aIdx, size_t bIdx, size_t cIdx, size_t dIdx) const;
-
-	std::vector<CINT> lookupTableFast; /**> larger O(n^4) lookup table storing the count of each quartet topology */
-	QuartetLookupTable<CINT> lookupTable; /**> smaller O(n^4) lookup table storing the count of each quartet topology */
+			const std::vector<FlatGeneTree::LeafId> &eulerTourLeaves, int t);
 
 	size_t n; /**> number of taxa in the reference tree */
-	size_t n_square; /**> n*n */
-	size_t n_cube; /**> n*n*n */
+	std::unordered_map<std::string, size_t> taxonToLookupID;
 	std::vector<size_t> refIdToLookupID;
-	bool savemem; /**> trade speed for less memory or not */
-	void reduceSorter();
-	stxxl::parallel_sorter_synchron<uint64_t, my_comparator<uint64_t> > quartetSorter;
+	std::unique_ptr<Backend<CINT> > backend; /**> stores the count of each quartet topology */
+	QicKernel qic; /**> x log x for the possible counts */
 	int nthread;
 };
 
@@ -93,14 +98,23 @@ private:
  * @param endLeafIndexS3 the last index in eulerTourLeaves that corresponds to a leaf in subtree S_3
  * @param eulerTourLeaves the leaves' IDs of the tree traversed in an euler tour order
  */
-template<typename CINT>
-void QuartetCounterLookup<CINT>::updateQuartetsThreeClades(size_t startLeafIndexS1, size_t endLeafIndexS1,
+template<typename CINT, template<typename > class Backend>
+void QuartetCounterLookup<CINT, Backend>::updateQuartetsThreeClades(size_t startLeafIndexS1, size_t endLeafIndexS1,
 		size_t startLeafIndexS2, size_t endLeafIndexS2, size_t startLeafIndexS3, size_t endLeafIndexS3,
-		const std::vector<int> &eulerTourLeaves, int t) {
+		const std::vector<FlatGeneTree::LeafId> &eulerTourLeaves, int t) {
 	size_t aLeafIndex = startLeafIndexS1;
 	size_t bLeafIndex = startLeafIndexS2;
 	size_t cLeafIndex = startLeafIndexS3;
 
+	size_t const numLeaves = eulerTourLeaves.size();
+	size_t const sizeS1 = (endLeafIndexS1 + numLeaves - startLeafIndexS1) % numLeaves;
+	size_t const sizeS2 = (endLeafIndexS2 + numLeaves - startLeafIndexS2) % numLeaves;
+	size_t const sizeS3 = (endLeafIndexS3 + numLeaves - startLeafIndexS3) % numLeaves;
+	uint64_t const pushed = sizeS1 * (sizeS1 - (sizeS1 > 0 ? 1 : 0)) / 2 * sizeS2 * sizeS3;
+	Metrics::get_instance().add(Metrics::QUARTETS_ENUMERATED, pushed);
+	Metrics::get_instance().add(Metrics::BYTES_PUSHED, pushed * Backend<CINT>::PUSHED_BYTES);
+	Backend<CINT> &counts = *backend;
+
 	while (aLeafIndex != endLeafIndexS1) {
 		size_t a = eulerTourLeaves[aLeafIndex];
 		size_t a2LeafIndex = (aLeafIndex + 1) % eulerTourLeaves.size();
@@ -111,24 +125,7 @@ void QuartetCounterLookup<CINT>::updateQuartetsThreeClades(size_t startLeafIndex
 				while (cLeafIndex != endLeafIndexS3) {
 					size_t c = eulerTourLeaves[cLeafIndex];
 
-					if (savemem) {
-						size_t tuple = lookupTable.get_tuple_id(a, a2, b, c);
-						size_t tupleIdx = lookupTable.tuple_index(a, a2, b, c);
-						size_t tmp = tuple << 2;
-						tmp +=tupleIdx;
-						quartetSorter.push(tmp,t);
-//#pragma omp atomic
-						//tuple[tupleIdx]++;
-					} else {
-//#pragma omp atomic
-
-//size_t tmp = CO(a, a2, b, c);
-//quartetSorter.push(tmp,t);						
-//size_t tmp = metaLookupTable.get_index(a,a2,b,c);
-//tmp += metaLookupTable.get_tuple_index(a,a2,b,c);
-//quartetSorter.push(tmp,t);	
-//lookupTableFast[CO(a, a2, b, c)]++;
-					}
+					counts.add(a, a2, b, c, t);
 
 					cLeafIndex = (cLeafIndex + 1) % eulerTourLeaves.size();
 				}
@@ -146,82 +143,143 @@ void QuartetCounterLookup<CINT>::updateQuartetsThreeClades(size_t startLeafIndex
 }
 
 /**
- * Return a pair <start, end> representing the leaf indices in the Euler tour within the subtree induced by the genesis TreeLink with ID linkIdx.
- * The leaf indices are between [start,end), this means they include the start index but not the end index.
- * @param linkIdx the ID of the TreeLink from genesis
- * @param tree the tree
- * @param linkToEulerLeafIndex Mapping of each link in the tree to indices in the euler tour;
- * 	needed for determining first and last index of leaves belonging to a subtree.
+ * An inner node in a bifurcating tree induces three subtrees S_1, S_2, and S_3.
+ * Given an evaluation tree and an inner node, update the quartet topology counts of all quartets
+ * {a,b,c,d} for which a and b are in the same subtree, c is in another subtree, and d is in the remaining subtree.
+ * For multifurcating nodes, this is done for every triple of subtrees.
+ * @param tree the evaluation tree
+ * @param innerNode index of an inner node in the evaluation tree
+ * @param clades buffer for the clades induced by the inner node
  */
-template<typename CINT>
-std::pair<size_t, size_t> QuartetCounterLookup<CINT>::subtreeLeafIndices(size_t linkIdx, const Tree &tree,
-		const std::vector<int> &linkToEulerLeafIndex) {
-	size_t outerLinkIdx = tree.link_at(linkIdx).outer().index();
-	return {linkToEulerLeafIndex[linkIdx] % linkToEulerLeafIndex.size(), linkToEulerLeafIndex[outerLinkIdx] % linkToEulerLeafIndex.size()};
+template<typename CINT, template<typename > class Backend>
+void QuartetCounterLookup<CINT, Backend>::updateQuartets(const FlatGeneTree &tree, size_t innerNode,
+		std::vector<FlatGeneTree::Clade> &clades, int t) {
+	tree.getClades(innerNode, clades);
+	for (size_t i = 0; i + 2 < clades.size(); ++i) {
+		updateQuartetsFirstClade(tree, clades, i, t);
+	}
 }
 
 /**
- * Given the genesis links to the tree subtrees induced by an inner node, update the quartet topology counts of all quartets
- * {a,b,c,d} for which a and b are in the same subtree, c is in another subtree, and d is in the remaining subtree.
- * @param link1 link ID to the first subtree
- * @param link2 link ID to the second subtree
- * @param link3 link ID to the third subtree
+ * Update the quartet topology counts for the triples of clades of an inner node whose first clade is clades[i].
  * @param tree the evaluation tree
- * @param eulerTourLeaves the leaves' IDs of the tree traversed in an euler tour order
- * @param linkToEulerLeafIndex Mapping of each link in the tree to indices in the euler tour;
- * 	needed for determining first and last index of leaves belonging to a subtree.
+ * @param clades the clades induced by the inner node
+ * @param i index of the first clade of the triples
  */
-template<typename CINT>
-void QuartetCounterLookup<CINT>::updateQuartetsThreeLinks(size_t link1, size_t link2, size_t link3, const Tree &tree,
-		const std::vector<int> &eulerTourLeaves, const std::vector<int> &linkToEulerLeafIndex, int t) {
-	std::pair<size_t, size_t> subtree1 = subtreeLeafIndices(link1, tree, linkToEulerLeafIndex);
-	std::pair<size_t, size_t> subtree2 = subtreeLeafIndices(link2, tree, linkToEulerLeafIndex);
-	std::pair<size_t, size_t> subtree3 = subtreeLeafIndices(link3, tree, linkToEulerLeafIndex);
-
-	size_t startLeafIndexS1 = subtree1.first % eulerTourLeaves.size();
-	size_t endLeafIndexS1 = subtree1.second % eulerTourLeaves.size();
-	size_t startLeafIndexS2 = subtree2.first % eulerTourLeaves.size();
-	size_t endLeafIndexS2 = subtree2.second % eulerTourLeaves.size();
-	size_t startLeafIndexS3 = subtree3.first % eulerTourLeaves.size();
-	size_t endLeafIndexS3 = subtree3.second % eulerTourLeaves.size();
-
-	updateQuartetsThreeClades(startLeafIndexS1, endLeafIndexS1, startLeafIndexS2, endLeafIndexS2, startLeafIndexS3,
-			endLeafIndexS3, eulerTourLeaves, t);
-	updateQuartetsThreeClades(startLeafIndexS2, endLeafIndexS2, startLeafIndexS1, endLeafIndexS1, startLeafIndexS3,
-			endLeafIndexS3, eulerTourLeaves, t);
-	updateQuartetsThreeClades(startLeafIndexS3, endLeafIndexS3, startLeafIndexS1, endLeafIndexS1, startLeafIndexS2,
-			endLeafIndexS2, eulerTourLeaves, t);
+template<typename CINT, template<typename > class Backend>
+void QuartetCounterLookup<CINT, Backend>::updateQuartetsFirstClade(const FlatGeneTree &tree,
+		std::vector<FlatGeneTree::Clade> const &clades, size_t i, int t) {
+	for (size_t j = i + 1; j < clades.size(); ++j) {
+		for (size_t k = j + 1; k < clades.size(); ++k) {
+			FlatGeneTree::Clade const& s1 = clades[i];
+			FlatGeneTree::Clade const& s2 = clades[j];
+			FlatGeneTree::Clade const& s3 = clades[k];
+			updateQuartetsThreeClades(s1.first, s1.second, s2.first, s2.second, s3.first, s3.second, tree.leaves, t);
+			updateQuartetsThreeClades(s2.first, s2.second, s1.first, s1.second, s3.first, s3.second, tree.leaves, t);
+			updateQuartetsThreeClades(s3.first, s3.second, s1.first, s1.second, s2.first, s2.second, tree.leaves, t);
+		}
+	}
 }
 
 /**
- * An inner node in a bifurcating tree induces three subtrees S_1, S_2, and S_3.
- * Given an evaluation tree and an inner node, update the quartet topology counts of all quartets
- * {a,b,c,d} for which a and b are in the same subtree, c is in another subtree, and d is in the remaining subtree.
- * @param tree the evaluation tree
- * @param nodeIdx ID of an inner node in the evaluation tree
- * @param eulerTourLeaves the leaves' IDs of the tree traversed in an euler tour order
- * @param linkToEulerLeafIndex Mapping of each link in the tree to indices in the euler tour;
- * 	needed for determining first and last index of leaves belonging to a subtree.
+ * The number of quartet occurrences that updateQuartetsFirstClade() enumerates.
+ * @param cladeSizes the number of leaves of each clade of an inner node
+ * @param i index of the first clade of the triples
  */
-template<typename CINT>
-void QuartetCounterLookup<CINT>::updateQuartets(const Tree &tree, size_t nodeIdx,
-		const std::vector<int> &eulerTourLeaves, const std::vector<int> &linkToEulerLeafIndex, int t) {
-	// get taxa from subtree clades at nodeIdx
-	std::vector<size_t> subtreeLinkIndices;
-	const TreeLink* actLinkPtr = &tree.node_at(nodeIdx).link();
-	subtreeLinkIndices.push_back(actLinkPtr->index());
-	while (subtreeLinkIndices[0] != actLinkPtr->next().index()) {
-		actLinkPtr = &actLinkPtr->next();
-		subtreeLinkIndices.push_back(actLinkPtr->index());
+template<typename CINT, template<typename > class Backend>
+uint64_t QuartetCounterLookup<CINT, Backend>::firstCladeWork(std::vector<uint64_t> const &cladeSizes, size_t i) {
+	auto pairs = [](uint64_t size) {
+		return size * (size - (size > 0 ? 1 : 0)) / 2;
+	};
+	uint64_t work = 0;
+	for (size_t j = i + 1; j < cladeSizes.size(); ++j) {
+		for (size_t k = j + 1; k < cladeSizes.size(); ++k) {
+			uint64_t const a = cladeSizes[i];
+			uint64_t const b = cladeSizes[j];
+			uint64_t const c = cladeSizes[k];
+			work += pairs(a) * b * c + pairs(b) * a * c + pairs(c) * a * b;
+		}
 	}
+	return work;
+}
 
-	for (size_t i = 0; i < subtreeLinkIndices.size(); ++i) {
-		for (size_t j = i + 1; j < subtreeLinkIndices.size(); ++j) {
-			for (size_t k = j + 1; k < subtreeLinkIndices.size(); ++k) {
-				size_t link1 = subtreeLinkIndices[i];
-				size_t link2 = subtreeLinkIndices[j];
-				size_t link3 = subtreeLinkIndices[k];
-				updateQuartetsThreeLinks(link1, link2, link3, tree, eulerTourLeaves, linkToEulerLeafIndex, t);
+/**
+ * Count the quartets of a batch of evaluation trees in one parallel region. The work is cut into tasks of one inner
+ * node and one first clade, see updateQuartetsFirstClade(), across all trees of the batch. Consecutive tasks are
+ * grouped into chunks of about equal work, which are handed out from the largest to the smallest. Small trees thus
+ * do not pay for a parallel region each, and the large nodes of large trees do not leave threads idle at the end.
+ * @param batch the evaluation trees
+ * @param tasks buffer for the tasks
+ * @param chunks buffer for the [first, last) tasks of each chunk
+ */
+template<typename CINT, template<typename > class Backend>
+void QuartetCounterLookup<CINT, Backend>::countBatch(std::vector<FlatGeneTree> const &batch,
+		std::vector<CountingTask> &tasks, std::vector<std::pair<size_t, size_t>> &chunks) {
+	// chunks with less work are not worth scheduling on their own
+	uint64_t const minChunkWork = uint64_t(1) << 12;
+	uint64_t const chunksPerThread = 8;
+
+	tasks.clear();
+	std::vector<FlatGeneTree::Clade> clades;
+	std::vector<uint64_t> cladeSizes;
+	uint64_t totalWork = 0;
+	for (size_t t = 0; t < batch.size(); ++t) {
+		FlatGeneTree const &tree = batch[t];
+		size_t const n = tree.leafCount();
+		if (n < 4) {
+			// no quartets
+			continue;
+		}
+		for (size_t node = 0; node < tree.innerNodeCount(); ++node) {
+			tree.getClades(node, clades);
+			cladeSizes.clear();
+			for (FlatGeneTree::Clade const &clade : clades) {
+				cladeSizes.push_back((clade.second + n - clade.first) % n);
+			}
+			for (size_t i = 0; i + 2 < clades.size(); ++i) {
+				uint64_t const work = firstCladeWork(cladeSizes, i);
+				if (work > 0) {
+					tasks.push_back({ static_cast<uint32_t>(t), static_cast<uint32_t>(node), static_cast<uint32_t>(i),
+							work });
+					totalWork += work;
+				}
+			}
+		}
+	}
+
+	uint64_t const chunkWork = std::max(minChunkWork, totalWork / (chunksPerThread * nthread));
+	chunks.clear();
+	std::vector<uint64_t> work;
+	for (size_t first = 0; first < tasks.size();) {
+		size_t last = first;
+		uint64_t sum = 0;
+		while (last < tasks.size() && sum < chunkWork) {
+			sum += tasks[last].work;
+			++last;
+		}
+		chunks.emplace_back(first, last);
+		work.push_back(sum);
+		first = last;
+	}
+	std::vector<size_t> order(chunks.size());
+	for (size_t c = 0; c < order.size(); ++c) {
+		order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&work](size_t a, size_t b) {
+		return work[a] > work[b];
+	});
+
+#pragma omp parallel num_threads(nthread)
+	{
+		int tid = omp_get_thread_num();
+		std::vector<FlatGeneTree::Clade> taskClades;
+#pragma omp for schedule(dynamic)
+		for (size_t c = 0; c < order.size(); ++c) {
+			std::pair<size_t, size_t> const &chunk = chunks[order[c]];
+			for (size_t task = chunk.first; task < chunk.second; ++task) {
+				FlatGeneTree const &tree = batch[tasks[task].tree];
+				tree.getClades(tasks[task].node, taskClades);
+				updateQuartetsFirstClade(tree, taskClades, tasks[task].clade, tid);
 			}
 		}
 	}
@@ -229,80 +287,65 @@ void QuartetCounterLookup<CINT>::updateQuartets(const Tree &tree, size_t nodeIdx
 
 /**
  * Fill the lookup table by counting quartet topologies in the set of evaluation trees.
- * @param evalTreesPath path to the file containing the set of evaluation trees
+ * @param openEvalTrees opens the set of evaluation trees
  * @param m number of evaluation trees
  * @param taxonToReferenceID mapping of taxon names to leaf ID in reference tree
+ * @param log where to print status messages and progress
  */
-template<typename CINT>
-void QuartetCounterLookup<CINT>::countQuartets(const std::string &evalTreesPath, size_t m,
-		const std::unordered_map<std::string, size_t> &taxonToReferenceID) {
-	unsigned int progress = 1;
-	float onePercent = (float)m / 200;
-	utils::InputStream instream(utils::make_unique<utils::FileInputSource>(evalTreesPath));
-	auto itTree = NewickInputIterator(instream, DefaultTreeNewickReader());
+template<typename CINT, template<typename > class Backend>
+void QuartetCounterLookup<CINT, Backend>::countQuartets(GeneTreeOpener const &openEvalTrees, size_t m,
+		const std::unordered_map<std::string, size_t> &taxonToLookupID, std::ostream &log) {
+	std::unique_ptr<GeneTreeSource> source = openEvalTrees(taxonToLookupID);
+	std::vector<FlatGeneTree> batch;
+	std::vector<CountingTask> tasks;
+	std::vector<std::pair<size_t, size_t>> chunks;
+	size_t const batchSize = 256;
 	size_t i = 0;
 	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 	std::chrono::steady_clock::time_point end;	
 
-
-	stxxl::stats* Stats = stxxl::stats::get_instance();
-	
-	stxxl::stats_data stats_begin(*Stats);
-
-	while (itTree) { // iterate over the set of evaluation trees
-		//TIMED_BLOCK(timerObj, "while(itTree)_time"){
-		
-		Tree const& tree = *itTree;
-
-		size_t nEval = tree.node_count();
-
-		// do an euler tour through the tree
-		std::vector<int> eulerTourLeaves; // directly containing the mapped IDs from the reference
-		std::vector<int> linkToEulerLeafIndex;
-		linkToEulerLeafIndex.resize(tree.link_count());
-		for (auto it : eulertour(tree)) {
-			if (it.node().is_leaf()) {
-				size_t leafIdx = it.node().index();
-				eulerTourLeaves.push_back(
-						refIdToLookupID[taxonToReferenceID.at(tree.node_at(leafIdx).data<DefaultNodeData>().name)]);
-			}
-			linkToEulerLeafIndex[it.link().index()] = eulerTourLeaves.size();
+	// Each resolved quartet of a gene tree with n_g taxa is enumerated at the two ends of its inner path, so the work
+	// of a tree is at most 2 * C(n_g,4) occurrences. The trees are streamed, so the total is exact for the trees read
+	// so far and extrapolated from their average for the rest.
+	size_t const numTrees = m / 2;
+	uint64_t knownWork = 0;
+	ProgressReporter progress("Counting quartets", "quartet occurrences", Metrics::QUARTETS_ENUMERATED, 0, log);
+
+	while (true) {
+		size_t batchTrees;
+		{
+			MetricsSpan span("reading", "counting");
+			batchTrees = source->nextBatch(batch, batchSize);
 		}
-			
-#pragma omp parallel num_threads(nthread)	
-	  {			
-	       int tid = omp_get_thread_num();
-#pragma omp for schedule(dynamic)
-		for (size_t j = 0; j < nEval; ++j) {
-			if (!tree.node_at(j).is_leaf()) {
-				updateQuartets(tree, j, eulerTourLeaves, linkToEulerLeafIndex, tid);
-			}
+		if (batchTrees == 0) {
+			break;
 		}
-
-		if (i > progress * onePercent) {
-			std::cout << "Counting quartets... " << progress << "%" << std::endl;
-			progress++;
+		// replace the estimate of the previous batch by the work actually done
+		knownWork = progress.done();
+		for (FlatGeneTree const& tree : batch) {
+			uint64_t const taxa = tree.leafCount();
+			knownWork += taxa < 4 ? 0 : taxa * (taxa - 1) * (taxa - 2) * (taxa - 3) / 12;
 		}
+		size_t const treesRead = i + batchTrees;
+		progress.setTotal(knownWork + (numTrees > treesRead ? (numTrees - treesRead) * (knownWork / treesRead) : 0));
+
+		MetricsSpan span("enumeration", "counting");
+		for (size_t t = 0; t < batch.size(); ++t) {
+			backend->addTree(batch[t], i + t);
 		}
-		//}; //TIMED_BLOCK
-		if((i!=0) && (i%250 == 0)){
+		countBatch(batch, tasks, chunks);
+		i += batchTrees;
+		// flush the backend after about every 250 trees
+		if ((i - batchTrees) / 250 != i / 250) {
 			end = std::chrono::steady_clock::now();
-			LOG(INFO) << "[counting_time] [" << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()<< " ms]";
-			reduceSorter();
+			Metrics::get_instance().logTime("counting_time", begin, end);
+			backend->flush();
 			begin = std::chrono::steady_clock::now();
-
 		}
-		++itTree;
-		++i;
 	}
 	end = std::chrono::steady_clock::now();
-	LOG(INFO) << "[counting_time] [" << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()<< " ms]";
-	reduceSorter();
-		
-	stxxl::stats_data stats_end(*Stats);
-	LOG(INFO) << "[run_volumeWritten] [" << (stats_end - stats_begin).get_written_volume ()<< " bytes]"; 
-		
-	std::cout << (stxxl::stats_data(*Stats) - stats_begin); // print i/o statistics
+	Metrics::get_instance().logTime("counting_time", begin, end);
+	backend->finish(log);
 }
 
 /**
@@ -310,173 +353,115 @@ void QuartetCounterLookup<CINT>::countQuartets(const std::string &evalTreesPath,
  * @param evalTreesPath path to the file containing the set of evaluation trees
  * @param m the number of evaluation trees
  */
-template<typename CINT>
-QuartetCounterLookup<CINT>::QuartetCounterLookup(Tree const &refTree, const std::string &evalTreesPath, size_t m,
-		bool savemem,int num_threads, int internalMemory) :
-		savemem(savemem),
-quartetSorter(my_comparator<uint64_t>(),static_cast<size_t>(1)<<internalMemory, num_threads) {
-//quartetSorter(my_comparator<size_t>(),static_cast<size_t>(1)<<32) {
-	std::unordered_map<std::string, size_t> taxonToReferenceID;
+template<typename CINT, template<typename > class Backend>
+QuartetCounterLookup<CINT, Backend>::QuartetCounterLookup(Tree const &refTree, const std::string &evalTreesPath,
+		size_t m, HugePageMode hugePages, int num_threads, int internalMemory, std::ostream &log) :
+		QuartetCounterLookup(refTree, geneTreeFileOpener(evalTreesPath, num_threads), m, hugePages, num_threads,
+				internalMemory, log) {
+}
+
+/**
+ * @param refTree the reference tree
+ * @param openEvalTrees opens the set of evaluation trees
+ * @param m the number of evaluation trees
+ * @param num_threads number of threads, 0 for the OpenMP default
+ * @param log where to print status messages and progress
+ */
+template<typename CINT, template<typename > class Backend>
+QuartetCounterLookup<CINT, Backend>::QuartetCounterLookup(Tree const &refTree, GeneTreeOpener const &openEvalTrees,
+		size_t m, HugePageMode hugePages, int num_threads, int internalMemory, std::ostream &log) {
 	refIdToLookupID.resize(refTree.node_count());
-	nthread = num_threads;	
+	nthread = resolveNumThreads(num_threads);
 	n = 0;
-	//TIMED_BLOCK(timerObj, "QuartetCounterLookup_time"){
 
 	for (auto it : eulertour(refTree)) {
 		if (it.node().is_leaf()) {
-			taxonToReferenceID[it.node().data<DefaultNodeData>().name] = it.node().index();
+			taxonToLookupID[it.node().data<DefaultNodeData>().name] = n;
 			refIdToLookupID[it.node().index()] = n;
 			n++;
 		}
 	}
 
-	n_square = n * n;
-	n_cube = n_square * n;
-	// initialize the lookup table.
-	if (savemem) {
-		lookupTable.init(n);
-	} else {
-		//lookupTableFast.resize(n * n * n * n);
-	//	metaLookupTable.init(n);
-	}
-	countQuartets(evalTreesPath, m, taxonToReferenceID);
-	if (savemem) {
-		std::cout << "lookup table size in bytes: " << lookupTable.size() << "\n";
-	} else {
-		std::cout << "lookup table size in bytes: " << lookupTableFast.size() * sizeof(CINT) << "\n";
+	backend.reset(new Backend<CINT>(n, hugePages, num_threads, internalMemory));
+	std::vector<size_t> pagesPerNode = backend->pagesPerNode();
+	if (!pagesPerNode.empty()) {
+		log << "lookup table pages per NUMA node (sampled):";
+		for (size_t node = 0; node < pagesPerNode.size(); ++node) {
+			log << " node" << node << "=" << pagesPerNode[node];
+		}
+		log << "\n";
 	}
-	//};//TIMED_BLOCK
+	countQuartets(openEvalTrees, m, taxonToLookupID, log);
+	qic = QicKernel(m);
 }
 
 /**
- * Returns the count of the quartet topology ab|cd in the evaluation trees... only needed for the fast option
+ * Returns the counts of the quartet topologies ab|cd, ac|bd, and ad|bc in the evaluation trees
  * @param aIdx ID of taxon a
  * @param bIdx ID of taxon b
  * @param cIdx ID of taxon c
  * @param dIdx ID of taxon d
  */
-template<typename CINT>
-CINT QuartetCounterLookup<CINT>::lookupQuartetCount(size_t aIdx, size_t bIdx, size_t cIdx, size_t dIdx) const {
-	aIdx = refIdToLookupID[aIdx];
-	bIdx = refIdToLookupID[bIdx];
-	cIdx = refIdToLookupID[cIdx];
-	dIdx = refIdToLookupID[dIdx];
-	return lookupTableFast[CO(aIdx, bIdx, cIdx, dIdx)] + lookupTableFast[CO(aIdx, bIdx, dIdx, cIdx)]
-			+ lookupTableFast[CO(bIdx, aIdx, cIdx, dIdx)] + lookupTableFast[CO(bIdx, aIdx, dIdx, cIdx)];
+template<typename CINT, template<typename > class Backend>
+std::tuple<CINT, CINT, CINT> QuartetCounterLookup<CINT, Backend>::countQuartetOccurrences(size_t aIdx, size_t bIdx,
+		size_t cIdx, size_t dIdx) const {
+	return backend->counts(refIdToLookupID[aIdx], refIdToLookupID[bIdx], refIdToLookupID[cIdx], refIdToLookupID[dIdx]);
 }
 
 /**
- * Returns the counts of the quartet topologies ab|cd, ac|bd, and ad|bc in the evaluation trees
- * @param aIdx ID of taxon a
- * @param bIdx ID of taxon b
- * @param cIdx ID of taxon c
- * @param dIdx ID of taxon d
+ * Returns the counts of the quartet topologies ab|cd, ac|bd, and ad|bc in the evaluation trees, for taxa given by
+ * their lookup IDs, see lookupIDs().
  */
-template<typename CINT>
-std::tuple<CINT, CINT, CINT> QuartetCounterLookup<CINT>::countQuartetOccurrences(size_t aIdx, size_t bIdx, size_t cIdx,
-		size_t dIdx) const {
-	if (savemem) {
-		size_t a = refIdToLookupID[aIdx];
-		size_t b = refIdToLookupID[bIdx];
-		size_t c = refIdToLookupID[cIdx];
-		size_t d = refIdToLookupID[dIdx];
-		const auto& tuple = lookupTable.get_tuple(a, b, c, d);
-		CINT abCD = tuple[lookupTable.tuple_index(a, b, c, d)];
-		CINT acBD = tuple[lookupTable.tuple_index(a, c, b, d)];
-		CINT adBC = tuple[lookupTable.tuple_index(a, d, b, c)];
-		//std::ofstream output;
-		//output.open("countBuffer.csv", std::ios_base::app);
-		//output << a << "," << b << "," << c << "," << d << "," << abCD << "," << acBD << "," << adBC << std::endl;
-		//output.close();
-		return std::tuple<CINT, CINT, CINT>(abCD, acBD, adBC);
-	} else {
-		CINT abCD = lookupQuartetCount(aIdx, bIdx, cIdx, dIdx);
-		CINT acBD = lookupQuartetCount(aIdx, cIdx, bIdx, dIdx);
-		CINT adBC = lookupQuartetCount(aIdx, dIdx, bIdx, cIdx);
-		return std::tuple<CINT, CINT, CINT>(abCD, acBD, adBC);
-	}
+template<typename CINT, template<typename > class Backend>
+std::tuple<CINT, CINT, CINT> QuartetCounterLookup<CINT, Backend>::countLookupQuartetOccurrences(size_t a, size_t b,
+		size_t c, size_t d) const {
+	return backend->counts(a, b, c, d);
 }
 
-template<typename CINT>
-void QuartetCounterLookup<CINT>::reduceSorter() {
-	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-	std::chrono::steady_clock::time_point end;	
-	quartetSorter.sort();
-	end = std::chrono::steady_clock::now();
-	LOG(INFO) << "[sorting_time] [" << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()<< " ms]";
-	begin = std::chrono::steady_clock::now();
-
-	//TIMED_BLOCK(obj_r, "readSorter_time"){
-    	uint64_t tmp = *quartetSorter;
-	uint64_t mask = 3;
-	CINT counter = 0;
-	CINT counter_q1 = 0;
-	CINT counter_q2 = 0;
-	CINT counter_q3 = 0;
-	std::vector<uint16_t> quartet;	
-	uint64_t tupleIndex = 0;
-
-    for(;!quartetSorter.empty();++quartetSorter)
-    {
-		if(tmp == *quartetSorter){
-			counter++;
-		}
-		else if((tmp >> 2) - (*quartetSorter >> 2) == 0){
-			tupleIndex = tmp & mask;
-			switch(tupleIndex){
-				case 0:
-					counter_q1 = counter;
-					break;
-				case 1:
-					counter_q2 = counter;
-					break;
-				case 2:
-					counter_q3 = counter;
-					break;
-			}
-			counter = 1;
-			tmp = *quartetSorter;
+/**
+ * Returns the counts as countLookupQuartetOccurrences() for each of count quartets, which are the given quartet with
+ * its taxon at the given position replaced by one of the taxa. The counts are fastest to look up if the quartets are
+ * in the order of the lookup table, e.g. for the lowest of the four taxa running upwards.
+ * @param quartet lookup IDs of the taxa a, b, c and d
+ * @param position index of the taxon in quartet that runs through the taxa
+ * @param taxa lookup IDs of the running taxon
+ * @param count number of taxa
+ * @param out room for count tuples of counts
+ */
+template<typename CINT, template<typename > class Backend>
+void QuartetCounterLookup<CINT, Backend>::countLookupQuartetRun(std::array<size_t, 4> const &quartet, size_t position,
+		size_t const *taxa, size_t count, std::tuple<CINT, CINT, CINT> *out) const {
+	backend->countsRun(quartet, position, taxa, count, out);
+}
+
+/**
+ * Start loading the counts of a quartet given by lookup IDs into the cache, before countLookupQuartetOccurrences()
+ * is called for it.
+ */
+template<typename CINT, template<typename > class Backend>
+void QuartetCounterLookup<CINT, Backend>::prefetchLookup(size_t a, size_t b, size_t c, size_t d) const {
+	backend->prefetch(a, b, c, d);
+}
+
+/**
+ * Map the leaves of a tree to the lookup IDs of their taxa, so that the counts can be used for any tree on the taxa of
+ * the reference tree, e.g. another candidate topology. Inner nodes are mapped to 0.
+ * @param tree a tree whose taxa are a subset of the taxa of the reference tree
+ * @return the lookup ID of each node, indexed by node index
+ */
+template<typename CINT, template<typename > class Backend>
+std::vector<size_t> QuartetCounterLookup<CINT, Backend>::lookupIDs(Tree const &tree) const {
+	std::vector<size_t> ids(tree.node_count(), 0);
+	for (size_t i = 0; i < tree.node_count(); ++i) {
+		if (!tree.node_at(i).is_leaf()) {
+			continue;
 		}
-		else{
-			tupleIndex = tmp & mask;
-			switch(tupleIndex){
-				case 0:
-					counter_q1 = counter;
-					break;
-				case 1:
-					counter_q2 = counter;
-					break;
-				case 2:
-					counter_q3 = counter;
-					break;
-			}
-			tmp &= ~(mask); 
-			tmp = tmp >> 2;
-			lookupTable.update_quartet(tmp, counter_q1, counter_q2, counter_q3);
-			counter = 1;
-			counter_q1 = counter_q2 = counter_q3 = 0;
-			tmp = *quartetSorter;
+		std::string const &name = tree.node_at(i).data<DefaultNodeData>().name;
+		auto it = taxonToLookupID.find(name);
+		if (it == taxonToLookupID.end()) {
+			throw std::runtime_error("Taxon '" + name + "' was not in the reference tree of the quartet counts.");
 		}
-    }
-	tupleIndex = tmp & mask;
-	switch(tupleIndex){
-		case 0:
-			counter_q1 = counter;
-			break;
-		case 1:
-			counter_q2 = counter;
-			break;
-		case 2:
-			counter_q3 = counter;
-			break;
+		ids[i] = it->second;
 	}
-	tmp &= ~(mask); 
-	tmp = tmp >> 2;
-	lookupTable.update_quartet(tmp, counter_q1, counter_q2, counter_q3);
-	//lookupTableFast[tmp] = lookupTableFast[tmp] + counter;
-	quartetSorter.clear();
-	//output.close();
-	end = std::chrono::steady_clock::now();
-	LOG(INFO) << "[readingSorter_time] [" << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()<< " ms]";
-
+	return ids;
 }
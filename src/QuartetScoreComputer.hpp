@@ -2,11 +2,17 @@
 
 #include "genesis/genesis.hpp"
 #include "QuartetCounterLookup.hpp"
+#include "EdgeSelection.hpp"
 #include "TreeInformation.hpp"
-#include "easylogging++.h"
+#include "MemoryPlanner.hpp"
+#include "Metrics.hpp"
+#include "ProgressReporter.hpp"
+#include "QicKernel.hpp"
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <chrono>
+#include <iostream>
 #include <memory>
 #include <stdexcept>
 #include <unordered_map>
@@ -14,12 +20,6 @@
 #include <utility>
 #include <vector>
 
-#if defined( _WIN32 ) || defined(  _WIN64  )
-#include <windows.h>
-#else
-#include <unistd.h>
-#endif
-
 using namespace genesis;
 using namespace tree;
 using namespace utils;
@@ -34,19 +34,52 @@ public:
 		return std::hash<T>()(x.first) ^ std::hash<U>()(x.second);
 	}
 };
+
+/**
+ * The scores of the metaquartet induced by a pair of inner nodes {u,v} of a bifurcating reference tree. Both are
+ * minima for all edges on the path from u to v.
+ */
+struct NodePairScore {
+	double lqic; /**< the lowest LQ-IC score of the quartets of the metaquartet */
+	double qpic; /**< the QP-IC score of the metaquartet */
+};
+
+/**
+ * The topology counts and the lowest LQ-IC score of the quartets in a slice of a metaquartet.
+ */
+struct MetaquartetCounts {
+	uint64_t p1; /**< occurrences of the topology of the reference tree */
+	uint64_t p2;
+	uint64_t p3;
+	double lqic;
+};
+
+template<typename CINT, template<typename > class Backend>
+class IncrementalScorer;
+
 /**
- * Compute LQ-, QP-, and EQP-IC support scores for quartets.
+ * Compute LQ-, QP-, and EQP-IC support scores for quartets. The quartet counts are stored by the Backend, see
+ * CountingBackends.hpp.
  */
-template<typename CINT>
+template<typename CINT, template<typename > class Backend = SorterBackend>
 class QuartetScoreComputer {
 public:
 	QuartetScoreComputer(Tree const &refTree, const std::string &evalTreesPath, size_t m, bool verboseOutput,
-			bool enforceSmallMem, int num_threads, int internalMemory);
+			HugePageMode hugePages, int num_threads, int internalMemory, std::ostream &log = std::cout,
+			EdgeSelection const &selection = EdgeSelection());
+	QuartetScoreComputer(Tree const &refTree, GeneTreeOpener const &openEvalTrees, size_t m, bool verboseOutput,
+			HugePageMode hugePages, int num_threads, int internalMemory, std::ostream &log = std::cout,
+			EdgeSelection const &selection = EdgeSelection());
+	QuartetScoreComputer(Tree const &refTree, std::shared_ptr<QuartetCounterLookup<CINT, Backend> const> counter,
+			int num_threads, std::ostream &log = std::cout);
 	using QuartetTuple = std::array<uint16_t, 4>;
 	using QuartetCountTuple = std::array<CINT, 3>;
-	std::vector<double> getLQICScores();
-	std::vector<double> getQPICScores();
-	std::vector<double> getEQPICScores();
+	std::vector<double> const& getLQICScores() const;
+	std::vector<double> const& getQPICScores() const;
+	std::vector<double> const& getEQPICScores() const;
+	void releaseScores(std::vector<double> &lqic, std::vector<double> &qpic, std::vector<double> &eqpic);
+	std::chrono::steady_clock::duration getCountingTime() const;
+	std::chrono::steady_clock::duration getScoringTime() const;
 	void calculateQPICScores();
 	void computeQuartetScoresBifurcatingQuartets(size_t uIdx, size_t vIdx, size_t wIdx, size_t zIdx, std::vector<CINT> quartetOccurrences);
 	void init(size_t num_taxa);
@@ -56,13 +89,27 @@ public:
 	uint64_t get_index(size_t a, size_t b, size_t c, size_t d) const;
 	
 private:
+	friend class QuartetScoresBench; /**< checks and times the kernels */
+	friend class IncrementalScorer<CINT, Backend>; /**< rescores the node pairs changed by a move */
+
+	QuartetScoreComputer(std::shared_ptr<QuartetCounterLookup<CINT, Backend> const> counter, int num_threads);
+
 	double log_score(size_t q1, size_t q2, size_t q3);
+	void initReferenceTree(Tree const &refTree);
+	void indexReferenceTree();
+	void computeScores();
 
 	void computeQuartetScoresBifurcating();
 	std::unordered_map<std::pair<size_t, size_t>, std::tuple<size_t, size_t, size_t>, pairhash> countBuffer;
 
 	void computeQuartetScoresMultifurcating();
 	std::pair<size_t, size_t> nodePairForQuartet(size_t aIdx, size_t bIdx, size_t cIdx, size_t dIdx);
+	void nodePairLeafRanges(size_t uIdx, size_t vIdx, std::array<size_t, 4> &start, std::array<size_t, 4> &end);
+	MetaquartetCounts countNodePair(size_t uIdx, size_t vIdx, size_t part, size_t parts);
+	NodePairScore scoreNodePair(size_t uIdx, size_t vIdx);
+	std::vector<NodePairScore> scoreNodePairs(std::vector<std::pair<size_t, size_t>> const &pairs);
+	void applyNodePairScores(std::vector<std::pair<size_t, size_t>> const &pairs,
+			std::vector<NodePairScore> const &scores);
 	void processNodePair(size_t uIdx, size_t vIdx);
 	std::tuple<CINT, CINT, CINT> countQuartetOccurrences(size_t aIdx, size_t bIdx, size_t cIdx, size_t dIdx);
 	std::pair<size_t, size_t> subtreeLeafIndices(size_t linkIdx);
@@ -77,6 +124,9 @@ private:
 
 	size_t num_taxa_;
 	bool verbose;
+	int numThreads; /**< threads for scoring */
+	std::ostream *log; /**< where status messages and progress are printed */
+	EdgeSelection selection; /**< the edges whose scores are computed */
 
 	TreeInformation informationReferenceTree;
 	std::vector<double> LQICScores;
@@ -86,7 +136,10 @@ private:
 	std::vector<size_t> eulerTourLeaves;
 	std::vector<size_t> linkToEulerLeafIndex;
 
-	std::unique_ptr<QuartetCounterLookup<CINT>> quartetCounterLookup;
+	std::shared_ptr<QuartetCounterLookup<CINT, Backend> const> quartetCounterLookup; /**< may be shared between reference trees */
+
+	std::chrono::steady_clock::duration countingTime; /**< time spent reading the evaluation trees and counting quartets */
+	std::chrono::steady_clock::duration scoringTime; /**< time spent computing the scores */
 };
 
 /**
@@ -96,8 +149,8 @@ private:
  * @param cIdx ID of the taxon c in the reference tree
  * @param dIdx ID of the taxon d in the reference tree
  */
-template<typename CINT>
-std::pair<size_t, size_t> QuartetScoreComputer<CINT>::nodePairForQuartet(size_t aIdx, size_t bIdx, size_t cIdx,
+template<typename CINT, template<typename > class Backend>
+std::pair<size_t, size_t> QuartetScoreComputer<CINT, Backend>::nodePairForQuartet(size_t aIdx, size_t bIdx, size_t cIdx,
 		size_t dIdx) {
 	size_t uIdx = informationReferenceTree.lowestCommonAncestorIdx(aIdx, bIdx, rootIdx);
 	size_t vIdx = informationReferenceTree.lowestCommonAncestorIdx(cIdx, dIdx, rootIdx);
@@ -113,98 +166,68 @@ std::pair<size_t, size_t> QuartetScoreComputer<CINT>::nodePairForQuartet(size_t
 /**
  * Return the computed LQ-IC support scores.
  */
-template<typename CINT>
-std::vector<double> QuartetScoreComputer<CINT>::getLQICScores() {
+template<typename CINT, template<typename > class Backend>
+std::vector<double> const& QuartetScoreComputer<CINT, Backend>::getLQICScores() const {
 	return LQICScores;
 }
 
 /**
  * Return the computed QP-IC support scores.
  */
-template<typename CINT>
-std::vector<double> QuartetScoreComputer<CINT>::getQPICScores() {
+template<typename CINT, template<typename > class Backend>
+std::vector<double> const& QuartetScoreComputer<CINT, Backend>::getQPICScores() const {
 	return QPICScores;
 }
 
 /**
  * Return the computed EQP-IC support scores.
  */
-template<typename CINT>
-std::vector<double> QuartetScoreComputer<CINT>::getEQPICScores() {
+template<typename CINT, template<typename > class Backend>
+std::vector<double> const& QuartetScoreComputer<CINT, Backend>::getEQPICScores() const {
 	return EQPICScores;
 }
 
 /**
- * Compute qic = 1 + p_q1 * log(p_q1) + p_q2 * log(p_q2) + p_q3 * log(p_q3)
- * Take into account corner cases when one or more values are zero.
- * Let ab|cd be the topology of the quartet {a,b,c,d} in the reference tree.
- * @param q1 count of the quartet topology ab|cd
- * @param q2 count of the quartet topology ac|bd
- * @param q3 count of the quartet topology ad|bc
+ * Move the computed LQ-IC, QP-IC, and EQP-IC support scores into the given vectors, e.g. to return them without
+ * copies. The getters return empty vectors afterwards.
  */
-template<typename CINT>
-double QuartetScoreComputer<CINT>::log_score(size_t q1, size_t q2, size_t q3) {
-	if (q1 == 0 && q2 == 0 && q3 == 0)
-		return 0;
-
-	size_t sum = q1 + q2 + q3;
-	double p_q1 = (double) q1 / sum;
-	double p_q2 = (double) q2 / sum;
-	double p_q3 = (double) q3 / sum;
-
-	// qic = 1 + p_q1 * log(p_q1) + p_q2 * log(p_q2) + p_q3 * log(p_q3);
-	double qic = 1;
-	if (p_q1 != 0)
-		qic += p_q1 * log(p_q1) / log(3);
-	if (p_q2 != 0)
-		qic += p_q2 * log(p_q2) / log(3);
-	if (p_q3 != 0)
-		qic += p_q3 * log(p_q3) / log(3);
-
-	if (q1 < q2 || q1 < q3) {
-		return qic * -1;
-	} else {
-		return qic;
-	}
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::releaseScores(std::vector<double> &lqic, std::vector<double> &qpic,
+		std::vector<double> &eqpic) {
+	lqic = std::move(LQICScores);
+	qpic = std::move(QPICScores);
+	eqpic = std::move(EQPICScores);
+	LQICScores.clear();
+	QPICScores.clear();
+	EQPICScores.clear();
 }
 
 /**
- * @brief For a given pair of nodes (and their LCA), return the indices of the two links of those
- * nodes that point towards the respective other node.
- *
- * For example, given node A and node B, the first index in the returned std::pair is the index
- * of the link of node A that points in direction of node B, and the second index in the std::pair
- * is the index of the link of node B that points towards node A.
+ * Return the time spent reading the evaluation trees and counting their quartets.
  */
-std::pair<size_t, size_t> get_path_inner_links(TreeNode const& u, TreeNode const& v, TreeNode const& lca) {
-	if (&u == &v) {
-		throw std::runtime_error("No inner links on a path between a node and itself.");
-	}
-	if (&u == &lca) {
-		TreeLink const* u_link = nullptr;
-		for (auto it : path_set(v, u, lca)) {
-			if (it.is_lca())
-				continue;
-			u_link = &it.link().outer();
-		}
-		assert(u_link != nullptr);
-		return {u_link->index(), v.primary_link().index()};
-	}
-	if (&v == &lca) {
-		TreeLink const* v_link = nullptr;
-		for (auto it : path_set(u, v, lca)) {
-			if (it.is_lca())
-				continue;
-			v_link = &it.link().outer();
-		}
-		assert(v_link != nullptr);
-		return {u.primary_link().index(), v_link->index()};
-	}
-	return {u.primary_link().index(), v.primary_link().index()};
+template<typename CINT, template<typename > class Backend>
+std::chrono::steady_clock::duration QuartetScoreComputer<CINT, Backend>::getCountingTime() const {
+	return countingTime;
 }
 
-template<typename CINT>
-void QuartetScoreComputer<CINT>::calculateQPICScores(){
+/**
+ * Return the time spent computing the scores from the quartet counts.
+ */
+template<typename CINT, template<typename > class Backend>
+std::chrono::steady_clock::duration QuartetScoreComputer<CINT, Backend>::getScoringTime() const {
+	return scoringTime;
+}
+
+/**
+ * Compute the QIC score of the counts, see quartetLogScore().
+ */
+template<typename CINT, template<typename > class Backend>
+double QuartetScoreComputer<CINT, Backend>::log_score(size_t q1, size_t q2, size_t q3) {
+	return quartetLogScore(q1, q2, q3);
+}
+
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::calculateQPICScores(){
 	 // ***** Code for QP-IC and EQP-IC scores, finalizing, start
 		for (auto kv : countBuffer) {
 			std::pair<size_t, size_t> nodePair = kv.first;
@@ -227,13 +250,10 @@ void QuartetScoreComputer<CINT>::calculateQPICScores(){
 
 			size_t lcaIdx = informationReferenceTree.lowestCommonAncestorIdx(uIdx, vIdx, rootIdx);
 			// update the EQP-IC scores of the edges from uIdx to vIdx
-			for (auto it : path_set(referenceTree.node_at(uIdx), referenceTree.node_at(vIdx),
-					referenceTree.node_at(lcaIdx))) {
-				if (it.is_lca())
-					continue;
+			informationReferenceTree.forEachPathEdge(uIdx, vIdx, lcaIdx, [&](size_t edgeIdx) {
 #pragma omp critical
-				EQPICScores[it.edge().index()] = std::min(EQPICScores[it.edge().index()], qpic);
-			}
+				EQPICScores[edgeIdx] = std::min(EQPICScores[edgeIdx], qpic);
+			});
 		}
 	 // ***** Code for QP-IC and EQP-IC scores, finalizing, end
 }
@@ -245,18 +265,19 @@ void QuartetScoreComputer<CINT>::calculateQPICScores(){
  * @param cIdx ID of the taxon c
  * @param dIdx ID of the taxon d
  */
-template<typename CINT>
-std::tuple<CINT, CINT, CINT> QuartetScoreComputer<CINT>::countQuartetOccurrences(size_t aIdx, size_t bIdx, size_t cIdx,
+template<typename CINT, template<typename > class Backend>
+std::tuple<CINT, CINT, CINT> QuartetScoreComputer<CINT, Backend>::countQuartetOccurrences(size_t aIdx, size_t bIdx, size_t cIdx,
 		size_t dIdx) {
-	return quartetCounterLookup->countQuartetOccurrences(aIdx, bIdx, cIdx, dIdx);
+	return quartetCounterLookup->countLookupQuartetOccurrences(refIdToLookupId[aIdx], refIdToLookupId[bIdx],
+			refIdToLookupId[cIdx], refIdToLookupId[dIdx]);
 }
 
 
 /**
  * Compute the LQ-IC, QP-IC, and EQP-IC scores for a bifurcating reference tree, iterating over quartets instead of node pairs.
  */
-template<typename CINT>
-void QuartetScoreComputer<CINT>::computeQuartetScoresBifurcatingQuartets(size_t uIdx, size_t vIdx, size_t wIdx, size_t zIdx, std::vector<CINT> quartetOccurrences) {
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::computeQuartetScoresBifurcatingQuartets(size_t uIdx, size_t vIdx, size_t wIdx, size_t zIdx, std::vector<CINT> quartetOccurrences) {
 	// Process all quartets
 	//#pragma omp parallel for schedule(dynamic)
 					// find topology ab|cd of {u,v,w,z}
@@ -347,13 +368,10 @@ void QuartetScoreComputer<CINT>::computeQuartetScoresBifurcatingQuartets(size_t
 					toIdx = nodePair.first;
 					// update the LQ-IC scores of the edges from fromIdx to toIdx
 					size_t lcaFromToIdx = informationReferenceTree.lowestCommonAncestorIdx(fromIdx, toIdx, rootIdx);
-					for (auto it : path_set(referenceTree.node_at(fromIdx), referenceTree.node_at(toIdx),
-							referenceTree.node_at(lcaFromToIdx))) {
-						if (it.is_lca())
-							continue;
+					informationReferenceTree.forEachPathEdge(fromIdx, toIdx, lcaFromToIdx, [&](size_t edgeIdx) {
 #pragma omp critical
-						LQICScores[it.edge().index()] = std::min(LQICScores[it.edge().index()], qic);
-					}
+						LQICScores[edgeIdx] = std::min(LQICScores[edgeIdx], qic);
+					});
 					std::get<0>(countBuffer[nodePairSorted]) += quartetOccurrences[tupleA];
 					std::get<1>(countBuffer[nodePairSorted]) += quartetOccurrences[tupleB];
 					std::get<2>(countBuffer[nodePairSorted]) += quartetOccurrences[tupleC];
@@ -363,149 +381,394 @@ void QuartetScoreComputer<CINT>::computeQuartetScoresBifurcatingQuartets(size_t
 }
 
 /**
- * Update LQ-IC, QP-IC, and EQP-IC scores of all internodes influenced by the pair of inner nodes {u,v}.
- * As each quartet contributes to only one metaquartet induced by a node pair, our code visits each quartet exactly once.
+ * The leaf index ranges of the four subtrees of the metaquartet induced by the pair of inner nodes {u,v} in the Euler
+ * tour. A subtree is the cyclic range from start to end, exclusive; the first two subtrees are those of u.
  * @param uIdx the ID of the inner node u
  * @param vIdx the ID of the inner node v
  */
-template<typename CINT>
-void QuartetScoreComputer<CINT>::processNodePair(size_t uIdx, size_t vIdx) {
-	// occurrences of topologies of the the metaquartet induced by {u,v} in the evaluation trees
-	unsigned p1, p2, p3;
-	p1 = 0;
-	p2 = 0;
-	p3 = 0;
-	// find metaquartet indices by {u,v}
-
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::nodePairLeafRanges(size_t uIdx, size_t vIdx, std::array<size_t, 4> &start,
+		std::array<size_t, 4> &end) {
 	size_t lcaIdx = informationReferenceTree.lowestCommonAncestorIdx(uIdx, vIdx, rootIdx);
+	std::pair<size_t, size_t> innerLinks = informationReferenceTree.pathInnerLinks(uIdx, vIdx, lcaIdx);
+
+	std::array<size_t, 4> const linkSubtree = { { referenceTree.link_at(innerLinks.first).next().index(),
+			referenceTree.link_at(innerLinks.first).next().next().index(),
+			referenceTree.link_at(innerLinks.second).next().index(),
+			referenceTree.link_at(innerLinks.second).next().next().index() } };
+	for (size_t s = 0; s < 4; ++s) {
+		start[s] = linkToEulerLeafIndex[linkSubtree[s]] % eulerTourLeaves.size();
+		end[s] = linkToEulerLeafIndex[referenceTree.link_at(linkSubtree[s]).outer().index()] % eulerTourLeaves.size();
+	}
+}
 
-	std::pair<size_t, size_t> innerLinks = get_path_inner_links(referenceTree.node_at(uIdx),
-			referenceTree.node_at(vIdx), referenceTree.node_at(lcaIdx));
-
-	size_t linkSubtree1 = referenceTree.link_at(innerLinks.first).next().index();
-	size_t linkSubtree2 = referenceTree.link_at(innerLinks.first).next().next().index();
-	size_t linkSubtree3 = referenceTree.link_at(innerLinks.second).next().index();
-	size_t linkSubtree4 = referenceTree.link_at(innerLinks.second).next().next().index();
+/**
+ * Count the topologies of the quartets in one slice of the metaquartet induced by the pair of inner nodes {u,v}.
+ * The largest subtree is cut into the given number of parts, and only the quartets with a taxon in the given part are
+ * visited, so that the slices of a large metaquartet can be counted by different threads.
+ * @param uIdx the ID of the inner node u
+ * @param vIdx the ID of the inner node v
+ * @param part the slice, less than parts
+ * @param parts the number of slices, at most the size of the largest subtree
+ */
+template<typename CINT, template<typename > class Backend>
+MetaquartetCounts QuartetScoreComputer<CINT, Backend>::countNodePair(size_t uIdx, size_t vIdx, size_t part,
+		size_t parts) {
 	// iterate over all quartets from {subtree1} x {subtree2} x {subtree3} x {subtree4}.
 	// These are the quartets relevant to the current metaquartet.
-	size_t startLeafIndexS1 = linkToEulerLeafIndex[linkSubtree1] % eulerTourLeaves.size();
-	size_t endLeafIndexS1 = linkToEulerLeafIndex[referenceTree.link_at(linkSubtree1).outer().index()]
-			% eulerTourLeaves.size();
-	size_t startLeafIndexS2 = linkToEulerLeafIndex[linkSubtree2] % eulerTourLeaves.size();
-	size_t endLeafIndexS2 = linkToEulerLeafIndex[referenceTree.link_at(linkSubtree2).outer().index()]
-			% eulerTourLeaves.size();
-	size_t startLeafIndexS3 = linkToEulerLeafIndex[linkSubtree3] % eulerTourLeaves.size();
-	size_t endLeafIndexS3 = linkToEulerLeafIndex[referenceTree.link_at(linkSubtree3).outer().index()]
-			% eulerTourLeaves.size();
-	size_t startLeafIndexS4 = linkToEulerLeafIndex[linkSubtree4] % eulerTourLeaves.size();
-	size_t endLeafIndexS4 = linkToEulerLeafIndex[referenceTree.link_at(linkSubtree4).outer().index()]
-			% eulerTourLeaves.size();
-
-	size_t aLeafIndex = startLeafIndexS1;
-	size_t bLeafIndex = startLeafIndexS2;
-	size_t cLeafIndex = startLeafIndexS3;
-	size_t dLeafIndex = startLeafIndexS4;
-
-	while (aLeafIndex != endLeafIndexS1) {
-		while (bLeafIndex != endLeafIndexS2) {
-			while (cLeafIndex != endLeafIndexS3) {
-				while (dLeafIndex != endLeafIndexS4) {
-					size_t aIdx = eulerTourLeaves[aLeafIndex];
-					size_t bIdx = eulerTourLeaves[bLeafIndex];
-					size_t cIdx = eulerTourLeaves[cLeafIndex];
-					size_t dIdx = eulerTourLeaves[dLeafIndex];
-
-					// process the quartet (a,b,c,d)
-					// We already know by the way we defined S1,S2,S3,S4 that the reference tree has the quartet topology ab|cd
-					std::tuple<CINT, CINT, CINT> quartetOccurrences = countQuartetOccurrences(aIdx, bIdx, cIdx, dIdx);
-					p1 += std::get<0>(quartetOccurrences);
-					p2 += std::get<1>(quartetOccurrences);
-					p3 += std::get<2>(quartetOccurrences);
-					double qic = log_score(std::get<0>(quartetOccurrences), std::get<1>(quartetOccurrences),
-							std::get<2>(quartetOccurrences));
+	size_t const numLeaves = eulerTourLeaves.size();
+	std::array<size_t, 4> startLeafIndex;
+	std::array<size_t, 4> endLeafIndex;
+	nodePairLeafRanges(uIdx, vIdx, startLeafIndex, endLeafIndex);
+	if (parts > 1) {
+		size_t largest = 0;
+		size_t largestSize = 0;
+		for (size_t s = 0; s < 4; ++s) {
+			size_t const size = (endLeafIndex[s] + numLeaves - startLeafIndex[s]) % numLeaves;
+			if (size > largestSize) {
+				largest = s;
+				largestSize = size;
+			}
+		}
+		size_t const first = largestSize * part / parts;
+		size_t const last = largestSize * (part + 1) / parts;
+		endLeafIndex[largest] = (startLeafIndex[largest] + last) % numLeaves;
+		startLeafIndex[largest] = (startLeafIndex[largest] + first) % numLeaves;
+	}
 
-					// find path ends
-					size_t lca_ab = informationReferenceTree.lowestCommonAncestorIdx(aIdx, bIdx, rootIdx);
-					size_t lca_cd = informationReferenceTree.lowestCommonAncestorIdx(cIdx, dIdx, rootIdx);
-					size_t fromIdx, toIdx;
-					if (lca_cd == informationReferenceTree.lowestCommonAncestorIdx(cIdx, dIdx, lca_ab)) {
-						fromIdx = informationReferenceTree.lowestCommonAncestorIdx(aIdx, bIdx, lca_cd);
-						toIdx = lca_cd;
-					} else {
-						fromIdx = lca_ab;
-						toIdx = informationReferenceTree.lowestCommonAncestorIdx(cIdx, dIdx, lca_ab);
+	// occurrences of topologies of the the metaquartet induced by {u,v} in the evaluation trees
+	MetaquartetCounts counts;
+	counts.p1 = 0;
+	counts.p2 = 0;
+	counts.p3 = 0;
+	counts.lqic = std::numeric_limits<double>::infinity();
+	uint64_t numQuartets = 0;
+
+	// the counts of a block of quartets, whose LQ-IC scores are computed at once
+	QicKernel const &qic = quartetCounterLookup->qicKernel();
+	std::array<uint64_t, QicKernel::BLOCK> blockQ1;
+	std::array<uint64_t, QicKernel::BLOCK> blockQ2;
+	std::array<uint64_t, QicKernel::BLOCK> blockQ3;
+	size_t blockSize = 0;
+	std::vector<size_t> runTaxa;
+	std::array<std::tuple<CINT, CINT, CINT>, QicKernel::BLOCK> runCounts;
+
+	// The lookup IDs are the positions of the leaves in the Euler tour, so each subtree is one range of IDs, or two if
+	// it contains the end of the tour. In a product of four disjoint ranges, the largest ID of each quartet is in the
+	// highest range, the second largest in the second highest, and so on. With the lowest range in the innermost loop,
+	// the ranks of consecutive quartets in the lookup table are consecutive, and the outer loops move upwards through
+	// the table. Trees other than the one the quartets were counted for are enumerated the same way, with less locality.
+	size_t wrapping = 4;
+	for (size_t s = 0; s < 4; ++s) {
+		if (endLeafIndex[s] != 0 && endLeafIndex[s] < startLeafIndex[s]) {
+			wrapping = s;
+		}
+	}
+
+	for (size_t piece = 0; piece < (wrapping < 4 ? 2 : 1); ++piece) {
+		// leaf index ranges [first, last) and the subtree they belong to, ordered by their position in the tour
+		std::array<std::array<size_t, 3>, 4> ranges;
+		for (size_t s = 0; s < 4; ++s) {
+			ranges[s] = { { startLeafIndex[s], endLeafIndex[s] == 0 ? numLeaves : endLeafIndex[s], s } };
+		}
+		if (wrapping < 4) {
+			ranges[wrapping] = piece == 0 ? std::array<size_t, 3> { { startLeafIndex[wrapping], numLeaves, wrapping } }
+					: std::array<size_t, 3> { { 0, endLeafIndex[wrapping], wrapping } };
+		}
+		std::sort(ranges.begin(), ranges.end());
+
+		// lookup IDs of the taxa of the innermost loop, which are looked up as one run per iteration of the outer loops
+		runTaxa.clear();
+		for (size_t i0 = ranges[0][0]; i0 < ranges[0][1]; ++i0) {
+			runTaxa.push_back(refIdToLookupId[eulerTourLeaves[i0]]);
+		}
+
+		// the lookup IDs of the quartet ab|cd, with a and b in the subtrees of u and c and d in those of v
+		std::array<size_t, 4> quartet;
+		for (size_t i3 = ranges[3][0]; i3 < ranges[3][1]; ++i3) {
+			quartet[ranges[3][2]] = refIdToLookupId[eulerTourLeaves[i3]];
+			for (size_t i2 = ranges[2][0]; i2 < ranges[2][1]; ++i2) {
+				quartet[ranges[2][2]] = refIdToLookupId[eulerTourLeaves[i2]];
+				for (size_t i1 = ranges[1][0]; i1 < ranges[1][1]; ++i1) {
+					quartet[ranges[1][2]] = refIdToLookupId[eulerTourLeaves[i1]];
+					// the next run starts far away in the table
+					if (i1 + 1 < ranges[1][1] && !runTaxa.empty()) {
+						quartetCounterLookup->prefetchLookup(quartet[ranges[3][2]], quartet[ranges[2][2]],
+								refIdToLookupId[eulerTourLeaves[i1 + 1]], runTaxa.front());
 					}
-					// update the LQ-IC scores of the edges from fromIdx to toIdx
-					size_t lcaFromToIdx = informationReferenceTree.lowestCommonAncestorIdx(fromIdx, toIdx, rootIdx);
-					for (auto it : path_set(referenceTree.node_at(fromIdx), referenceTree.node_at(toIdx),
-							referenceTree.node_at(lcaFromToIdx))) {
-						if (it.is_lca())
-							continue;
-#pragma omp critical
-						LQICScores[it.edge().index()] = std::min(LQICScores[it.edge().index()], qic);
+					for (size_t first = 0; first < runTaxa.size(); first += QicKernel::BLOCK) {
+						size_t const runSize = std::min<size_t>(QicKernel::BLOCK, runTaxa.size() - first);
+						// We already know by the way we defined S1,S2,S3,S4 that the reference tree has the quartet topology ab|cd
+						quartetCounterLookup->countLookupQuartetRun(quartet, ranges[0][2], runTaxa.data() + first,
+								runSize, runCounts.data());
+						for (size_t i = 0; i < runSize; ++i) {
+							std::tuple<CINT, CINT, CINT> const &quartetOccurrences = runCounts[i];
+							counts.p1 += std::get<0>(quartetOccurrences);
+							counts.p2 += std::get<1>(quartetOccurrences);
+							counts.p3 += std::get<2>(quartetOccurrences);
+							// the inner path of each quartet ab|cd of the metaquartet is the path from u to v, so its
+							// LQ-IC score only lowers the minimum of the node pair
+							blockQ1[blockSize] = std::get<0>(quartetOccurrences);
+							blockQ2[blockSize] = std::get<1>(quartetOccurrences);
+							blockQ3[blockSize] = std::get<2>(quartetOccurrences);
+							if (++blockSize == QicKernel::BLOCK) {
+								counts.lqic = std::min(counts.lqic,
+										qic.minScore(blockQ1.data(), blockQ2.data(), blockQ3.data(), blockSize));
+								blockSize = 0;
+							}
+						}
+						numQuartets += runSize;
 					}
-
-					dLeafIndex = (dLeafIndex + 1) % eulerTourLeaves.size();
 				}
-				cLeafIndex = (cLeafIndex + 1) % eulerTourLeaves.size();
-				dLeafIndex = startLeafIndexS4;
 			}
-			bLeafIndex = (bLeafIndex + 1) % eulerTourLeaves.size();
-			cLeafIndex = startLeafIndexS3;
-			dLeafIndex = startLeafIndexS4;
 		}
-		aLeafIndex = (aLeafIndex + 1) % eulerTourLeaves.size();
-		bLeafIndex = startLeafIndexS2;
-		cLeafIndex = startLeafIndexS3;
-		dLeafIndex = startLeafIndexS4;
 	}
+	counts.lqic = std::min(counts.lqic, qic.minScore(blockQ1.data(), blockQ2.data(), blockQ3.data(), blockSize));
+
+	// one lookup per quartet
+	Metrics::get_instance().add(Metrics::TABLE_LOOKUPS, numQuartets);
+	if (part == 0) {
+		Metrics::get_instance().add(Metrics::METAQUARTETS_SCORED, 1);
+	}
+	return counts;
+}
 
+/**
+ * Score the metaquartet induced by the pair of inner nodes {u,v}, without updating the scores of any edge.
+ * As each quartet contributes to only one metaquartet induced by a node pair, our code visits each quartet exactly once.
+ * @param uIdx the ID of the inner node u
+ * @param vIdx the ID of the inner node v
+ */
+template<typename CINT, template<typename > class Backend>
+NodePairScore QuartetScoreComputer<CINT, Backend>::scoreNodePair(size_t uIdx, size_t vIdx) {
+	MetaquartetCounts const counts = countNodePair(uIdx, vIdx, 0, 1);
+	NodePairScore score;
+	score.lqic = counts.lqic;
 	// compute the QP-IC score of the current metaquartet
-	double qpic = log_score(p1, p2, p3);
+	score.qpic = log_score(counts.p1, counts.p2, counts.p3);
+	return score;
+}
+
+/**
+ * Score the metaquartets of many node pairs in parallel. The work of a node pair is the number of its quartets,
+ * |S1|*|S2|*|S3|*|S4|, which differs by orders of magnitude between node pairs. The pairs are cut into blocks of about
+ * equal work, see countNodePair(), and the blocks are handed out to the threads from the largest to the smallest, so
+ * that no thread is left with a large block at the end.
+ * @param pairs the node pairs {u,v}
+ * @return the scores of the node pairs, in the same order
+ */
+template<typename CINT, template<typename > class Backend>
+std::vector<NodePairScore> QuartetScoreComputer<CINT, Backend>::scoreNodePairs(
+		std::vector<std::pair<size_t, size_t>> const &pairs) {
+	// blocks with fewer quartets are not worth splitting
+	uint64_t const minBlockQuartets = uint64_t(1) << 14;
+	uint64_t const blocksPerThread = 16;
+
+	// the number of quartets and the size of the largest subtree of each pair
+	size_t const numLeaves = eulerTourLeaves.size();
+	std::vector<uint64_t> pairQuartets(pairs.size());
+	std::vector<size_t> largestSubtree(pairs.size());
+#pragma omp parallel for schedule(static) num_threads(numThreads)
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		std::array<size_t, 4> start;
+		std::array<size_t, 4> end;
+		nodePairLeafRanges(pairs[i].first, pairs[i].second, start, end);
+		pairQuartets[i] = 1;
+		largestSubtree[i] = 0;
+		for (size_t s = 0; s < 4; ++s) {
+			size_t const size = (end[s] + numLeaves - start[s]) % numLeaves;
+			pairQuartets[i] *= size;
+			largestSubtree[i] = std::max(largestSubtree[i], size);
+		}
+	}
+	uint64_t totalQuartets = 0;
+	for (uint64_t quartets : pairQuartets) {
+		totalQuartets += quartets;
+	}
+	uint64_t const blockQuartets = std::max(minBlockQuartets, totalQuartets / (blocksPerThread * numThreads));
+
+	// the blocks of a pair are consecutive
+	struct Block {
+		size_t pair;
+		size_t part;
+		size_t parts;
+		uint64_t quartets;
+	};
+	std::vector<Block> blocks;
+	std::vector<size_t> firstBlock(pairs.size() + 1);
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		firstBlock[i] = blocks.size();
+		size_t const parts = std::max<size_t>(1, std::min<uint64_t>(largestSubtree[i],
+				(pairQuartets[i] + blockQuartets - 1) / blockQuartets));
+		for (size_t part = 0; part < parts; ++part) {
+			blocks.push_back({ i, part, parts, pairQuartets[i] / parts });
+		}
+	}
+	firstBlock[pairs.size()] = blocks.size();
+	std::vector<size_t> order(blocks.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&blocks](size_t a, size_t b) {
+		return blocks[a].quartets > blocks[b].quartets;
+	});
+
+	std::vector<MetaquartetCounts> blockCounts(blocks.size());
+#pragma omp parallel num_threads(numThreads)
+	{
+		MetricsSpan span("scoring thread", "scoring");
+#pragma omp for schedule(dynamic)
+		for (size_t i = 0; i < order.size(); ++i) {
+			Block const &block = blocks[order[i]];
+			blockCounts[order[i]] = countNodePair(pairs[block.pair].first, pairs[block.pair].second, block.part,
+					block.parts);
+		}
+	}
+
+	std::vector<NodePairScore> scores(pairs.size());
+	for (size_t i = 0; i < pairs.size(); ++i) {
+		MetaquartetCounts counts = blockCounts[firstBlock[i]];
+		for (size_t b = firstBlock[i] + 1; b < firstBlock[i + 1]; ++b) {
+			counts.p1 += blockCounts[b].p1;
+			counts.p2 += blockCounts[b].p2;
+			counts.p3 += blockCounts[b].p3;
+			counts.lqic = std::min(counts.lqic, blockCounts[b].lqic);
+		}
+		scores[i].lqic = counts.lqic;
+		scores[i].qpic = log_score(counts.p1, counts.p2, counts.p3);
+	}
+	return scores;
+}
+
+/**
+ * Update the LQ-IC, QP-IC, and EQP-IC scores of the edges with the scores of node pairs. Each thread keeps the minima
+ * of its pairs, which are merged at the end.
+ * @param pairs the node pairs {u,v}
+ * @param scores the scores of the node pairs, see scoreNodePairs()
+ */
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::applyNodePairScores(std::vector<std::pair<size_t, size_t>> const &pairs,
+		std::vector<NodePairScore> const &scores) {
+	// one path for the LQ-IC and EQP-IC scores of all quartets of a node pair
+	Metrics::get_instance().add(Metrics::PATH_WALKS, pairs.size());
+#pragma omp parallel num_threads(numThreads)
+	{
+		std::vector<double> lqic(referenceTree.edge_count(), std::numeric_limits<double>::infinity());
+		std::vector<double> eqpic(referenceTree.edge_count(), std::numeric_limits<double>::infinity());
+#pragma omp for schedule(dynamic, 256)
+		for (size_t i = 0; i < pairs.size(); ++i) {
+			size_t const uIdx = pairs[i].first;
+			size_t const vIdx = pairs[i].second;
+			NodePairScore const &score = scores[i];
+
+			// if u and v are neighbors, this is the QP-IC score of the edge connecting them, which no other pair sets
+			auto const& u_link = referenceTree.node_at(uIdx).link();
+			auto const& v_link = referenceTree.node_at(vIdx).link();
+			if (u_link.outer().node().index() == vIdx) {
+				QPICScores[u_link.edge().index()] = score.qpic;
+			} else if (v_link.outer().node().index() == uIdx) {
+				QPICScores[v_link.edge().index()] = score.qpic;
+			}
+
+			size_t const lcaIdx = informationReferenceTree.lowestCommonAncestorIdx(uIdx, vIdx, rootIdx);
+			informationReferenceTree.forEachPathEdge(uIdx, vIdx, lcaIdx, [&](size_t edgeIdx) {
+				lqic[edgeIdx] = std::min(lqic[edgeIdx], score.lqic);
+				eqpic[edgeIdx] = std::min(eqpic[edgeIdx], score.qpic);
+			});
+		}
+#pragma omp critical
+		for (size_t e = 0; e < referenceTree.edge_count(); ++e) {
+			LQICScores[e] = std::min(LQICScores[e], lqic[e]);
+			EQPICScores[e] = std::min(EQPICScores[e], eqpic[e]);
+		}
+	}
+}
+
+/**
+ * Update LQ-IC, QP-IC, and EQP-IC scores of all internodes influenced by the pair of inner nodes {u,v}.
+ * @param uIdx the ID of the inner node u
+ * @param vIdx the ID of the inner node v
+ */
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::processNodePair(size_t uIdx, size_t vIdx) {
+	NodePairScore const score = scoreNodePair(uIdx, vIdx);
+	size_t lcaIdx = informationReferenceTree.lowestCommonAncestorIdx(uIdx, vIdx, rootIdx);
+	// one path for the LQ-IC and EQP-IC scores of all quartets of the node pair
+	Metrics::get_instance().add(Metrics::PATH_WALKS, 1);
 
 	// check if uIdx and vIdx are neighbors; if so, set QP-IC score of the edge connecting u and v
 	auto const& u_link = referenceTree.node_at(uIdx).link();
 	auto const& v_link = referenceTree.node_at(vIdx).link();
 	if (u_link.outer().node().index() == vIdx) {
-		QPICScores[u_link.edge().index()] = qpic;
+		QPICScores[u_link.edge().index()] = score.qpic;
 	} else if (v_link.outer().node().index() == uIdx) {
-		QPICScores[v_link.edge().index()] = qpic;
+		QPICScores[v_link.edge().index()] = score.qpic;
 	}
 
-	// update the EQP-IC scores of the edges from uIdx to vIdx
-	for (auto it : path_set(referenceTree.node_at(uIdx), referenceTree.node_at(vIdx), referenceTree.node_at(lcaIdx))) {
-		if (it.is_lca())
-			continue;
+	// update the LQ-IC and EQP-IC scores of the edges from uIdx to vIdx
+	informationReferenceTree.forEachPathEdge(uIdx, vIdx, lcaIdx, [&](size_t edgeIdx) {
 #pragma omp critical
-		EQPICScores[it.edge().index()] = std::min(EQPICScores[it.edge().index()], qpic);
-	}
+		{
+			LQICScores[edgeIdx] = std::min(LQICScores[edgeIdx], score.lqic);
+			EQPICScores[edgeIdx] = std::min(EQPICScores[edgeIdx], score.qpic);
+		}
+	});
 }
 
 /**
  * Compute the LQ-IC, QP-IC, and EQP-IC support scores, iterating over node pairs.
  */
-template<typename CINT>
-void QuartetScoreComputer<CINT>::computeQuartetScoresBifurcating() {
-	// Process all pairs of inner nodes
-#pragma omp parallel for schedule(dynamic)
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::computeQuartetScoresBifurcating() {
+	// the pairs are scheduled in batches, which bounds the memory of the schedule
+	size_t const batchPairs = size_t(1) << 20;
+	std::vector<std::pair<size_t, size_t>> batch;
+
+	if (!selection.empty()) {
+		// only the node pairs relevant to the selected edges
+		std::vector<std::pair<size_t, size_t>> const pairs = selection.nodePairs(referenceTree);
+		ProgressReporter progress("Computing scores", "metaquartets", Metrics::METAQUARTETS_SCORED, pairs.size(),
+				*log);
+		for (size_t first = 0; first < pairs.size(); first += batchPairs) {
+			batch.assign(pairs.begin() + first, pairs.begin() + std::min(pairs.size(), first + batchPairs));
+			applyNodePairScores(batch, scoreNodePairs(batch));
+		}
+		return;
+	}
+
+	// all pairs of inner nodes, generated batch by batch instead of all O(n^2) at once
+	std::vector<size_t> innerNodes;
 	for (size_t i = 0; i < referenceTree.node_count(); ++i) {
-		if (!referenceTree.node_at(i).is_inner())
-			continue;
-		for (size_t j = i + 1; j < referenceTree.node_count(); ++j) {
-			if (!referenceTree.node_at(j).is_inner())
-				continue;
-			processNodePair(i, j);
+		if (referenceTree.node_at(i).is_inner()) {
+			innerNodes.push_back(i);
+		}
+	}
+	uint64_t const numPairs = innerNodes.empty() ? 0 : uint64_t(innerNodes.size()) * (innerNodes.size() - 1) / 2;
+	ProgressReporter progress("Computing scores", "metaquartets", Metrics::METAQUARTETS_SCORED, numPairs, *log);
+	batch.reserve(std::min<uint64_t>(batchPairs, numPairs));
+	// the cursor is at the pair {innerNodes[i], innerNodes[j]}, with i < j
+	size_t i = 0;
+	size_t j = 1;
+	while (j < innerNodes.size()) {
+		batch.clear();
+		while (batch.size() < batchPairs && j < innerNodes.size()) {
+			batch.emplace_back(innerNodes[i], innerNodes[j]);
+			if (++i == j) {
+				i = 0;
+				++j;
+			}
 		}
+		applyNodePairScores(batch, scoreNodePairs(batch));
 	}
 }
 
 /**
  * Compute LQ-IC scores for a (possibly multifurcating) reference tree. Iterate over quartets.
  */
-template<typename CINT>
-void QuartetScoreComputer<CINT>::computeQuartetScoresMultifurcating() {
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::computeQuartetScoresMultifurcating() {
 	// Process all quartets
-#pragma omp parallel for schedule(dynamic)
+#pragma omp parallel for schedule(dynamic) num_threads(numThreads)
 	for (size_t uLeafIdx = 0; uLeafIdx < eulerTourLeaves.size(); uLeafIdx++) {
 		for (size_t vLeafIdx = uLeafIdx + 1; vLeafIdx < eulerTourLeaves.size(); vLeafIdx++) {
 			for (size_t wLeafIdx = vLeafIdx + 1; wLeafIdx < eulerTourLeaves.size(); wLeafIdx++) {
@@ -555,8 +818,8 @@ void QuartetScoreComputer<CINT>::computeQuartetScoresMultifurcating() {
 
 					std::tuple<CINT, CINT, CINT> quartetOccurrences = countQuartetOccurrences(aIdx, bIdx, cIdx, dIdx);
 
-					double qic = log_score(std::get<0>(quartetOccurrences), std::get<1>(quartetOccurrences),
-							std::get<2>(quartetOccurrences));
+					double qic = quartetCounterLookup->qicKernel().score(std::get<0>(quartetOccurrences),
+							std::get<1>(quartetOccurrences), std::get<2>(quartetOccurrences));
 
 					// find path ends
 					size_t lca_ab = informationReferenceTree.lowestCommonAncestorIdx(aIdx, bIdx, rootIdx);
@@ -571,13 +834,10 @@ void QuartetScoreComputer<CINT>::computeQuartetScoresMultifurcating() {
 					}
 					// update the LQ-IC scores of the edges from fromIdx to toIdx
 					size_t lcaFromToIdx = informationReferenceTree.lowestCommonAncestorIdx(fromIdx, toIdx, rootIdx);
-					for (auto it : path_set(referenceTree.node_at(fromIdx), referenceTree.node_at(toIdx),
-							referenceTree.node_at(lcaFromToIdx))) {
-						if (it.is_lca())
-							continue;
+					informationReferenceTree.forEachPathEdge(fromIdx, toIdx, lcaFromToIdx, [&](size_t edgeIdx) {
 #pragma omp critical
-						LQICScores[it.edge().index()] = std::min(LQICScores[it.edge().index()], qic);
-					}
+						LQICScores[edgeIdx] = std::min(LQICScores[edgeIdx], qic);
+					});
 				}
 			}
 		}
@@ -589,105 +849,166 @@ void QuartetScoreComputer<CINT>::computeQuartetScoresMultifurcating() {
  * The leaf indices are between [start,stop).
  * @param linkIdx the genesis ID of the link inducing a subtree
  */
-template<typename CINT>
-std::pair<size_t, size_t> QuartetScoreComputer<CINT>::subtreeLeafIndices(size_t linkIdx) {
+template<typename CINT, template<typename > class Backend>
+std::pair<size_t, size_t> QuartetScoreComputer<CINT, Backend>::subtreeLeafIndices(size_t linkIdx) {
 	size_t outerLinkIdx = referenceTree.link_at(linkIdx).outer().index();
 	return {linkToEulerLeafIndex[linkIdx] % linkToEulerLeafIndex.size(), linkToEulerLeafIndex[outerLinkIdx] % linkToEulerLeafIndex.size()};
 }
 
 /**
- * Get the amount of total system RAM memory available.
+ * @param refTree the reference tree
+ * @param evalTrees path to the file containing the set of evaluation trees
+ * @param m number of evaluation trees
+ * @param verboseOutput print some additional (debug) information
  */
-// Code adapted from http://stackoverflow.com/questions/2513505/how-to-get-available-memory-c-g
-inline size_t getTotalSystemMemory() {
-#if defined( _WIN32 ) || defined(  _WIN64  )
-	MEMORYSTATUSEX status;
-	status.dwLength = sizeof(status);
-	GlobalMemoryStatusEx(&status);
-	return status.ullTotalPhys;
-#else
-	size_t pages = sysconf(_SC_PHYS_PAGES);
-	size_t page_size = sysconf(_SC_PAGE_SIZE);
-	return pages * page_size;
-#endif
+template<typename CINT, template<typename > class Backend>
+QuartetScoreComputer<CINT, Backend>::QuartetScoreComputer(Tree const &refTree, const std::string &evalTreesPath, size_t m,
+		bool verboseOutput, HugePageMode hugePages, int num_threads, int internalMemory, std::ostream &log,
+		EdgeSelection const &selection) :
+		QuartetScoreComputer(refTree, geneTreeFileOpener(evalTreesPath, num_threads), m, verboseOutput, hugePages,
+				num_threads, internalMemory, log, selection) {
 }
 
 /**
  * @param refTree the reference tree
- * @param evalTrees path to the file containing the set of evaluation trees
+ * @param openEvalTrees opens the set of evaluation trees
  * @param m number of evaluation trees
  * @param verboseOutput print some additional (debug) information
+ * @param num_threads number of threads, 0 for the OpenMP default
+ * @param log where to print status messages and progress, e.g. a stream without buffer to discard them
+ * @param selection the edges whose scores are computed, all edges if empty
  */
-template<typename CINT>
-QuartetScoreComputer<CINT>::QuartetScoreComputer(Tree const &refTree, const std::string &evalTreesPath, size_t m,
-		bool verboseOutput, bool enforeSmallMem, int num_threads, int internalMemory) {
-	referenceTree = refTree;
-	rootIdx = referenceTree.root_node().index();
-
+template<typename CINT, template<typename > class Backend>
+QuartetScoreComputer<CINT, Backend>::QuartetScoreComputer(Tree const &refTree, GeneTreeOpener const &openEvalTrees,
+		size_t m, bool verboseOutput, HugePageMode hugePages, int num_threads, int internalMemory, std::ostream &log,
+		EdgeSelection const &selection) {
 	verbose = verboseOutput;
+	numThreads = resolveNumThreads(num_threads);
+	this->log = &log;
+	this->selection = selection;
 
-	std::cout << "There are " << m << " evaluation trees.\n";
+	log << "There are " << m << " evaluation trees.\n";
 
-	std::cout << "Building subtree informations for reference tree..." << std::endl;
-	// precompute subtree informations
-	informationReferenceTree.init(refTree);
-	linkToEulerLeafIndex.resize(referenceTree.link_count());
-	for (auto it : eulertour(referenceTree)) {
-		if (it.node().is_leaf()) {
-			eulerTourLeaves.push_back(it.node().index());
-		}
-		linkToEulerLeafIndex[it.link().index()] = eulerTourLeaves.size();
-	}
+	log << "Building subtree informations for reference tree..." << std::endl;
+	initReferenceTree(refTree);
 	size_t n = eulerTourLeaves.size();
 
-	std::cout << "Finished precomputing subtree informations in reference tree.\n";
-	std::cout << "The reference tree has " << n << " taxa.\n";
+	log << "Finished precomputing subtree informations in reference tree.\n";
+	log << "The reference tree has " << n << " taxa.\n";
 
 	//estimate memory requirements
-	size_t memoryLookupFast = n * n * n * n * sizeof(CINT);
-	size_t memoryLookup = (n * (n - 1) * (n - 2) * (n - 3) / 24) * 3 * sizeof(CINT) + sizeof(size_t);
-	size_t estimatedMemory = getTotalSystemMemory();
+	// m counts each tree twice, as the quartet counts do
+	size_t memoryLookup = Backend<CINT>::tableBytes(n, m / 2) + sizeof(size_t);
+	// free memory within the cgroup limit, not the total RAM of the machine
+	size_t estimatedMemory = readMemoryLimit().effective();
 
-	std::cout << "Estimated memory usages (in bytes):" << std::endl;
-	std::cout << "  Runtime-efficient Lookup table: " << memoryLookupFast << std::endl;
-	std::cout << "  Memory-efficient Lookup table: " << memoryLookup << std::endl;
-	std::cout << "  Estimated available memory: " << estimatedMemory << std::endl;
+	log << "Estimated memory usages (in bytes):" << std::endl;
+	log << "  Lookup table: " << memoryLookup << std::endl;
+	log << "  Estimated available memory: " << estimatedMemory << std::endl;
 
 	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
-	if (memoryLookup > estimatedMemory) {
+	if (Backend<CINT>::STORES_ALL_QUARTETS && memoryLookup > estimatedMemory) {
 		throw std::runtime_error("Insufficient memory!");
 	}
 
-	//if (enforeSmallMem || memoryLookupFast > 0.9 * estimatedMemory) {
-	if(enforeSmallMem){
-		std::cout << "Using memory-efficient Lookup table\n";
-		quartetCounterLookup = make_unique<QuartetCounterLookup<CINT> >(refTree, evalTreesPath, m, true, num_threads, internalMemory);
-	} else {
-		std::cout << "Using runtime-efficient Lookup table\n";
-		quartetCounterLookup = make_unique<QuartetCounterLookup<CINT> >(refTree, evalTreesPath, m, false, num_threads, internalMemory);
-	}
+	log << "Using the " << Backend<CINT>::name() << " counting backend\n";
+	quartetCounterLookup = std::make_shared<QuartetCounterLookup<CINT, Backend> >(refTree, openEvalTrees, m, hugePages, num_threads, internalMemory, log);
+	refIdToLookupId = quartetCounterLookup->lookupIDs(referenceTree);
 
 	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
-	std::cout << "Finished counting quartets.\n";
-	LOG(INFO) << "[countingQuartets_time] {" << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()<< " ms]";
+	countingTime = end - begin;
+	Metrics::get_instance().addSpan("counting", "phase", begin, end);
+	log << "Finished counting quartets.\n";
+	Metrics::get_instance().logTime("countingQuartets_time", begin, end);
 
 	begin = std::chrono::steady_clock::now();
+	computeScores();
+	end = std::chrono::steady_clock::now();
+	scoringTime = end - begin;
+	Metrics::get_instance().addSpan("scoring", "phase", begin, end);
+
+	log << "Finished computing scores.\n";
+	Metrics::get_instance().logTime("computingScores_time", begin, end);
+}
+
+/**
+ * Compute the scores of a reference tree from quartet counts that have already been computed, e.g. for another
+ * reference tree on the same taxa. Only the scoring phase is run, and the counts may be shared by concurrent computers.
+ * @param refTree the reference tree, whose taxa have to be a subset of the taxa the quartets were counted for
+ * @param counter the quartet counts of the evaluation trees
+ * @param num_threads number of threads, 0 for the OpenMP default
+ * @param log where to print status messages and progress
+ */
+template<typename CINT, template<typename > class Backend>
+QuartetScoreComputer<CINT, Backend>::QuartetScoreComputer(Tree const &refTree,
+		std::shared_ptr<QuartetCounterLookup<CINT, Backend> const> counter, int num_threads, std::ostream &log) :
+		verbose(false), numThreads(resolveNumThreads(num_threads)), log(&log),
+		quartetCounterLookup(std::move(counter)), countingTime(0) {
+	initReferenceTree(refTree);
+	refIdToLookupId = quartetCounterLookup->lookupIDs(referenceTree);
+
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	computeScores();
+	scoringTime = std::chrono::steady_clock::now() - begin;
+}
+
+/**
+ * A computer without reference tree for IncrementalScorer, which sets the tree and scores the node pairs itself.
+ */
+template<typename CINT, template<typename > class Backend>
+QuartetScoreComputer<CINT, Backend>::QuartetScoreComputer(
+		std::shared_ptr<QuartetCounterLookup<CINT, Backend> const> counter, int num_threads) :
+		rootIdx(0), verbose(false), numThreads(resolveNumThreads(num_threads)), log(nullptr),
+		quartetCounterLookup(std::move(counter)), countingTime(0), scoringTime(0) {
+}
+
+/**
+ * Precompute the subtree informations and the Euler tour of the reference tree.
+ */
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::initReferenceTree(Tree const &refTree) {
+	referenceTree = refTree;
+	indexReferenceTree();
+}
+
+/**
+ * Recompute the subtree informations and the Euler tour after the topology of the reference tree has changed.
+ */
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::indexReferenceTree() {
+	rootIdx = referenceTree.root_node().index();
+
+	informationReferenceTree.init(referenceTree);
+	eulerTourLeaves.clear();
+	linkToEulerLeafIndex.resize(referenceTree.link_count());
+	for (auto it : eulertour(referenceTree)) {
+		if (it.node().is_leaf()) {
+			eulerTourLeaves.push_back(it.node().index());
+		}
+		linkToEulerLeafIndex[it.link().index()] = eulerTourLeaves.size();
+	}
+}
 
+/**
+ * Compute the scores of the reference tree from the quartet counts.
+ */
+template<typename CINT, template<typename > class Backend>
+void QuartetScoreComputer<CINT, Backend>::computeScores() {
 	// precompute taxon ID mappings
 	// this is commented out as it was not needed anywhere in the code.
 	//taxonMapper = make_unique<TaxonMapper>(referenceTree, evaluationTrees, eulerTourLeaves);
 	//std::cout << "Finished precomputing taxon ID mappings.\n";
 
-	if (!is_bifurcating(refTree)) {
-		std::cout << "The reference tree is multifurcating.\n";
+	if (!is_bifurcating(referenceTree)) {
+		*log << "The reference tree is multifurcating.\n";
 		LQICScores.resize(referenceTree.edge_count());
 		std::fill(LQICScores.begin(), LQICScores.end(), std::numeric_limits<double>::infinity());
 		// compute only LQ-IC scores
 		//computeQuartetScoresMultifurcating();
 	} else {
-		std::cout << "The reference tree is bifurcating.\n";
+		*log << "The reference tree is bifurcating.\n";
 		LQICScores.resize(referenceTree.edge_count());
 		QPICScores.resize(referenceTree.edge_count());
 		EQPICScores.resize(referenceTree.edge_count());
@@ -698,10 +1019,13 @@ QuartetScoreComputer<CINT>::QuartetScoreComputer(Tree const &refTree, const std:
 		// compute LQ-IC, QP-IC and EQP-IC scores
 		computeQuartetScoresBifurcating();
 		//computeQuartetScoresBifurcatingQuartets();
+		if (selection.qpicOnly) {
+			// the LQ-IC and EQP-IC scores would need all node pairs across the selected edges
+			LQICScores.clear();
+			EQPICScores.clear();
+		}
 	}
-
-	end = std::chrono::steady_clock::now();
-
-	std::cout << "Finished computing scores.\n";
-	LOG(INFO) << "[computingScores_time] [" << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()<< " ms]";
+	selection.clearUnselected(LQICScores);
+	selection.clearUnselected(QPICScores);
+	selection.clearUnselected(EQPICScores);
 }
@@ -1,13 +1,26 @@
 #include "genesis/genesis.hpp"
+#include "CladeIntersectionScorer.hpp"
+#include "CountingBackends.hpp"
+#include "EdgeSelection.hpp"
+#include "GeneTreeInput.hpp"
+#include "MemoryPlanner.hpp"
+#include "Metrics.hpp"
+#include "ProgressReporter.hpp"
 #include "quartet_newick_writer.hpp"
 #include "QuartetScoreComputer.hpp"
+#include "Resampling.hpp"
+#include "ScoringServer.hpp"
+#include "SpillDirectory.hpp"
 #include "tclap/CmdLine.h" // command line parser, downloaded from http://tclap.sourceforge.net/
 #include "easylogging++.h"
 
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <ctime>
 
@@ -21,18 +34,97 @@ using namespace tree;
 INITIALIZE_EASYLOGGINGPP
 
 /**
- * Count the number of evaluation trees.
+ * Count the number of evaluation trees, without parsing them.
+ * @param evalTreesPath path to the file containing the set of evaluation trees, optionally gzip or zstd compressed
+ * @param nThreads number of threads to use, 0 for the OpenMP default
+ */
+size_t countEvalTrees(const std::string &evalTreesPath, size_t nThreads) {
+	return countGeneTrees(evalTreesPath, nThreads);
+}
+
+/**
+ * Convert the evaluation trees into a prepared gene tree file for the taxa of the reference tree.
+ * Later runs with this file as evaluation trees skip parsing Newick.
+ * @param referenceTree the reference tree
  * @param evalTreesPath path to the file containing the set of evaluation trees
+ * @param outputPath path of the prepared gene tree file to write
+ * @param nThreads number of threads to use, 0 for the OpenMP default
+ */
+size_t prepareEvalTrees(Tree const &referenceTree, const std::string &evalTreesPath, const std::string &outputPath,
+		size_t nThreads) {
+	std::vector<std::string> taxa;
+	std::unordered_map<std::string, size_t> taxonToLookupID;
+	for (auto it : eulertour(referenceTree)) {
+		if (it.node().is_leaf()) {
+			taxonToLookupID[it.node().data<DefaultNodeData>().name] = taxa.size();
+			taxa.push_back(it.node().data<DefaultNodeData>().name);
+		}
+	}
+	std::unique_ptr<GeneTreeSource> source = openGeneTreeSource(evalTreesPath, taxonToLookupID, nThreads);
+	return prepared_gene_trees::write(*source, taxa, outputPath);
+}
+
+/**
+ * Count the quartets with the counting backend Backend and compute the scores. If servePath is given, the counts are
+ * kept instead to score the reference trees sent to the Unix socket at this path, or to standard input for "-".
+ */
+template<typename CINT, template<typename > class Backend>
+void computeScoresWith(Tree const &referenceTree, const std::string &evalTreesPath, size_t m, bool verbose,
+		HugePageMode hugePages, size_t nThreads, int internalMemory, std::string const &servePath,
+		EdgeSelection const &selection, std::vector<double> &lqic, std::vector<double> &qpic,
+		std::vector<double> &eqpic) {
+	if (!servePath.empty()) {
+		std::shared_ptr<QuartetCounterLookup<CINT, Backend> const> counter = std::make_shared<
+				QuartetCounterLookup<CINT, Backend> >(referenceTree, evalTreesPath, m, hugePages, nThreads,
+				internalMemory);
+		ScoringServer<CINT, Backend> server(counter, nThreads, std::cout);
+		if (servePath == "-") {
+			server.serveConnection(STDIN_FILENO, STDOUT_FILENO);
+		} else {
+			server.serveSocket(servePath);
+		}
+		return;
+	}
+	QuartetScoreComputer<CINT, Backend> qsc(referenceTree, evalTreesPath, m, verbose, hugePages, nThreads, internalMemory,
+			std::cout, selection);
+	qsc.releaseScores(lqic, qpic, eqpic);
+}
+
+/**
+ * Count the quartets and compute the scores. The backend is chosen here once, and each backend has its own
+ * instantiation of the counting and scoring loops.
  */
-size_t countEvalTrees(const std::string &evalTreesPath) {
-	size_t count = 0;
-	utils::InputStream instream(utils::make_unique<utils::FileInputSource>(evalTreesPath));
-	auto it = NewickInputIterator(instream);
-	while (it) {
-		count++;
-		++it;
-	}
-	return count;
+template<typename CINT>
+void computeScores(CountingBackend backend, Tree const &referenceTree, const std::string &evalTreesPath, size_t m,
+		bool verbose, HugePageMode hugePages, size_t nThreads, int internalMemory, std::string const &servePath,
+		EdgeSelection const &selection, std::vector<double> &lqic, std::vector<double> &qpic,
+		std::vector<double> &eqpic) {
+	switch (backend) {
+	case CountingBackend::DENSE:
+		computeScoresWith<CINT, DenseBackend>(referenceTree, evalTreesPath, m, verbose, hugePages, nThreads,
+				internalMemory, servePath, selection, lqic, qpic, eqpic);
+		break;
+	case CountingBackend::SORTER:
+		computeScoresWith<CINT, SorterBackend>(referenceTree, evalTreesPath, m, verbose, hugePages, nThreads,
+				internalMemory, servePath, selection, lqic, qpic, eqpic);
+		break;
+	case CountingBackend::PACKED:
+		computeScoresWith<CINT, PackedBackend>(referenceTree, evalTreesPath, m, verbose, hugePages, nThreads,
+				internalMemory, servePath, selection, lqic, qpic, eqpic);
+		break;
+	case CountingBackend::SPARSE:
+		computeScoresWith<CINT, SparseBackend>(referenceTree, evalTreesPath, m, verbose, hugePages, nThreads,
+				internalMemory, servePath, selection, lqic, qpic, eqpic);
+		break;
+	case CountingBackend::TILED:
+		computeScoresWith<CINT, TiledBackend>(referenceTree, evalTreesPath, m, verbose, hugePages, nThreads,
+				internalMemory, servePath, selection, lqic, qpic, eqpic);
+		break;
+	case CountingBackend::RESOLVED:
+		computeScoresWith<CINT, ResolvedBackend>(referenceTree, evalTreesPath, m, verbose, hugePages, nThreads,
+				internalMemory, servePath, selection, lqic, qpic, eqpic);
+		break;
+	}
 }
 
 /**
@@ -42,10 +134,26 @@ int main(int argc, char* argv[]) {
 	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
 	bool verbose = false;
-	bool savemem = false;
+	CountingBackend backend = CountingBackend::DENSE;
+	bool plan = false;
+	bool tableFree = false;
+	bool autoEngine = false;
+	HugePageMode hugePages = HugePageMode::TRANSPARENT;
 	std::string pathToReferenceTree;
 	std::string pathToEvaluationTrees;
 	std::string outputFilePath;
+	std::string preparePath;
+	std::string metricsPath;
+	std::string tracePath;
+	std::string servePath;
+	std::string spillDir;
+	bool spillDirGiven;
+	size_t bootstrapReplicates = 0;
+	size_t jackknifeReplicates = 0;
+	uint64_t seed = 0;
+	std::vector<std::string> edgeSpecs;
+	bool qpicOnly = false;
+	double progressInterval = 10;
 	size_t nThreads = 0;
 	int internalMemory = 33;
 
@@ -53,43 +161,118 @@ int main(int argc, char* argv[]) {
     el::Configurations conf("../logging.conf");
     // Actually reconfigure all loggers
     el::Loggers::reconfigureAllLoggers(conf);
+	Metrics::get_instance().setTimingLog([](std::string const &line) { LOG(INFO) << line; });
 
 	try {
 		TCLAP::CmdLine cmd("Compute quartet scores", ' ', "1.0");
 		TCLAP::ValueArg<std::string> refArg("r", "ref", "Path to the reference tree", true, "", "string");
-		TCLAP::ValueArg<std::string> evalArg("e", "eval", "Path to the evaluation trees", true, "", "string");
+		TCLAP::ValueArg<std::string> evalArg("e", "eval", "Path to the evaluation trees (plain, .gz or .zst)", true, "", "string");
 		TCLAP::ValueArg<std::string> outputArg("o", "output", "Path to the output file", true, "", "string");
+		TCLAP::ValueArg<std::string> serveArg("", "serve", "Instead of writing scores, keep the quartet counts in memory and score the Newick reference trees sent to a Unix socket at this path, or to standard input for '-'. Each tree is answered with the annotated tree and one line of scores per edge", true, "", "string");
+		TCLAP::ValueArg<std::string> prepareArg("", "prepare", "Instead of computing scores, convert the evaluation trees into a prepared binary file at this path, which can be given to -e in later runs", true, "", "string");
 		TCLAP::ValueArg<size_t> threadsArg("t", "threads", "Maximum number of threads to use", false, 0, "uint");
 		TCLAP::ValueArg<int> intMemArg("i", "internal", "Internal memory to use for external structure", false, 33, "uint");
+		TCLAP::ValueArg<std::string> spillArg("", "spill-dir", "Directory the external sorter spills to. By default, the disks of a .stxxl or $STXXLCFG file are used, or $TMPDIR or /tmp if there is none", false, "", "string");
 		TCLAP::SwitchArg verboseArg("v", "verbose", "Verbose mode", false);
-		TCLAP::SwitchArg savememArg("s", "savemem", "Consume less memory, but with the cost of increased runtime", false);
+		TCLAP::SwitchArg savememArg("s", "savemem", "Count with the external sorter, same as --backend sorter", false);
+		TCLAP::ValueArg<std::string> hugePagesArg("", "hugepages", "Huge pages for the lookup table: none, transparent or explicit", false, "transparent", "string");
+		TCLAP::SwitchArg packedArg("p", "packed", "Keep the quartet counts bit-packed after counting, same as --backend packed", false);
+		TCLAP::ValueArg<std::string> backendArg("", "backend", "Counting backend: dense, sorter, packed, sparse, tiled or resolved", false, "dense", "string");
+		TCLAP::SwitchArg tableFreeArg("", "table-free", "Compute only QP-IC and EQP-IC scores, from clade intersections instead of a quartet table (bifurcating reference trees only)", false);
+		TCLAP::SwitchArg planArg("", "plan", "Print the predicted memory and runtime of the counting engines for the effective memory limit and exit", false);
+		TCLAP::ValueArg<size_t> bootstrapArg("", "bootstrap", "Also compute the QP-IC and EQP-IC scores of this many bootstrap replicates of the evaluation trees, implies --table-free", false, 0, "uint");
+		TCLAP::ValueArg<size_t> jackknifeArg("", "jackknife", "Also compute the QP-IC and EQP-IC scores of this many delete-half jackknife replicates of the evaluation trees, implies --table-free", false, 0, "uint");
+		TCLAP::ValueArg<uint64_t> seedArg("", "seed", "Seed for drawing the bootstrap or jackknife replicates", false, 0, "uint");
+		TCLAP::MultiArg<std::string> edgesArg("", "edges", "Score only these edges, given as comma-separated edge indices (edges:12,57) or as the comma-separated taxa on one side of an edge (clade:A,B,C). Without a prefix, a list of digits is taken as edge indices. Can be repeated", false, "list");
+		TCLAP::SwitchArg qpicOnlyArg("", "qpic-only", "With --edges, compute only the QP-IC scores, which need only the node pair at each edge", false);
+		TCLAP::ValueArg<std::string> metricsArg("", "metrics", "Write the time per phase and the work counters as JSON to this path", false, "", "string");
+		TCLAP::ValueArg<double> progressArg("", "progress", "Seconds between progress reports while counting and scoring, 0 to disable them", false, 10, "seconds");
+		TCLAP::ValueArg<std::string> traceArg("", "trace", "Write the phases of each thread as a Chrome trace to this path", false, "", "string");
 		cmd.add(refArg);
 		cmd.add(evalArg);
-		cmd.add(outputArg);
+		std::vector<TCLAP::Arg*> outputArgs { &outputArg, &prepareArg, &serveArg };
+		cmd.xorAdd(outputArgs);
 		cmd.add(intMemArg);
+		cmd.add(spillArg);
 		cmd.add(threadsArg);
 		cmd.add(verboseArg);
 		cmd.add(savememArg);
+		cmd.add(packedArg);
+		cmd.add(backendArg);
+		cmd.add(hugePagesArg);
+		cmd.add(planArg);
+		cmd.add(tableFreeArg);
+		cmd.add(bootstrapArg);
+		cmd.add(jackknifeArg);
+		cmd.add(seedArg);
+		cmd.add(edgesArg);
+		cmd.add(qpicOnlyArg);
+		cmd.add(metricsArg);
+		cmd.add(traceArg);
+		cmd.add(progressArg);
 		cmd.parse(argc, argv);
 
 		pathToReferenceTree = refArg.getValue();
 		pathToEvaluationTrees = evalArg.getValue();
 		outputFilePath = outputArg.getValue();
+		preparePath = prepareArg.getValue();
+		servePath = serveArg.getValue();
 		nThreads = threadsArg.getValue();
 		internalMemory = intMemArg.getValue();
+		spillDirGiven = spillArg.isSet();
+		spillDir = spillDirGiven ? spillArg.getValue() : defaultSpillDirectory();
 		verbose = verboseArg.getValue();
-		savemem = savememArg.getValue();
+		if (backendArg.isSet()) {
+			backend = parseCountingBackend(backendArg.getValue());
+		} else if (packedArg.getValue()) {
+			// the packed table is reduced from the external sorter, so -p implies -s
+			backend = CountingBackend::PACKED;
+		} else if (savememArg.getValue()) {
+			backend = CountingBackend::SORTER;
+		}
+		hugePages = parseHugePageMode(hugePagesArg.getValue());
+		plan = planArg.getValue();
+		bootstrapReplicates = bootstrapArg.getValue();
+		jackknifeReplicates = jackknifeArg.getValue();
+		seed = seedArg.getValue();
+		edgeSpecs = edgesArg.getValue();
+		qpicOnly = qpicOnlyArg.getValue();
+		if (qpicOnly && edgeSpecs.empty()) {
+			throw std::runtime_error("--qpic-only needs --edges.");
+		}
+		if (bootstrapReplicates > 0 && jackknifeReplicates > 0) {
+			throw std::runtime_error("--bootstrap and --jackknife cannot be combined.");
+		}
+		// the replicates are counted from clade intersections, see CladeIntersectionScorer
+		tableFree = tableFreeArg.getValue() || bootstrapReplicates > 0 || jackknifeReplicates > 0;
+		// without any engine option, the planner chooses them
+		autoEngine = !savememArg.isSet() && !packedArg.isSet() && !backendArg.isSet() && !intMemArg.isSet();
+		metricsPath = metricsArg.getValue();
+		tracePath = traceArg.getValue();
+		progressInterval = progressArg.getValue();
 	} catch (TCLAP::ArgException &e) // catch any exceptions
 	{
 		std::cerr << "ERROR: " << e.error() << " for arg " << e.argId() << std::endl;
 		return 1;
+	} catch (std::runtime_error &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
 	}
 
-	std::ifstream infile(outputFilePath);
+	std::ifstream infile(preparePath.empty() ? outputFilePath : preparePath);
 	if (infile.good()) {
 		std::cout << "ERROR: The specified output file already exists.\n";
 		return 1;
 	}
+	if (!servePath.empty() && tableFree) {
+		std::cerr << "ERROR: --serve needs the quartet counts and cannot be combined with --table-free.\n";
+		return 1;
+	}
+	if (servePath == "-") {
+		// standard output carries the responses, so everything else goes to standard error
+		std::cout.rdbuf(std::cerr.rdbuf());
+		el::Loggers::reconfigureAllLoggers(el::ConfigurationType::ToStandardOutput, "false");
+	}
 
 	if (nThreads > 0) {
 		#ifdef GENESIS_OPENMP
@@ -99,10 +282,21 @@ int main(int argc, char* argv[]) {
 			          << "Thus, we can only use one thread." << std::endl;
 		#endif
 	}
+	Metrics::get_instance().reset(nThreads);
+	// the server does not return to write them, and its spans would pile up with every request
+	Metrics::get_instance().recordSpans((!metricsPath.empty() || !tracePath.empty()) && servePath.empty());
+	ProgressReporter::interval() = std::chrono::milliseconds(static_cast<long long>(std::max(progressInterval, 0.0) * 1000));
 
 	//read trees
 	DefaultTreeNewickReader reader;
 	Tree referenceTree = reader.from_file(pathToReferenceTree);
+	EdgeSelection selection;
+	try {
+		selection = EdgeSelection::parse(referenceTree, edgeSpecs, qpicOnly);
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
 
 	if (verbose) {
 		auto tp = PrinterCompact();
@@ -115,31 +309,95 @@ int main(int argc, char* argv[]) {
 		std::cout << res << std::endl;
 	}
 
+	if (!preparePath.empty()) {
+		size_t numTrees = prepareEvalTrees(referenceTree, pathToEvaluationTrees, preparePath, nThreads);
+		std::cout << "Prepared " << numTrees << " evaluation trees in " << preparePath << std::endl;
+		return 0;
+	}
+
 	std::vector<double> lqic;
 	std::vector<double> qpic;
 	std::vector<double> eqpic;
-	size_t m = countEvalTrees(pathToEvaluationTrees);
+	size_t m = countEvalTrees(pathToEvaluationTrees, nThreads);
 	m = 2*m;
-	if (m < (size_t(1) << 8)) {
-		QuartetScoreComputer<uint8_t> qsc(referenceTree, pathToEvaluationTrees, m, verbose, savemem, nThreads, internalMemory);
-		lqic = qsc.getLQICScores();
-		qpic = qsc.getQPICScores();
-		eqpic = qsc.getEQPICScores();
-	} else if (m < (size_t(1) << 16)) {
-		QuartetScoreComputer<uint16_t> qsc(referenceTree, pathToEvaluationTrees, m, verbose, savemem, nThreads, internalMemory);
-		lqic = qsc.getLQICScores();
-		qpic = qsc.getQPICScores();
-		eqpic = qsc.getEQPICScores();
-	} else if (m < (size_t(1) << 32)) {
-		QuartetScoreComputer<uint32_t> qsc(referenceTree, pathToEvaluationTrees, m, verbose, savemem, nThreads, internalMemory);
-		lqic = qsc.getLQICScores();
-		qpic = qsc.getQPICScores();
-		eqpic = qsc.getEQPICScores();
+
+	if (tableFree) {
+		Resampling resampling;
+		if (bootstrapReplicates > 0) {
+			resampling = Resampling::bootstrap(m / 2, bootstrapReplicates, seed);
+		} else if (jackknifeReplicates > 0) {
+			resampling = Resampling::jackknife(m / 2, jackknifeReplicates, seed);
+		}
+		CladeIntersectionScorer scorer(referenceTree, geneTreeFileOpener(pathToEvaluationTrees, nThreads), m / 2,
+				nThreads, std::cout, resampling, selection);
+		scorer.releaseScores(qpic, eqpic);
+		if (resampling.replicates > 0) {
+			std::string const replicatesPath = outputFilePath + ".replicates.tsv";
+			std::vector<std::string> names { "QP-IC" };
+			std::vector<std::vector<std::vector<double>>> replicateScores { scorer.getReplicateQPICScores() };
+			if (!scorer.getReplicateEQPICScores().empty()) {
+				names.push_back("EQP-IC");
+				replicateScores.push_back(scorer.getReplicateEQPICScores());
+			}
+			writeReplicateScores(replicatesPath, names, replicateScores);
+			std::cout << "Wrote the scores of " << resampling.replicates << " replicates to " << replicatesPath << "\n";
+		}
 	} else {
-		QuartetScoreComputer<uint64_t> qsc(referenceTree, pathToEvaluationTrees, m, verbose, savemem, nThreads, internalMemory);
-		lqic = qsc.getLQICScores();
-		qpic = qsc.getQPICScores();
-		eqpic = qsc.getEQPICScores();
+		size_t numTaxa = 0;
+		for (size_t i = 0; i < referenceTree.node_count(); ++i) {
+			numTaxa += referenceTree.node_at(i).is_leaf();
+		}
+		size_t const countBytes = m < (size_t(1) << 8) ? 1 : m < (size_t(1) << 16) ? 2 : m < (size_t(1) << 32) ? 4 : 8;
+		int planThreads = nThreads;
+		#ifdef GENESIS_OPENMP
+			if (planThreads == 0) {
+				planThreads = omp_get_max_threads();
+			}
+		#endif
+		MemoryPlanner planner(numTaxa, m / 2, countBytes, planThreads, readMemoryLimit());
+		if (plan) {
+			planner.print(std::cout);
+			return 0;
+		}
+		if (autoEngine) {
+			EnginePlan const &chosen = planner.best();
+			if (!chosen.fits) {
+				planner.print(std::cerr);
+				std::cerr << "ERROR: No counting engine fits into the memory limit.\n";
+				return 1;
+			}
+			backend = parseCountingBackend(chosen.engine);
+			if (chosen.internalMemory > 0) {
+				internalMemory = chosen.internalMemory;
+				std::cout << "Planned counting engine: " << chosen.engine << " with -i " << internalMemory << "\n";
+			} else {
+				std::cout << "Planned counting engine: " << chosen.engine << "\n";
+			}
+		}
+		if (backend == CountingBackend::SORTER || backend == CountingBackend::PACKED) {
+			try {
+				configureSpillDisks(spillDir, spillDirGiven, std::cout);
+			} catch (std::runtime_error &e) {
+				std::cerr << "ERROR: " << e.what() << std::endl;
+				return 1;
+			}
+		}
+		if (m < (size_t(1) << 8)) {
+			computeScores<uint8_t>(backend, referenceTree, pathToEvaluationTrees, m, verbose, hugePages, nThreads,
+					internalMemory, servePath, selection, lqic, qpic, eqpic);
+		} else if (m < (size_t(1) << 16)) {
+			computeScores<uint16_t>(backend, referenceTree, pathToEvaluationTrees, m, verbose, hugePages, nThreads,
+					internalMemory, servePath, selection, lqic, qpic, eqpic);
+		} else if (m < (size_t(1) << 32)) {
+			computeScores<uint32_t>(backend, referenceTree, pathToEvaluationTrees, m, verbose, hugePages, nThreads,
+					internalMemory, servePath, selection, lqic, qpic, eqpic);
+		} else {
+			computeScores<uint64_t>(backend, referenceTree, pathToEvaluationTrees, m, verbose, hugePages, nThreads,
+					internalMemory, servePath, selection, lqic, qpic, eqpic);
+		}
+		if (!servePath.empty()) {
+			return 0;
+		}
 	}
 
          std::ofstream output;
@@ -161,7 +419,9 @@ int main(int argc, char* argv[]) {
 
 	// Create the writer and assign values.
 	auto writer = QuartetTreeNewickWriter();
-	writer.set_lq_ic_scores(lqic);
+	if (!lqic.empty()) { // computed with the quartet table
+		writer.set_lq_ic_scores(lqic);
+	}
 	if (!eqpic.empty()) { // bifurcating tree
 		writer.set_eqp_ic_scores(eqpic);
 	}
@@ -172,7 +432,19 @@ int main(int argc, char* argv[]) {
 	writer.to_file(referenceTree, outputFilePath);
 	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
-	LOG(INFO) << "[total_time] [" << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()<< " ms]";
+	LOG(INFO) << "[total_time] [" << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()<< " us]";
+
+	try {
+		if (!metricsPath.empty()) {
+			Metrics::get_instance().writeSummary(metricsPath);
+		}
+		if (!tracePath.empty()) {
+			Metrics::get_instance().writeTrace(tracePath);
+		}
+	} catch (std::runtime_error &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
 
 	return 0;
 }
@@ -0,0 +1,888 @@
+#include "genesis/genesis.hpp"
+#include "CladeIntersectionScorer.hpp"
+#include "GeneTreeInput.hpp"
+#include "IncrementalScorer.hpp"
+#include "QuartetScoreComputer.hpp"
+#include "QuartetScoresLibrary.hpp"
+#include "SpillDirectory.hpp"
+#include "SyntheticTrees.hpp"
+#include "tclap/CmdLine.h" // command line parser, downloaded from http://tclap.sourceforge.net/
+#include "easylogging++.h"
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#	include <omp.h>
+#endif
+
+using namespace genesis;
+using namespace tree;
+
+INITIALIZE_EASYLOGGINGPP
+
+/**
+ * Microbenchmarks for the counting and scoring kernels, run on synthetic trees.
+ * Before a kernel is timed, its results are checked against a brute-force computation on the same trees,
+ * so that a faster variant of a kernel cannot silently change the scores.
+ */
+class QuartetScoresBench {
+public:
+	/**
+	 * @param numTaxa number of taxa of the synthetic trees, at most 64 for the brute-force checks
+	 * @param numTrees number of evaluation trees
+	 * @param swaps number of leaf swaps applied to the reference tree to obtain each evaluation tree
+	 * @param collapse probability of contracting an inner edge of an evaluation tree
+	 * @param seed seed of the tree generator
+	 * @param repetitions number of timed runs per kernel, of which the fastest is reported
+	 * @param numThreads number of threads for counting
+	 * @param internalMemory log2 of the internal memory of the external sorter
+	 * @param evalTreesPath where to store the evaluation trees while benchmarking
+	 */
+	QuartetScoresBench(size_t numTaxa, size_t numTrees, size_t swaps, double collapse, uint64_t seed,
+			size_t repetitions, int numThreads, int internalMemory, std::string const &evalTreesPath) :
+			numTaxa(numTaxa), repetitions(repetitions), numThreads(numThreads), internalMemory(internalMemory),
+			evalTreesPath(evalTreesPath), bifurcating(collapse == 0), failures(0) {
+		SyntheticTreeGenerator generator(numTaxa, seed);
+		SyntheticTree reference = generator.randomTree();
+		referenceTree = DefaultTreeNewickReader().from_string(reference.toNewick());
+
+		std::ofstream output(evalTreesPath);
+		for (size_t i = 0; i < numTrees; ++i) {
+			SyntheticTree gene = generator.perturb(reference, swaps);
+			generator.collapse(gene, collapse);
+			geneClades.push_back(gene.cladeMasks());
+			output << gene.toNewick() << "\n";
+		}
+
+		taxonToNode.resize(numTaxa);
+		for (auto it : eulertour(referenceTree)) {
+			if (it.node().is_leaf()) {
+				std::string const &name = it.node().data<DefaultNodeData>().name;
+				size_t const lookupID = taxonToLookupID.size();
+				taxonToLookupID[name] = lookupID;
+				taxonToNode[std::stoul(name.substr(1))] = it.node().index();
+			}
+		}
+		nodeToTaxon.resize(referenceTree.node_count(), numTaxa);
+		for (size_t taxon = 0; taxon < numTaxa; ++taxon) {
+			nodeToTaxon[taxonToNode[taxon]] = taxon;
+		}
+	}
+
+	~QuartetScoresBench() {
+		std::remove(evalTreesPath.c_str());
+	}
+
+	/**
+	 * Check and time all kernels. Returns false if a check failed.
+	 */
+	bool run() {
+		std::cout << std::left << std::setw(32) << "kernel" << std::setw(14) << "operations" << "ns/op\n";
+		benchLookupIndex();
+		benchLowestCommonAncestor();
+
+		benchBackend<DenseBackend>(true);
+		benchBackend<SorterBackend>(true);
+		// the unpacked table is released after counting, so no further quartets can be added
+		benchBackend<PackedBackend>(false);
+		benchBackend<SparseBackend>(true);
+		benchBackend<TiledBackend>(true);
+		if (bifurcating) {
+			// needs bifurcating evaluation trees, and quartets added without their trees would break the derived counts
+			benchBackend<ResolvedBackend>(false);
+		}
+
+		size_t const m = 2 * geneClades.size();
+		{
+			QuartetScoreComputer<uint32_t> computer(referenceTree, evalTreesPath, m, false, HugePageMode::TRANSPARENT,
+					numThreads, internalMemory);
+			checkScores(computer);
+			checkLibrary(computer);
+			benchLogScore(computer);
+			benchQicKernel(computer.quartetCounterLookup->qicKernel());
+			benchProcessNodePair(computer);
+		}
+		benchCladeIntersectionScorer();
+		benchIncrementalScorer();
+
+		if (failures > 0) {
+			std::cout << failures << " checks FAILED.\n";
+		} else {
+			std::cout << "All checks passed.\n";
+		}
+		return failures == 0;
+	}
+
+private:
+	// -------------------------------------------------------------------------
+	//     Timing and Checking
+	// -------------------------------------------------------------------------
+
+	template<typename Function>
+	static double measure(Function function) {
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		function();
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+	}
+
+	/**
+	 * Run the function repetitions times and report the fastest run.
+	 */
+	template<typename Function>
+	void time(std::string const &kernel, size_t operations, Function function) {
+		double best = std::numeric_limits<double>::infinity();
+		for (size_t rep = 0; rep < repetitions; ++rep) {
+			best = std::min(best, measure(function));
+		}
+		report(kernel, operations, best);
+	}
+
+	static void report(std::string const &kernel, size_t operations, double nanoseconds) {
+		std::cout << std::left << std::setw(32) << kernel << std::setw(14) << operations << std::fixed
+				<< std::setprecision(2) << nanoseconds / std::max<size_t>(operations, 1) << "\n";
+	}
+
+	void check(bool ok, std::string const &what) {
+		if (!ok) {
+			std::cout << "CHECK FAILED: " << what << "\n";
+			++failures;
+		}
+	}
+
+	// -------------------------------------------------------------------------
+	//     Brute-Force Reference
+	// -------------------------------------------------------------------------
+
+	/**
+	 * Count the topologies ab|cd, ac|bd and ad|bc of the quartet of taxa {a,b,c,d} in the evaluation trees,
+	 * by searching every tree for a clade that contains exactly two of the taxa.
+	 * Each resolved quartet is counted twice, as in the lookup table.
+	 */
+	std::array<size_t, 3> bruteForceCounts(size_t a, size_t b, size_t c, size_t d) const {
+		uint64_t const ma = uint64_t(1) << a, mb = uint64_t(1) << b, mc = uint64_t(1) << c, md = uint64_t(1) << d;
+		uint64_t const all = ma | mb | mc | md;
+		std::array<uint64_t, 3> const pairs = { { ma | mb, ma | mc, ma | md } };
+		std::array<size_t, 3> counts = { { 0, 0, 0 } };
+		for (std::vector<uint64_t> const &clades : geneClades) {
+			for (uint64_t clade : clades) {
+				uint64_t const in = clade & all;
+				size_t topology = 0;
+				while (topology < 3 && in != pairs[topology] && in != (all ^ pairs[topology])) {
+					++topology;
+				}
+				if (topology < 3) {
+					counts[topology] += 2;
+					break;
+				}
+			}
+		}
+		return counts;
+	}
+
+	static double bruteForceLogScore(size_t q1, size_t q2, size_t q3) {
+		size_t const sum = q1 + q2 + q3;
+		if (sum == 0) {
+			return 0;
+		}
+		double qic = 1;
+		for (size_t q : { q1, q2, q3 }) {
+			if (q > 0) {
+				double const p = double(q) / sum;
+				qic += p * std::log(p) / std::log(3.0);
+			}
+		}
+		return (q1 < q2 || q1 < q3) ? -qic : qic;
+	}
+
+	/**
+	 * Lowest common ancestor of u and v with the tree rooted at root, by walking up from both nodes.
+	 */
+	size_t bruteForceLowestCommonAncestor(size_t u, size_t v, size_t root) const {
+		std::vector<size_t> parent(referenceTree.node_count(), root);
+		std::vector<size_t> depth(referenceTree.node_count(), 0);
+		std::vector<size_t> queue(1, root);
+		std::vector<bool> seen(referenceTree.node_count(), false);
+		seen[root] = true;
+		for (size_t i = 0; i < queue.size(); ++i) {
+			for (size_t neighbor : neighbors[queue[i]]) {
+				if (!seen[neighbor]) {
+					seen[neighbor] = true;
+					parent[neighbor] = queue[i];
+					depth[neighbor] = depth[queue[i]] + 1;
+					queue.push_back(neighbor);
+				}
+			}
+		}
+		while (depth[u] > depth[v]) {
+			u = parent[u];
+		}
+		while (depth[v] > depth[u]) {
+			v = parent[v];
+		}
+		while (u != v) {
+			u = parent[u];
+			v = parent[v];
+		}
+		return u;
+	}
+
+	/**
+	 * For each edge, mark the nodes on its secondary side (away from the root) and the taxa among them.
+	 */
+	void collectEdgeSides() {
+		neighbors.assign(referenceTree.node_count(), std::vector<size_t>());
+		nodesBelow.assign(referenceTree.edge_count(), std::vector<bool>(referenceTree.node_count(), false));
+		taxaBelow.assign(referenceTree.edge_count(), 0);
+		for (size_t e = 0; e < referenceTree.edge_count(); ++e) {
+			TreeEdge const &edge = referenceTree.edge_at(e);
+			neighbors[edge.primary_node().index()].push_back(edge.secondary_node().index());
+			neighbors[edge.secondary_node().index()].push_back(edge.primary_node().index());
+			collectBelow(edge.secondary_link(), nodesBelow[e], taxaBelow[e]);
+		}
+	}
+
+	void collectBelow(TreeLink const &link, std::vector<bool> &nodes, uint64_t &taxa) const {
+		nodes[link.node().index()] = true;
+		if (link.node().is_leaf()) {
+			taxa |= uint64_t(1) << nodeToTaxon[link.node().index()];
+		}
+		for (TreeLink const* next = &link.next(); next != &link; next = &next->next()) {
+			collectBelow(next->outer(), nodes, taxa);
+		}
+	}
+
+	/**
+	 * Return the taxa reachable through the given link, seen from its node.
+	 */
+	uint64_t taxaBehindLink(TreeLink const &link) const {
+		size_t const e = link.edge().index();
+		uint64_t const allTaxa = numTaxa == 64 ? ~uint64_t(0) : (uint64_t(1) << numTaxa) - 1;
+		return &link.edge().primary_link() == &link ? taxaBelow[e] : allTaxa & ~taxaBelow[e];
+	}
+
+	bool nodeBehindLink(TreeLink const &link, size_t node) const {
+		size_t const e = link.edge().index();
+		return (&link.edge().primary_link() == &link) == nodesBelow[e][node];
+	}
+
+	static std::vector<size_t> taxaOf(uint64_t mask) {
+		std::vector<size_t> taxa;
+		for (size_t taxon = 0; mask != 0; ++taxon, mask >>= 1) {
+			if (mask & 1) {
+				taxa.push_back(taxon);
+			}
+		}
+		return taxa;
+	}
+
+	/**
+	 * Compute the LQ-IC, QP-IC and EQP-IC scores by enumerating the four subtrees around every pair of inner nodes.
+	 */
+	void bruteForceScores(std::vector<double> &lqic, std::vector<double> &qpic, std::vector<double> &eqpic) const {
+		double const inf = std::numeric_limits<double>::infinity();
+		lqic.assign(referenceTree.edge_count(), inf);
+		qpic.assign(referenceTree.edge_count(), inf);
+		eqpic.assign(referenceTree.edge_count(), inf);
+		for (size_t u = 0; u < referenceTree.node_count(); ++u) {
+			for (size_t v = u + 1; v < referenceTree.node_count(); ++v) {
+				if (!referenceTree.node_at(u).is_inner() || !referenceTree.node_at(v).is_inner()) {
+					continue;
+				}
+				std::vector<std::vector<size_t>> subtrees;
+				for (size_t end : { u, v }) {
+					size_t const other = (end == u) ? v : u;
+					TreeLink const &first = referenceTree.node_at(end).link();
+					TreeLink const* link = &first;
+					do {
+						if (!nodeBehindLink(*link, other)) {
+							subtrees.push_back(taxaOf(taxaBehindLink(*link)));
+						}
+						link = &link->next();
+					} while (link != &first);
+				}
+				std::vector<size_t> path;
+				for (size_t e = 0; e < referenceTree.edge_count(); ++e) {
+					if (nodesBelow[e][u] != nodesBelow[e][v]) {
+						path.push_back(e);
+					}
+				}
+
+				// the reference topology of these quartets is ab|cd
+				std::array<size_t, 3> sum = { { 0, 0, 0 } };
+				for (size_t a : subtrees[0]) {
+					for (size_t b : subtrees[1]) {
+						for (size_t c : subtrees[2]) {
+							for (size_t d : subtrees[3]) {
+								std::array<size_t, 3> const counts = bruteForceCounts(a, b, c, d);
+								double const qic = bruteForceLogScore(counts[0], counts[1], counts[2]);
+								for (size_t i = 0; i < 3; ++i) {
+									sum[i] += counts[i];
+								}
+								for (size_t e : path) {
+									lqic[e] = std::min(lqic[e], qic);
+								}
+							}
+						}
+					}
+				}
+				double const score = bruteForceLogScore(sum[0], sum[1], sum[2]);
+				if (path.size() == 1) {
+					qpic[path[0]] = score;
+				}
+				for (size_t e : path) {
+					eqpic[e] = std::min(eqpic[e], score);
+				}
+			}
+		}
+	}
+
+	static bool sameScores(std::vector<double> const &expected, std::vector<double> const &actual) {
+		if (expected.size() != actual.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < expected.size(); ++i) {
+			if (expected[i] != actual[i] && std::abs(expected[i] - actual[i]) > 1e-9) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// -------------------------------------------------------------------------
+	//     Checks
+	// -------------------------------------------------------------------------
+
+	template<template<typename > class Backend>
+	void checkCounts(QuartetCounterLookup<uint32_t, Backend> const &counter, std::string const &variant) {
+		bool ok = true;
+		for (size_t a = 0; a < numTaxa && ok; ++a) {
+			for (size_t b = a + 1; b < numTaxa && ok; ++b) {
+				for (size_t c = b + 1; c < numTaxa && ok; ++c) {
+					for (size_t d = c + 1; d < numTaxa && ok; ++d) {
+						std::array<size_t, 3> const expected = bruteForceCounts(a, b, c, d);
+						std::tuple<uint32_t, uint32_t, uint32_t> const actual = counter.countQuartetOccurrences(
+								taxonToNode[a], taxonToNode[b], taxonToNode[c], taxonToNode[d]);
+						ok = expected[0] == std::get<0>(actual) && expected[1] == std::get<1>(actual)
+								&& expected[2] == std::get<2>(actual);
+					}
+				}
+			}
+		}
+		check(ok, variant + " quartet counts");
+
+		// the scoring loops look up runs of quartets that differ in one taxon, with the running taxon at any position
+		std::vector<size_t> taxa;
+		std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> run(numTaxa);
+		ok = true;
+		for (size_t a = 0; a < numTaxa && ok; ++a) {
+			for (size_t b = a + 1; b < numTaxa && ok; ++b) {
+				for (size_t c = b + 1; c < numTaxa && ok; ++c) {
+					taxa.clear();
+					for (size_t d = 0; d < numTaxa; ++d) {
+						if (d != a && d != b && d != c) {
+							taxa.push_back(d);
+						}
+					}
+					size_t const position = (a + b + c) % 4;
+					std::array<size_t, 4> quartet;
+					for (size_t i = 0, j = 0; i < 4; ++i) {
+						quartet[i] = i == position ? 0 : std::array<size_t, 3> { { a, b, c } }[j++];
+					}
+					counter.countLookupQuartetRun(quartet, position, taxa.data(), taxa.size(), run.data());
+					for (size_t i = 0; i < taxa.size() && ok; ++i) {
+						quartet[position] = taxa[i];
+						ok = run[i] == counter.countLookupQuartetOccurrences(quartet[0], quartet[1], quartet[2],
+								quartet[3]);
+					}
+				}
+			}
+		}
+		check(ok, variant + " quartet count runs");
+	}
+
+	void checkScores(QuartetScoreComputer<uint32_t> &computer) {
+		collectEdgeSides();
+		std::vector<double> lqic, qpic, eqpic;
+		bruteForceScores(lqic, qpic, eqpic);
+		check(sameScores(lqic, computer.getLQICScores()), "LQ-IC scores");
+		check(sameScores(qpic, computer.getQPICScores()), "QP-IC scores");
+		check(sameScores(eqpic, computer.getEQPICScores()), "EQP-IC scores");
+	}
+
+	/**
+	 * Check that genesis trees are flattened like their Newick text is parsed, and that the library computes the
+	 * same scores as the command line program for the evaluation trees as a file, as Newick strings, and as trees.
+	 */
+	void checkLibrary(QuartetScoreComputer<uint32_t> const &computer) {
+		std::vector<std::string> newick;
+		std::ifstream input(evalTreesPath);
+		for (std::string line; std::getline(input, line);) {
+			if (!line.empty()) {
+				newick.push_back(line);
+			}
+		}
+		std::vector<Tree> trees;
+		for (std::string const &text : newick) {
+			trees.push_back(DefaultTreeNewickReader().from_string(text));
+		}
+
+		std::vector<FlatGeneTree> parsed;
+		openGeneTreeSource(evalTreesPath, taxonToLookupID, numThreads)->nextBatch(parsed, trees.size());
+		GeneTreeFlattener flattener(taxonToLookupID);
+		FlatGeneTree flat;
+		bool ok = parsed.size() == trees.size();
+		for (size_t i = 0; ok && i < trees.size(); ++i) {
+			flattener.flatten(trees[i], flat);
+			ok = flat.leaves == parsed[i].leaves && flat.cladeOffsets == parsed[i].cladeOffsets
+					&& flat.cladeBounds == parsed[i].cladeBounds;
+		}
+		check(ok, "flattened genesis trees");
+
+		quartet_scores::Options options;
+		options.engine = "dense";
+		options.numThreads = numThreads;
+		auto sameAsComputer = [&](quartet_scores::Scores const &scores) {
+			return sameScores(computer.getLQICScores(), scores.lqic) && sameScores(computer.getQPICScores(), scores.qpic)
+					&& sameScores(computer.getEQPICScores(), scores.eqpic);
+		};
+		check(sameAsComputer(quartet_scores::computeScores(referenceTree, evalTreesPath, options)),
+				"library scores of a file");
+		check(sameAsComputer(quartet_scores::computeScoresForNewick(referenceTree, newick.begin(), newick.end(), options)),
+				"library scores of Newick strings");
+		check(sameAsComputer(quartet_scores::computeScoresForTrees(referenceTree, trees.begin(), trees.end(), options)),
+				"library scores of genesis trees");
+	}
+
+	// -------------------------------------------------------------------------
+	//     Benchmarks
+	// -------------------------------------------------------------------------
+
+	void benchLookupIndex() {
+		QuartetLookupTable<uint32_t> table;
+		table.init(numTaxa, HugePageMode::NONE, numThreads);
+
+		// brute force: rank of the sorted quartet in the enumeration of all quartets, and position of the pairing
+		bool ok = true;
+		size_t rank = 0;
+		for (size_t a = 0; a < numTaxa; ++a) {
+			for (size_t b = 0; b < a; ++b) {
+				for (size_t c = 0; c < b; ++c) {
+					for (size_t d = 0; d < c; ++d, ++rank) {
+						ok = ok && table.get_tuple_id(b, d, a, c) == rank;
+						ok = ok && table.tuple_index(d, c, b, a) == 0 && table.tuple_index(d, b, a, c) == 1
+								&& table.tuple_index(c, b, d, a) == 2;
+					}
+				}
+			}
+		}
+		check(ok, "QuartetLookupTable::lookup_index_ and tuple_index");
+
+		std::mt19937_64 random(1);
+		std::uniform_int_distribution<size_t> taxonDist(0, numTaxa - 1);
+		std::vector<std::array<size_t, 4>> quartets;
+		while (quartets.size() < (size_t(1) << 20)) {
+			std::array<size_t, 4> q = { { taxonDist(random), taxonDist(random), taxonDist(random), taxonDist(random) } };
+			if (q[0] != q[1] && q[0] != q[2] && q[0] != q[3] && q[1] != q[2] && q[1] != q[3] && q[2] != q[3]) {
+				quartets.push_back(q);
+			}
+		}
+		volatile size_t sink = 0;
+		time("lookup_index_", quartets.size(), [&] {
+			size_t sum = 0;
+			for (auto const &q : quartets) {
+				sum += table.get_tuple_id(q[0], q[1], q[2], q[3]);
+			}
+			sink = sink + sum;
+		});
+		time("tuple_index", quartets.size(), [&] {
+			size_t sum = 0;
+			for (auto const &q : quartets) {
+				sum += table.tuple_index(q[0], q[1], q[2], q[3]);
+			}
+			sink = sink + sum;
+		});
+	}
+
+	void benchLowestCommonAncestor() {
+		TreeInformation information;
+		information.init(referenceTree);
+		collectEdgeSides();
+
+		std::mt19937_64 random(2);
+		std::uniform_int_distribution<size_t> nodeDist(0, referenceTree.node_count() - 1);
+		std::vector<std::array<size_t, 3>> queries(size_t(1) << 18);
+		for (auto &query : queries) {
+			query = { { nodeDist(random), nodeDist(random), nodeDist(random) } };
+		}
+		bool ok = true;
+		for (size_t i = 0; i < std::min<size_t>(queries.size(), 2000); ++i) {
+			ok = ok && information.lowestCommonAncestorIdx(queries[i][0], queries[i][1], queries[i][2])
+							== bruteForceLowestCommonAncestor(queries[i][0], queries[i][1], queries[i][2]);
+		}
+		check(ok, "TreeInformation::lowestCommonAncestorIdx");
+
+		volatile size_t sink = 0;
+		time("lowestCommonAncestorIdx", queries.size(), [&] {
+			size_t sum = 0;
+			for (auto const &query : queries) {
+				sum += information.lowestCommonAncestorIdx(query[0], query[1], query[2]);
+			}
+			sink = sink + sum;
+		});
+
+		// paths between the first two nodes of the queries, with their lowest common ancestor
+		size_t const rootIdx = referenceTree.root_node().index();
+		for (auto &query : queries) {
+			query[2] = information.lowestCommonAncestorIdx(query[0], query[1], rootIdx);
+		}
+		bool pathsOk = true;
+		for (size_t i = 0; i < std::min<size_t>(queries.size(), 2000); ++i) {
+			size_t edges = 0;
+			information.forEachPathEdge(queries[i][0], queries[i][1], queries[i][2], [&](size_t) {
+				++edges;
+			});
+			pathsOk = pathsOk && edges == information.distanceInEdges(queries[i][0], queries[i][1]);
+		}
+		check(pathsOk, "TreeInformation::forEachPathEdge");
+		time("path_set", queries.size(), [&] {
+			size_t sum = 0;
+			for (auto const &query : queries) {
+				for (auto it : path_set(referenceTree.node_at(query[0]), referenceTree.node_at(query[1]),
+						referenceTree.node_at(query[2]))) {
+					if (!it.is_lca()) {
+						sum += it.edge().index();
+					}
+				}
+			}
+			sink = sink + sum;
+		});
+		time("forEachPathEdge", queries.size(), [&] {
+			size_t sum = 0;
+			for (auto const &query : queries) {
+				information.forEachPathEdge(query[0], query[1], query[2], [&](size_t edgeIdx) {
+					sum += edgeIdx;
+				});
+			}
+			sink = sink + sum;
+		});
+	}
+
+	void benchLogScore(QuartetScoreComputer<uint32_t> &computer) {
+		std::mt19937_64 random(3);
+		std::uniform_int_distribution<size_t> countDist(0, 2 * geneClades.size());
+		std::vector<std::array<size_t, 3>> counts(size_t(1) << 20);
+		for (auto &count : counts) {
+			count = { { countDist(random), countDist(random), countDist(random) } };
+		}
+		bool ok = true;
+		for (auto const &count : counts) {
+			double const expected = bruteForceLogScore(count[0], count[1], count[2]);
+			ok = ok && std::abs(computer.log_score(count[0], count[1], count[2]) - expected) <= 1e-9;
+		}
+		check(ok, "log_score");
+
+		volatile double sink = 0;
+		time("log_score", counts.size(), [&] {
+			double sum = 0;
+			for (auto const &count : counts) {
+				sum += computer.log_score(count[0], count[1], count[2]);
+			}
+			sink = sink + sum;
+		});
+	}
+
+	/**
+	 * Check the tabulated QIC scores against the brute force, for counts whose sum is at most m, and time them.
+	 */
+	void benchQicKernel(QicKernel const &kernel) {
+		size_t const m = 2 * geneClades.size();
+		std::mt19937_64 random(4);
+		std::vector<uint64_t> q1(size_t(1) << 20);
+		std::vector<uint64_t> q2(q1.size());
+		std::vector<uint64_t> q3(q1.size());
+		for (size_t i = 0; i < q1.size(); ++i) {
+			q1[i] = std::uniform_int_distribution<uint64_t>(0, m)(random);
+			q2[i] = std::uniform_int_distribution<uint64_t>(0, m - q1[i])(random);
+			q3[i] = std::uniform_int_distribution<uint64_t>(0, m - q1[i] - q2[i])(random);
+		}
+		bool ok = true;
+		for (size_t first = 0; first < q1.size(); first += QicKernel::BLOCK) {
+			double lowest = std::numeric_limits<double>::infinity();
+			for (size_t i = first; i < first + QicKernel::BLOCK; ++i) {
+				double const expected = bruteForceLogScore(q1[i], q2[i], q3[i]);
+				ok = ok && std::abs(kernel.score(q1[i], q2[i], q3[i]) - expected) <= 1e-9;
+				lowest = std::min(lowest, expected);
+			}
+			ok = ok && std::abs(kernel.minScore(&q1[first], &q2[first], &q3[first], QicKernel::BLOCK) - lowest) <= 1e-9;
+		}
+		check(ok, "QicKernel");
+
+		volatile double sink = 0;
+		time("QicKernel::minScore", q1.size(), [&] {
+			double sum = 0;
+			for (size_t first = 0; first < q1.size(); first += QicKernel::BLOCK) {
+				sum += kernel.minScore(&q1[first], &q2[first], &q3[first], QicKernel::BLOCK);
+			}
+			sink = sink + sum;
+		});
+	}
+
+	/**
+	 * Count the quartets of the evaluation trees with a counting backend, check the counts and time the backend.
+	 * @param updates also time adding the quartets of all evaluation trees once more
+	 */
+	template<template<typename > class Backend>
+	void benchBackend(bool updates) {
+		QuartetCounterLookup<uint32_t, Backend> counter(referenceTree, evalTreesPath, 2 * geneClades.size(),
+				HugePageMode::TRANSPARENT, numThreads, internalMemory);
+		std::string const name = Backend<uint32_t>::name();
+		checkCounts(counter, "QuartetCounterLookup (" + name + ")");
+		benchCountQuartetOccurrences(counter, name);
+		if (updates) {
+			// adds further quartets to the counts, so this comes after the check
+			benchUpdateQuartets(counter, name);
+		}
+	}
+
+	template<template<typename > class Backend>
+	void benchCountQuartetOccurrences(QuartetCounterLookup<uint32_t, Backend> const &counter, std::string const &name) {
+		size_t const numQuartets = numTaxa * (numTaxa - 1) * (numTaxa - 2) * (numTaxa - 3) / 24;
+		volatile size_t sink = 0;
+		time("countQuartetOccurrences/" + name, numQuartets, [&] {
+			size_t sum = 0;
+			for (size_t a = 0; a < numTaxa; ++a) {
+				for (size_t b = a + 1; b < numTaxa; ++b) {
+					for (size_t c = b + 1; c < numTaxa; ++c) {
+						for (size_t d = c + 1; d < numTaxa; ++d) {
+							sum += std::get<0>(counter.countQuartetOccurrences(taxonToNode[a], taxonToNode[b],
+									taxonToNode[c], taxonToNode[d]));
+						}
+					}
+				}
+			}
+			sink = sink + sum;
+		});
+	}
+
+	/**
+	 * Time adding the quartets of all evaluation trees (single-threaded) and flushing them into the counts.
+	 */
+	template<template<typename > class Backend>
+	void benchUpdateQuartets(QuartetCounterLookup<uint32_t, Backend> &counter, std::string const &name) {
+		std::vector<FlatGeneTree> trees;
+		std::unique_ptr<GeneTreeSource> source = openGeneTreeSource(evalTreesPath, taxonToLookupID, numThreads);
+		source->nextBatch(trees, geneClades.size());
+
+		std::vector<FlatGeneTree::Clade> clades;
+		double bestUpdate = std::numeric_limits<double>::infinity();
+		double bestReduce = std::numeric_limits<double>::infinity();
+		for (size_t rep = 0; rep < repetitions; ++rep) {
+			bestUpdate = std::min(bestUpdate, measure([&] {
+				for (FlatGeneTree const &tree : trees) {
+					for (size_t node = 0; node < tree.innerNodeCount(); ++node) {
+						counter.updateQuartets(tree, node, clades, 0);
+					}
+				}
+			}));
+			bestReduce = std::min(bestReduce, measure([&] {
+				counter.backend->flush();
+			}));
+		}
+		report("updateQuartets/" + name + "/tree", trees.size(), bestUpdate);
+		report("flush/" + name + "/tree", trees.size(), bestReduce);
+	}
+
+	void benchProcessNodePair(QuartetScoreComputer<uint32_t> &computer) {
+		std::vector<std::pair<size_t, size_t>> pairs;
+		for (size_t u = 0; u < referenceTree.node_count(); ++u) {
+			for (size_t v = u + 1; v < referenceTree.node_count(); ++v) {
+				if (referenceTree.node_at(u).is_inner() && referenceTree.node_at(v).is_inner()) {
+					pairs.emplace_back(u, v);
+				}
+			}
+		}
+		// processing a pair again does not change the scores
+		time("processNodePair", pairs.size(), [&] {
+			for (auto const &pair : pairs) {
+				computer.processNodePair(pair.first, pair.second);
+			}
+		});
+		// the same pairs, cut into blocks of about equal work and scored by all threads
+		time("scoreNodePairs", pairs.size(), [&] {
+			computer.applyNodePairScores(pairs, computer.scoreNodePairs(pairs));
+		});
+		checkScores(computer);
+	}
+
+	void benchCladeIntersectionScorer() {
+		collectEdgeSides();
+		std::vector<double> lqic, qpic, eqpic;
+		bruteForceScores(lqic, qpic, eqpic);
+		std::unique_ptr<CladeIntersectionScorer> scorer;
+		time("CladeIntersectionScorer/tree", geneClades.size(), [&] {
+			scorer.reset(new CladeIntersectionScorer(referenceTree, evalTreesPath, geneClades.size(), numThreads));
+		});
+		check(sameScores(qpic, scorer->getQPICScores()), "table-free QP-IC scores");
+		check(sameScores(eqpic, scorer->getEQPICScores()), "table-free EQP-IC scores");
+	}
+
+	/**
+	 * Check that the scores after some NNIs are those of the changed tree scored from scratch, and that applying the
+	 * NNIs again in reverse order restores the scores, then time an NNI and its undo.
+	 */
+	void benchIncrementalScorer() {
+		if (!is_bifurcating(referenceTree)) {
+			return;
+		}
+		std::shared_ptr<QuartetCounterLookup<uint32_t, DenseBackend> const> counter = std::make_shared<
+				QuartetCounterLookup<uint32_t, DenseBackend> >(referenceTree, evalTreesPath, 2 * geneClades.size(),
+				HugePageMode::TRANSPARENT, numThreads, internalMemory);
+		IncrementalScorer<uint32_t, DenseBackend> scorer(referenceTree, counter, numThreads);
+		std::vector<double> const lqic = scorer.getLQICScores();
+		std::vector<double> const qpic = scorer.getQPICScores();
+		std::vector<double> const eqpic = scorer.getEQPICScores();
+
+		std::vector<size_t> innerEdges;
+		for (size_t i = 0; i < referenceTree.edge_count(); ++i) {
+			TreeEdge const &edge = referenceTree.edge_at(i);
+			if (edge.primary_node().is_inner() && edge.secondary_node().is_inner()) {
+				innerEdges.push_back(i);
+			}
+		}
+		if (innerEdges.empty()) {
+			return;
+		}
+		std::vector<std::pair<size_t, size_t>> moves;
+		for (size_t k = 0; k < 4; ++k) {
+			moves.emplace_back(innerEdges[k * innerEdges.size() / 4], k % 2);
+		}
+
+		std::ostream discard(nullptr);
+		for (auto const &move : moves) {
+			scorer.applyNNI(move.first, move.second);
+		}
+		QuartetScoreComputer<uint32_t, DenseBackend> fresh(scorer.tree(), counter, numThreads, discard);
+		check(sameScores(fresh.getLQICScores(), scorer.getLQICScores()), "incremental LQ-IC scores after NNIs");
+		check(sameScores(fresh.getQPICScores(), scorer.getQPICScores()), "incremental QP-IC scores after NNIs");
+		check(sameScores(fresh.getEQPICScores(), scorer.getEQPICScores()), "incremental EQP-IC scores after NNIs");
+
+		for (auto move = moves.rbegin(); move != moves.rend(); ++move) {
+			scorer.applyNNI(move->first, move->second);
+		}
+		check(sameScores(lqic, scorer.getLQICScores()) && sameScores(qpic, scorer.getQPICScores())
+				&& sameScores(eqpic, scorer.getEQPICScores()), "incremental scores after undoing the NNIs");
+
+		// the second NNI undoes the first
+		time("IncrementalScorer/NNI", 2, [&] {
+			scorer.applyNNI(moves[0].first, moves[0].second);
+			scorer.applyNNI(moves[0].first, moves[0].second);
+		});
+	}
+
+	// -------------------------------------------------------------------------
+	//     Data Members
+	// -------------------------------------------------------------------------
+
+	size_t numTaxa;
+	size_t repetitions;
+	int numThreads;
+	int internalMemory;
+	std::string evalTreesPath;
+	bool bifurcating; /**< no inner edge of the evaluation trees was contracted */
+	size_t failures; /**< number of failed checks */
+
+	Tree referenceTree;
+	std::vector<std::vector<uint64_t>> geneClades; /**< taxa of each clade of each evaluation tree */
+	std::unordered_map<std::string, size_t> taxonToLookupID;
+	std::vector<size_t> taxonToNode; /**< node index of each taxon in the reference tree */
+	std::vector<size_t> nodeToTaxon;
+
+	std::vector<std::vector<size_t>> neighbors; /**< adjacent nodes of each node of the reference tree */
+	std::vector<std::vector<bool>> nodesBelow; /**< nodes on the secondary side of each edge */
+	std::vector<uint64_t> taxaBelow; /**< taxa on the secondary side of each edge */
+};
+
+/**
+ * Run the microbenchmarks. Returns 1 if any kernel disagrees with the brute-force reference.
+ */
+int main(int argc, char* argv[]) {
+	size_t numTaxa, numTrees, swaps, repetitions, nThreads;
+	double collapse;
+	uint64_t seed;
+	int internalMemory;
+	std::string evalTreesPath;
+	Metrics::get_instance().setTimingLog([](std::string const &line) { LOG(INFO) << line; });
+
+	try {
+		TCLAP::CmdLine cmd("Microbenchmarks for the quartet counting and scoring kernels", ' ', "1.0");
+		TCLAP::ValueArg<size_t> taxaArg("n", "taxa", "Number of taxa of the synthetic trees (4 to 64)", false, 24, "uint");
+		TCLAP::ValueArg<size_t> treesArg("m", "trees", "Number of synthetic evaluation trees", false, 100, "uint");
+		TCLAP::ValueArg<size_t> swapsArg("w", "swaps", "Leaf swaps per evaluation tree", false, 2, "uint");
+		TCLAP::ValueArg<double> collapseArg("c", "collapse", "Probability of contracting an inner edge of an evaluation tree", false, 0.1, "double");
+		TCLAP::ValueArg<uint64_t> seedArg("", "seed", "Seed of the tree generator", false, 42, "uint");
+		TCLAP::ValueArg<size_t> repetitionsArg("r", "repetitions", "Timed runs per kernel", false, 5, "uint");
+		TCLAP::ValueArg<size_t> threadsArg("t", "threads", "Maximum number of threads to use", false, 0, "uint");
+		TCLAP::ValueArg<int> intMemArg("i", "internal", "Internal memory to use for external structure", false, 28, "uint");
+		TCLAP::ValueArg<std::string> evalArg("e", "eval", "Temporary file for the evaluation trees", false, "QuartetScoresBench_trees.nwk", "string");
+		cmd.add(taxaArg);
+		cmd.add(treesArg);
+		cmd.add(swapsArg);
+		cmd.add(collapseArg);
+		cmd.add(seedArg);
+		cmd.add(repetitionsArg);
+		cmd.add(threadsArg);
+		cmd.add(intMemArg);
+		cmd.add(evalArg);
+		cmd.parse(argc, argv);
+
+		numTaxa = taxaArg.getValue();
+		numTrees = treesArg.getValue();
+		swaps = swapsArg.getValue();
+		collapse = collapseArg.getValue();
+		seed = seedArg.getValue();
+		repetitions = std::max<size_t>(repetitionsArg.getValue(), 1);
+		nThreads = threadsArg.getValue();
+		internalMemory = intMemArg.getValue();
+		evalTreesPath = evalArg.getValue();
+	} catch (TCLAP::ArgException &e) {
+		std::cerr << "ERROR: " << e.error() << " for arg " << e.argId() << std::endl;
+		return 1;
+	}
+	if (numTaxa < 4 || numTaxa > 64) {
+		std::cerr << "ERROR: The number of taxa has to be between 4 and 64." << std::endl;
+		return 1;
+	}
+
+#ifdef GENESIS_OPENMP
+	if (nThreads == 0) {
+		nThreads = omp_get_max_threads();
+	}
+	omp_set_num_threads(nThreads);
+#else
+	nThreads = 1;
+#endif
+
+	// the sorter and packed backends spill like the main program does
+	try {
+		configureSpillDisks(defaultSpillDirectory(), false, std::cerr);
+	} catch (std::runtime_error &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+	QuartetScoresBench bench(numTaxa, numTrees, swaps, collapse, seed, repetitions, nThreads, internalMemory,
+			evalTreesPath);
+	return bench.run() ? 0 : 1;
+}
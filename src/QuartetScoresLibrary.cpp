@@ -0,0 +1,106 @@
+#include "QuartetScoresLibrary.hpp"
+#include "CladeIntersectionScorer.hpp"
+#include "CountingBackends.hpp"
+#include "GeneTreeInput.hpp"
+#include "MemoryPlanner.hpp"
+#include "QuartetScoreComputer.hpp"
+
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+namespace quartet_scores {
+
+namespace {
+
+template<typename CINT, template<typename > class Backend>
+void computeScoresWith(Tree const &referenceTree, GeneTreeOpener const &openEvalTrees, size_t m,
+		Options const &options, int internalMemory, std::ostream &log, Scores &scores) {
+	QuartetScoreComputer<CINT, Backend> qsc(referenceTree, openEvalTrees, m, options.verbose, options.hugePages,
+			options.numThreads, internalMemory, log);
+	qsc.releaseScores(scores.lqic, scores.qpic, scores.eqpic);
+}
+
+template<typename CINT>
+void computeScoresWith(CountingBackend backend, Tree const &referenceTree, GeneTreeOpener const &openEvalTrees,
+		size_t m, Options const &options, int internalMemory, std::ostream &log, Scores &scores) {
+	switch (backend) {
+	case CountingBackend::DENSE:
+		computeScoresWith<CINT, DenseBackend>(referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+		break;
+	case CountingBackend::SORTER:
+		computeScoresWith<CINT, SorterBackend>(referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+		break;
+	case CountingBackend::PACKED:
+		computeScoresWith<CINT, PackedBackend>(referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+		break;
+	case CountingBackend::SPARSE:
+		computeScoresWith<CINT, SparseBackend>(referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+		break;
+	case CountingBackend::TILED:
+		computeScoresWith<CINT, TiledBackend>(referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+		break;
+	case CountingBackend::RESOLVED:
+		computeScoresWith<CINT, ResolvedBackend>(referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+		break;
+	}
+}
+
+} // namespace
+
+Scores computeScores(Tree const &referenceTree, std::string const &evalTreesPath, Options const &options) {
+	CountedGeneTreeFile const evalTrees(evalTreesPath, options.numThreads);
+	return computeScores(referenceTree, evalTrees.opener(), evalTrees.treeCount(), options);
+}
+
+Scores computeScores(Tree const &referenceTree, GeneTreeOpener const &openEvalTrees, size_t numTrees,
+		Options const &options) {
+	// a stream without buffer discards everything written to it
+	std::ostream discard(nullptr);
+	std::ostream &log = options.log ? *options.log : discard;
+
+	Scores scores;
+	if (options.engine == "table-free") {
+		CladeIntersectionScorer scorer(referenceTree, openEvalTrees, numTrees, options.numThreads, log);
+		scorer.releaseScores(scores.qpic, scores.eqpic);
+		return scores;
+	}
+
+	size_t const m = 2 * numTrees;
+	CountingBackend backend;
+	int internalMemory = options.internalMemory;
+	if (options.engine == "auto") {
+		size_t numTaxa = 0;
+		for (size_t i = 0; i < referenceTree.node_count(); ++i) {
+			numTaxa += referenceTree.node_at(i).is_leaf();
+		}
+		size_t const countBytes = m < (size_t(1) << 8) ? 1 : m < (size_t(1) << 16) ? 2 : m < (size_t(1) << 32) ? 4 : 8;
+		MemoryPlanner planner(numTaxa, numTrees, countBytes, resolveNumThreads(options.numThreads),
+				readMemoryLimit());
+		EnginePlan const &chosen = planner.best();
+		if (!chosen.fits) {
+			throw std::runtime_error("No counting engine fits into the memory limit.");
+		}
+		backend = parseCountingBackend(chosen.engine);
+		if (chosen.internalMemory > 0) {
+			internalMemory = chosen.internalMemory;
+		}
+		log << "Planned counting engine: " << chosen.engine << "\n";
+	} else {
+		backend = parseCountingBackend(options.engine);
+	}
+
+	if (m < (size_t(1) << 8)) {
+		computeScoresWith<uint8_t>(backend, referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+	} else if (m < (size_t(1) << 16)) {
+		computeScoresWith<uint16_t>(backend, referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+	} else if (m < (size_t(1) << 32)) {
+		computeScoresWith<uint32_t>(backend, referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+	} else {
+		computeScoresWith<uint64_t>(backend, referenceTree, openEvalTrees, m, options, internalMemory, log, scores);
+	}
+	return scores;
+}
+
+} // namespace quartet_scores
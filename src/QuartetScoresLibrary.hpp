@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "genesis/genesis.hpp"
+#include "GeneTreeSource.hpp"
+#include "huge_page_array.hpp"
+#include "InMemoryGeneTreeSource.hpp"
+
+/**
+ * Library interface for computing the scores without the command line program.
+ *
+ * The functions are reentrant: they do not read configuration files, write no files, print only to the stream
+ * given in the options, and do not change the OpenMP settings of the process. Concurrent calls only share the
+ * Metrics counters, which are process-wide, so the counters and progress of concurrent calls are summed up. The
+ * library does not turn on Metrics::recordSpans(), so repeated calls do not accumulate memory in Metrics.
+ * The sorter-based backends use the stxxl disks, which are configured once per process, e.g. by calling
+ * configureSpillDirectory() from SpillDirectory.hpp before the first computation.
+ */
+namespace quartet_scores {
+
+/**
+ * Options of a score computation. The defaults choose the counting backend from the memory limit.
+ */
+struct Options {
+	std::string engine = "auto"; /**< a counting backend (see parseCountingBackend()), "table-free", or "auto" */
+	int numThreads = 0; /**< number of threads, 0 for the OpenMP default */
+	int internalMemory = 33; /**< log2 of the bytes of internal memory for the sorter-based and tiled backends */
+	HugePageMode hugePages = HugePageMode::TRANSPARENT;
+	bool verbose = false; /**< print some additional (debug) information */
+	std::ostream *log = nullptr; /**< where to print status messages and progress, nullptr to discard them */
+};
+
+/**
+ * The scores of the edges of the reference tree, indexed by edge index. A vector is empty if its score is not
+ * computed: LQ-IC scores need the quartet table, and QP-IC and EQP-IC scores a bifurcating reference tree.
+ */
+struct Scores {
+	std::vector<double> lqic;
+	std::vector<double> qpic;
+	std::vector<double> eqpic;
+};
+
+/**
+ * Compute the scores of the reference tree for the evaluation trees in a file. Plain and prepared files are split
+ * into trees once; compressed files are decompressed twice, once to count the trees and once to count the quartets.
+ * @param referenceTree the reference tree
+ * @param evalTreesPath path to the file containing the set of evaluation trees, optionally compressed or prepared
+ * @param options the options of the computation
+ */
+Scores computeScores(Tree const &referenceTree, std::string const &evalTreesPath, Options const &options = Options());
+
+/**
+ * Compute the scores of the reference tree for the evaluation trees of a source.
+ * @param referenceTree the reference tree
+ * @param openEvalTrees opens the set of evaluation trees, once per computation
+ * @param numTrees number of evaluation trees
+ * @param options the options of the computation
+ */
+Scores computeScores(Tree const &referenceTree, GeneTreeOpener const &openEvalTrees, size_t numTrees,
+		Options const &options = Options());
+
+/**
+ * Compute the scores of the reference tree for the genesis trees in [first, last).
+ */
+template<typename Iterator>
+Scores computeScoresForTrees(Tree const &referenceTree, Iterator first, Iterator last,
+		Options const &options = Options()) {
+	return computeScores(referenceTree, treeRangeOpener(first, last, options.numThreads),
+			std::distance(first, last), options);
+}
+
+/**
+ * Compute the scores of the reference tree for the Newick strings in [first, last), one tree per string.
+ */
+template<typename Iterator>
+Scores computeScoresForNewick(Tree const &referenceTree, Iterator first, Iterator last,
+		Options const &options = Options()) {
+	return computeScores(referenceTree, newickRangeOpener(first, last, options.numThreads),
+			std::distance(first, last), options);
+}
+
+} // namespace quartet_scores
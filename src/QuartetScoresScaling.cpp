@@ -0,0 +1,357 @@
+#include "genesis/genesis.hpp"
+#include "CladeIntersectionScorer.hpp"
+#include "CountingBackends.hpp"
+#include "JsonWriter.hpp"
+#include "Metrics.hpp"
+#include "QuartetScoreComputer.hpp"
+#include "SpillDirectory.hpp"
+#include "SyntheticTrees.hpp"
+#include "tclap/CmdLine.h" // command line parser, downloaded from http://tclap.sourceforge.net/
+#include "easylogging++.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#	include <omp.h>
+#endif
+
+#include <stxxl/vector>
+
+using namespace genesis;
+using namespace tree;
+
+INITIALIZE_EASYLOGGINGPP
+
+/**
+ * Settings of the synthetic workload.
+ */
+struct WorkloadSettings {
+	size_t numTaxa;
+	TreeShape shape;
+	double missingRate; /**< probability of a taxon to be missing from an evaluation tree */
+	double discordance; /**< fraction of taxa swapped in each evaluation tree, relative to the reference tree */
+	double collapse; /**< probability of contracting an inner edge of an evaluation tree */
+	uint64_t seed;
+};
+
+/**
+ * Measurements of one run of the scoring pipeline.
+ */
+struct ScalingRun {
+	std::string sweep; /**< "strong" or "weak" */
+	std::string engine;
+	size_t threads;
+	int internalMemory;
+	size_t numTrees;
+	size_t repetition;
+	double countingSeconds;
+	double scoringSeconds;
+	double totalSeconds;
+	unsigned long long bytesRead; /**< I/O volume of the external sorter */
+	unsigned long long bytesWritten;
+	std::vector<uint64_t> counters; /**< totals of the Metrics counters */
+};
+
+/**
+ * Write a random reference tree and numTrees evaluation trees derived from it.
+ * The same settings always produce the same files, and the first k evaluation trees do not depend on numTrees.
+ */
+void writeWorkload(WorkloadSettings const &settings, size_t numTrees, std::string const &referencePath,
+		std::string const &evalTreesPath) {
+	SyntheticTreeGenerator generator(settings.numTaxa, settings.seed);
+	SyntheticTree reference = generator.randomTree(settings.shape);
+	std::ofstream(referencePath) << reference.toNewick() << "\n";
+
+	std::ofstream output(evalTreesPath);
+	size_t const swaps = settings.discordance * settings.numTaxa + 0.5;
+	for (size_t i = 0; i < numTrees; ++i) {
+		SyntheticTree gene = generator.perturb(reference, swaps);
+		if (settings.missingRate > 0) {
+			gene = generator.removeTaxa(gene, settings.missingRate);
+		}
+		generator.collapse(gene, settings.collapse);
+		output << gene.toNewick() << "\n";
+	}
+}
+
+/**
+ * Run the whole scoring pipeline once with the counting backend Backend.
+ */
+template<typename CINT, template<typename > class Backend>
+void runPipelineWith(Tree const &referenceTree, std::string const &evalTreesPath, size_t m, int numThreads,
+		int internalMemory, ScalingRun &run) {
+	QuartetScoreComputer<CINT, Backend> qsc(referenceTree, evalTreesPath, m, false, HugePageMode::TRANSPARENT,
+			numThreads, internalMemory);
+	run.countingSeconds = std::chrono::duration<double>(qsc.getCountingTime()).count();
+	run.scoringSeconds = std::chrono::duration<double>(qsc.getScoringTime()).count();
+}
+
+/**
+ * Run the whole scoring pipeline once, choosing the counter type by the number of trees as the main program does.
+ */
+template<typename CINT>
+void runPipeline(Tree const &referenceTree, std::string const &evalTreesPath, size_t m, CountingBackend backend,
+		int numThreads, int internalMemory, ScalingRun &run) {
+	switch (backend) {
+	case CountingBackend::DENSE:
+		runPipelineWith<CINT, DenseBackend>(referenceTree, evalTreesPath, m, numThreads, internalMemory, run);
+		break;
+	case CountingBackend::SORTER:
+		runPipelineWith<CINT, SorterBackend>(referenceTree, evalTreesPath, m, numThreads, internalMemory, run);
+		break;
+	case CountingBackend::PACKED:
+		runPipelineWith<CINT, PackedBackend>(referenceTree, evalTreesPath, m, numThreads, internalMemory, run);
+		break;
+	case CountingBackend::SPARSE:
+		runPipelineWith<CINT, SparseBackend>(referenceTree, evalTreesPath, m, numThreads, internalMemory, run);
+		break;
+	case CountingBackend::TILED:
+		runPipelineWith<CINT, TiledBackend>(referenceTree, evalTreesPath, m, numThreads, internalMemory, run);
+		break;
+	case CountingBackend::RESOLVED:
+		runPipelineWith<CINT, ResolvedBackend>(referenceTree, evalTreesPath, m, numThreads, internalMemory, run);
+		break;
+	}
+}
+
+void measureRun(std::string const &referencePath, std::string const &evalTreesPath, ScalingRun &run) {
+#ifdef GENESIS_OPENMP
+	omp_set_num_threads(run.threads);
+#endif
+	Metrics::get_instance().reset(run.threads);
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	stxxl::stats_data statsBegin(*stxxl::stats::get_instance());
+
+	Tree referenceTree = DefaultTreeNewickReader().from_file(referencePath);
+	size_t const m = 2 * run.numTrees;
+	if (run.engine == "table-free") {
+		CladeIntersectionScorer scorer(referenceTree, evalTreesPath, run.numTrees, run.threads);
+		run.countingSeconds = std::chrono::duration<double>(scorer.getCountingTime()).count();
+		run.scoringSeconds = std::chrono::duration<double>(scorer.getScoringTime()).count();
+	} else if (m < (size_t(1) << 8)) {
+		runPipeline<uint8_t>(referenceTree, evalTreesPath, m, parseCountingBackend(run.engine), run.threads,
+				run.internalMemory, run);
+	} else if (m < (size_t(1) << 16)) {
+		runPipeline<uint16_t>(referenceTree, evalTreesPath, m, parseCountingBackend(run.engine), run.threads,
+				run.internalMemory, run);
+	} else if (m < (size_t(1) << 32)) {
+		runPipeline<uint32_t>(referenceTree, evalTreesPath, m, parseCountingBackend(run.engine), run.threads,
+				run.internalMemory, run);
+	} else {
+		runPipeline<uint64_t>(referenceTree, evalTreesPath, m, parseCountingBackend(run.engine), run.threads,
+				run.internalMemory, run);
+	}
+
+	stxxl::stats_data statsEnd(*stxxl::stats::get_instance());
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	run.totalSeconds = std::chrono::duration<double>(end - begin).count();
+	run.bytesRead = (statsEnd - statsBegin).get_read_volume();
+	run.bytesWritten = (statsEnd - statsBegin).get_written_volume();
+	run.counters.clear();
+	for (int counter = 0; counter < Metrics::NUM_COUNTERS; ++counter) {
+		run.counters.push_back(Metrics::get_instance().total(static_cast<Metrics::Counter>(counter)));
+	}
+}
+
+/**
+ * Split a comma-separated command line value.
+ */
+std::vector<std::string> splitList(std::string const &list) {
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		if (!item.empty()) {
+			items.push_back(item);
+		}
+	}
+	if (items.empty()) {
+		throw std::runtime_error("Empty list '" + list + "'.");
+	}
+	return items;
+}
+
+void writeReport(std::ostream &output, WorkloadSettings const &settings, size_t baseTrees,
+		std::vector<ScalingRun> const &runs) {
+	JsonWriter json(output);
+	json.beginObject();
+	json.key("workload").beginObject();
+	json.field("taxa", settings.numTaxa);
+	json.field("shape", settings.shape == TreeShape::CATERPILLAR ? "caterpillar" : "yule");
+	json.field("trees", baseTrees);
+	json.field("missing_rate", settings.missingRate);
+	json.field("discordance", settings.discordance);
+	json.field("collapse", settings.collapse);
+	json.field("seed", static_cast<size_t>(settings.seed));
+	json.endObject();
+	json.key("runs").beginArray();
+	for (ScalingRun const &run : runs) {
+		json.beginObject();
+		json.field("sweep", run.sweep);
+		json.field("engine", run.engine);
+		json.field("threads", run.threads);
+		json.field("internal_memory_log2", run.internalMemory);
+		json.field("trees", run.numTrees);
+		json.field("repetition", run.repetition);
+		json.key("phases").beginObject();
+		json.field("counting_seconds", run.countingSeconds);
+		json.field("scoring_seconds", run.scoringSeconds);
+		json.field("total_seconds", run.totalSeconds);
+		json.endObject();
+		json.key("io").beginObject();
+		json.field("bytes_read", static_cast<size_t>(run.bytesRead));
+		json.field("bytes_written", static_cast<size_t>(run.bytesWritten));
+		json.endObject();
+		json.key("counters").beginObject();
+		for (size_t counter = 0; counter < run.counters.size(); ++counter) {
+			json.field(Metrics::counterName(counter), static_cast<size_t>(run.counters[counter]));
+		}
+		json.endObject();
+		json.endObject();
+	}
+	json.endArray();
+	json.endObject();
+}
+
+/**
+ * Generate synthetic workloads and run strong and weak scaling sweeps of the scoring pipeline over thread counts,
+ * internal memory budgets and counting engines. The measurements are written as JSON.
+ */
+int main(int argc, char* argv[]) {
+	WorkloadSettings settings;
+	size_t numTrees, repetitions;
+	std::string sweeps, threadList, memoryList, engineList, workDir, spillDir, outputPath;
+	bool generateOnly, spillDirGiven;
+	Metrics::get_instance().setTimingLog([](std::string const &line) { LOG(INFO) << line; });
+
+	try {
+		TCLAP::CmdLine cmd("Scaling experiments on synthetic workloads", ' ', "1.0");
+		TCLAP::ValueArg<size_t> taxaArg("n", "taxa", "Number of taxa", false, 50, "uint");
+		TCLAP::ValueArg<size_t> treesArg("m", "trees", "Number of evaluation trees (per thread for weak scaling)", false, 100, "uint");
+		TCLAP::ValueArg<std::string> shapeArg("", "shape", "Shape of the reference tree: yule or caterpillar", false, "yule", "string");
+		TCLAP::ValueArg<double> missingArg("", "missing", "Probability of a taxon to be missing from an evaluation tree", false, 0.0, "double");
+		TCLAP::ValueArg<double> discordanceArg("", "discordance", "Fraction of taxa swapped in each evaluation tree", false, 0.05, "double");
+		TCLAP::ValueArg<double> collapseArg("", "collapse", "Probability of contracting an inner edge of an evaluation tree", false, 0.0, "double");
+		TCLAP::ValueArg<uint64_t> seedArg("", "seed", "Seed of the tree generator", false, 42, "uint");
+		TCLAP::ValueArg<std::string> sweepArg("", "sweep", "Sweeps to run: strong, weak or strong,weak", false, "strong", "string");
+		TCLAP::ValueArg<std::string> threadsArg("t", "threads", "Comma-separated thread counts", false, "1,2,4", "list");
+		TCLAP::ValueArg<std::string> intMemArg("i", "internal", "Comma-separated internal memory budgets (log2 bytes) of the external sorter or the tiled buffers", false, "28", "list");
+		TCLAP::ValueArg<std::string> engineArg("", "engine", "Comma-separated counting engines: the backends dense, sorter, packed, sparse, tiled, resolved, and table-free", false, "sorter", "list");
+		TCLAP::ValueArg<size_t> repetitionsArg("r", "repetitions", "Runs per configuration", false, 1, "uint");
+		TCLAP::ValueArg<std::string> dirArg("d", "dir", "Directory for the generated trees", false, ".", "string");
+		TCLAP::ValueArg<std::string> spillArg("", "spill-dir", "Directory the external sorter spills to. By default, the disks of a .stxxl or $STXXLCFG file are used, or $TMPDIR or /tmp if there is none", false, "", "string");
+		TCLAP::ValueArg<std::string> outputArg("o", "output", "Path of the JSON report", false, "scaling.json", "string");
+		TCLAP::SwitchArg generateArg("g", "generate", "Only write the reference and evaluation trees of the workload", false);
+		cmd.add(taxaArg);
+		cmd.add(treesArg);
+		cmd.add(shapeArg);
+		cmd.add(missingArg);
+		cmd.add(discordanceArg);
+		cmd.add(collapseArg);
+		cmd.add(seedArg);
+		cmd.add(sweepArg);
+		cmd.add(threadsArg);
+		cmd.add(intMemArg);
+		cmd.add(engineArg);
+		cmd.add(repetitionsArg);
+		cmd.add(dirArg);
+		cmd.add(spillArg);
+		cmd.add(outputArg);
+		cmd.add(generateArg);
+		cmd.parse(argc, argv);
+
+		settings.numTaxa = taxaArg.getValue();
+		settings.shape = parseTreeShape(shapeArg.getValue());
+		settings.missingRate = missingArg.getValue();
+		settings.discordance = discordanceArg.getValue();
+		settings.collapse = collapseArg.getValue();
+		settings.seed = seedArg.getValue();
+		numTrees = treesArg.getValue();
+		sweeps = sweepArg.getValue();
+		threadList = threadsArg.getValue();
+		memoryList = intMemArg.getValue();
+		engineList = engineArg.getValue();
+		repetitions = repetitionsArg.getValue();
+		workDir = dirArg.getValue();
+		spillDirGiven = spillArg.isSet();
+		spillDir = spillDirGiven ? spillArg.getValue() : defaultSpillDirectory();
+		outputPath = outputArg.getValue();
+		generateOnly = generateArg.getValue();
+	} catch (TCLAP::ArgException &e) {
+		std::cerr << "ERROR: " << e.error() << " for arg " << e.argId() << std::endl;
+		return 1;
+	} catch (std::runtime_error &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	std::string const referencePath = workDir + "/synthetic_reference.tre";
+	auto evalTreesPath = [&workDir](size_t trees) {
+		return workDir + "/synthetic_evaluation_" + std::to_string(trees) + ".tre";
+	};
+
+	std::vector<ScalingRun> runs;
+	try {
+		if (generateOnly) {
+			writeWorkload(settings, numTrees, referencePath, evalTreesPath(numTrees));
+			std::cout << "Wrote " << referencePath << " and " << evalTreesPath(numTrees) << std::endl;
+			return 0;
+		}
+
+		std::vector<std::string> const engines = splitList(engineList);
+		for (std::string const &engine : engines) {
+			if (engine != "table-free") {
+				CountingBackend const backend = parseCountingBackend(engine);
+				if (backend == CountingBackend::SORTER || backend == CountingBackend::PACKED) {
+					configureSpillDisks(spillDir, spillDirGiven, std::cerr);
+				}
+			}
+		}
+		for (std::string const &sweep : splitList(sweeps)) {
+			if (sweep != "strong" && sweep != "weak") {
+				throw std::runtime_error("Invalid sweep '" + sweep + "'. Use strong or weak.");
+			}
+			for (std::string const &threads : splitList(threadList)) {
+				// strong scaling keeps the workload fixed, weak scaling grows it with the threads
+				size_t const trees = (sweep == "weak") ? numTrees * std::stoul(threads) : numTrees;
+				writeWorkload(settings, trees, referencePath, evalTreesPath(trees));
+				for (std::string const &memory : splitList(memoryList)) {
+					for (std::string const &engine : engines) {
+						for (size_t rep = 0; rep < repetitions; ++rep) {
+							ScalingRun run;
+							run.sweep = sweep;
+							run.engine = engine;
+							run.threads = std::stoul(threads);
+							run.internalMemory = std::stoi(memory);
+							run.numTrees = trees;
+							run.repetition = rep;
+							measureRun(referencePath, evalTreesPath(trees), run);
+							runs.push_back(run);
+							std::cerr << "[scaling] " << sweep << " engine=" << engine << " threads=" << threads
+									<< " internal=" << memory << " trees=" << trees << " total=" << run.totalSeconds
+									<< "s" << std::endl;
+						}
+					}
+				}
+				std::remove(evalTreesPath(trees).c_str());
+			}
+		}
+		std::remove(referencePath.c_str());
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	// the pipeline prints its progress to standard output, so the report goes to a file
+	std::ofstream output(outputPath);
+	writeReport(output, settings, numTrees, runs);
+	std::cout << "Wrote " << runs.size() << " runs to " << outputPath << std::endl;
+	return 0;
+}
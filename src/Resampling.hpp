@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Multiplicities of the evaluation trees in resampled replicates of the set of evaluation trees. The counts of a
+ * replicate are the counts of the single trees weighted by their multiplicities, so all replicates can be counted
+ * while reading the trees once.
+ */
+struct Resampling {
+	size_t replicates = 0; /**< number of replicates, 0 for no resampling */
+	std::vector<uint32_t> weights; /**< multiplicity of tree t in replicate b at t * replicates + b */
+
+	/**
+	 * Bootstrap replicates: each replicate draws as many trees as there are, with replacement.
+	 */
+	static Resampling bootstrap(size_t numTrees, size_t replicates, uint64_t seed) {
+		Resampling resampling(numTrees, replicates);
+		std::mt19937_64 random(seed);
+		std::uniform_int_distribution<size_t> pick(0, numTrees > 0 ? numTrees - 1 : 0);
+		for (size_t b = 0; b < replicates; ++b) {
+			for (size_t i = 0; i < numTrees; ++i) {
+				++resampling.weights[pick(random) * replicates + b];
+			}
+		}
+		return resampling;
+	}
+
+	/**
+	 * Delete-half jackknife replicates: each replicate keeps half of the trees, without replacement.
+	 */
+	static Resampling jackknife(size_t numTrees, size_t replicates, uint64_t seed) {
+		Resampling resampling(numTrees, replicates);
+		std::mt19937_64 random(seed);
+		std::vector<size_t> order(numTrees);
+		std::iota(order.begin(), order.end(), 0);
+		for (size_t b = 0; b < replicates; ++b) {
+			// a partial Fisher-Yates shuffle chooses the kept trees
+			size_t const kept = (numTrees + 1) / 2;
+			for (size_t i = 0; i < kept; ++i) {
+				std::uniform_int_distribution<size_t> pick(i, numTrees - 1);
+				std::swap(order[i], order[pick(random)]);
+				resampling.weights[order[i] * replicates + b] = 1;
+			}
+		}
+		return resampling;
+	}
+
+	/**
+	 * The multiplicities of tree t in all replicates.
+	 */
+	uint32_t const* treeWeights(size_t t) const {
+		if ((t + 1) * replicates > weights.size()) {
+			throw std::runtime_error("There are more evaluation trees than resampled.");
+		}
+		return &weights[t * replicates];
+	}
+
+	Resampling() = default;
+
+private:
+	Resampling(size_t numTrees, size_t replicates) :
+			replicates(replicates), weights(numTrees * replicates, 0) {
+	}
+};
+
+/**
+ * Write the distributions of the replicate scores of each edge as tab-separated values: one line per edge and score,
+ * with the mean, standard deviation, 2.5%, 50% and 97.5% quantiles of the finite replicate scores, followed by the
+ * scores of all replicates.
+ * @param path path of the output file
+ * @param names names of the scores, e.g. "QP-IC"
+ * @param scores for each score, the scores of each replicate, indexed by replicate and edge
+ */
+inline void writeReplicateScores(std::string const &path, std::vector<std::string> const &names,
+		std::vector<std::vector<std::vector<double>>> const &scores) {
+	std::ofstream output(path);
+	if (!output) {
+		throw std::runtime_error("Cannot write the replicate scores to " + path + ".");
+	}
+	output << "edge\tscore\tmean\tsd\tq2.5\tmedian\tq97.5";
+	size_t const replicates = scores.empty() ? 0 : scores[0].size();
+	for (size_t b = 0; b < replicates; ++b) {
+		output << "\treplicate" << b;
+	}
+	output << "\n";
+
+	size_t const edges = replicates == 0 ? 0 : scores[0][0].size();
+	std::vector<double> finite;
+	for (size_t e = 0; e < edges; ++e) {
+		for (size_t s = 0; s < scores.size(); ++s) {
+			finite.clear();
+			for (size_t b = 0; b < replicates; ++b) {
+				if (std::isfinite(scores[s][b][e])) {
+					finite.push_back(scores[s][b][e]);
+				}
+			}
+			// scores of leaf edges are infinite in every replicate
+			if (finite.empty()) {
+				continue;
+			}
+			std::sort(finite.begin(), finite.end());
+			double const mean = std::accumulate(finite.begin(), finite.end(), 0.0) / finite.size();
+			double squares = 0;
+			for (double value : finite) {
+				squares += (value - mean) * (value - mean);
+			}
+			double const sd = finite.size() > 1 ? std::sqrt(squares / (finite.size() - 1)) : 0;
+			auto quantile = [&finite](double q) {
+				return finite[static_cast<size_t>(std::round(q * (finite.size() - 1)))];
+			};
+			output << e << "\t" << names[s] << "\t" << mean << "\t" << sd << "\t" << quantile(0.025) << "\t"
+					<< quantile(0.5) << "\t" << quantile(0.975);
+			for (size_t b = 0; b < replicates; ++b) {
+				output << "\t" << scores[s][b][e];
+			}
+			output << "\n";
+		}
+	}
+}
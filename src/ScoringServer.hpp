@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "genesis/genesis.hpp"
+#include "FlatGeneTree.hpp"
+#include "QuartetCounterLookup.hpp"
+#include "QuartetScoreComputer.hpp"
+#include "quartet_newick_writer.hpp"
+
+using namespace genesis;
+using namespace tree;
+
+/**
+ * Keeps the quartet counts of a set of evaluation trees in memory and scores the reference trees sent to it, so that
+ * each request only costs the scoring phase.
+ *
+ * A request is a reference tree in Newick format, terminated by ';', whose taxa are a subset of the taxa the quartets
+ * were counted for. The response is the annotated tree as QuartetScores writes it, on one line, followed by one line
+ * per edge with the edge index and its LQ-IC, QP-IC and EQP-IC scores, separated by tabs ("NA" for scores that are
+ * not computed), and an empty line. An invalid request, or one longer than MAX_REQUEST_SIZE, is answered with a line
+ * "ERROR: <message>" and an empty line. The requests of a connection are answered in order, and the connections of a
+ * socket are served concurrently.
+ */
+template<typename CINT, template<typename > class Backend>
+class ScoringServer {
+public:
+	using Counter = QuartetCounterLookup<CINT, Backend>;
+
+	static const size_t MAX_REQUEST_SIZE = size_t(64) << 20; /**< bytes of a request, which is buffered until its ';' */
+
+	/**
+	 * @param counter the quartet counts of the evaluation trees
+	 * @param numThreads number of threads for scoring one request, 0 for the OpenMP default
+	 * @param log where to print status messages
+	 */
+	ScoringServer(std::shared_ptr<Counter const> counter, int numThreads, std::ostream &log) :
+			counter(std::move(counter)), numThreads(numThreads), log(log) {
+	}
+
+	/**
+	 * Score one reference tree and return the response.
+	 */
+	std::string score(std::string const &newick) const {
+		Tree tree = DefaultTreeNewickReader().from_string(newick);
+		std::ostream discard(nullptr);
+		QuartetScoreComputer<CINT, Backend> qsc(tree, counter, numThreads, discard);
+		std::vector<double> lqic;
+		std::vector<double> qpic;
+		std::vector<double> eqpic;
+		qsc.releaseScores(lqic, qpic, eqpic);
+
+		auto writer = QuartetTreeNewickWriter();
+		if (!lqic.empty()) {
+			writer.set_lq_ic_scores(lqic);
+		}
+		if (!eqpic.empty()) {
+			writer.set_eqp_ic_scores(eqpic);
+		}
+		if (!qpic.empty()) {
+			writer.set_qp_ic_scores(qpic);
+		}
+		std::ostringstream response;
+		std::string annotated = writer.to_string(tree);
+		while (!annotated.empty() && (annotated.back() == '\n' || annotated.back() == '\r')) {
+			annotated.pop_back();
+		}
+		response << annotated << "\n";
+		for (size_t i = 0; i < tree.edge_count(); ++i) {
+			response << i << "\t" << scoreText(lqic, i) << "\t" << scoreText(qpic, i) << "\t" << scoreText(eqpic, i)
+					<< "\n";
+		}
+		response << "\n";
+		return response.str();
+	}
+
+	/**
+	 * Answer the requests read from the file descriptor input on output, until input is closed.
+	 */
+	void serveConnection(int input, int output) const {
+		std::vector<char> chunk(1 << 16);
+		std::string request;
+		// a request beyond MAX_REQUEST_SIZE is dropped, and the rest of it is skipped up to its ';'
+		bool tooLong = false;
+		NewickScanState state;
+		while (true) {
+			ssize_t const bytes = ::read(input, chunk.data(), chunk.size());
+			if (bytes < 0 && errno == EINTR) {
+				continue;
+			}
+			if (bytes <= 0) {
+				break;
+			}
+			for (ssize_t i = 0; i < bytes; ++i) {
+				if (!tooLong) {
+					request.push_back(chunk[i]);
+					if (request.size() > MAX_REQUEST_SIZE) {
+						tooLong = true;
+						std::string().swap(request);
+					}
+				}
+				if (!state.step(chunk[i])) {
+					continue;
+				}
+				std::string response;
+				if (tooLong) {
+					response = "ERROR: The request is longer than " + std::to_string(MAX_REQUEST_SIZE) + " bytes.\n\n";
+				} else {
+					try {
+						response = score(request);
+					} catch (std::exception const &e) {
+						response = std::string("ERROR: ") + e.what() + "\n\n";
+					}
+				}
+				if (!writeAll(output, response)) {
+					return;
+				}
+				request.clear();
+				tooLong = false;
+				state = NewickScanState();
+			}
+		}
+	}
+
+	/**
+	 * Listen on a Unix socket at the given path, which must not exist yet, and serve each connection in its own
+	 * thread. Does not return unless the socket cannot be created.
+	 */
+	void serveSocket(std::string const &path) const {
+		sockaddr_un address;
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path)) {
+			throw std::runtime_error("The socket path " + path + " is too long.");
+		}
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+		int const listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener < 0) {
+			throw std::runtime_error("Cannot create a socket: " + std::string(std::strerror(errno)));
+		}
+		if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+				|| ::listen(listener, SOMAXCONN) != 0) {
+			std::string const error = std::strerror(errno);
+			::close(listener);
+			throw std::runtime_error("Cannot listen on " + path + ": " + error);
+		}
+		// a client that disconnects early must not terminate the server
+		std::signal(SIGPIPE, SIG_IGN);
+		log << "Listening for reference trees on " << path << std::endl;
+
+		while (true) {
+			int const connection = ::accept(listener, nullptr, nullptr);
+			if (connection < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+				std::string const error = std::strerror(errno);
+				::close(listener);
+				throw std::runtime_error("Cannot accept connections on " + path + ": " + error);
+			}
+			// the thread may outlive this server, e.g. if accept fails, so it serves with its own copy
+			ScoringServer const server(*this);
+			std::thread([server, connection] {
+				server.serveConnection(connection, connection);
+				::close(connection);
+			}).detach();
+		}
+	}
+
+private:
+	static std::string scoreText(std::vector<double> const &scores, size_t i) {
+		if (scores.empty()) {
+			return "NA";
+		}
+		std::ostringstream text;
+		text << scores[i];
+		return text.str();
+	}
+
+	static bool writeAll(int output, std::string const &text) {
+		size_t written = 0;
+		while (written < text.size()) {
+			ssize_t const bytes = ::write(output, text.data() + written, text.size() - written);
+			if (bytes < 0 && errno == EINTR) {
+				continue;
+			}
+			if (bytes <= 0) {
+				return false;
+			}
+			written += bytes;
+		}
+		return true;
+	}
+
+	std::shared_ptr<Counter const> counter;
+	int numThreads;
+	std::ostream &log;
+};
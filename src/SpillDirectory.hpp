@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdlib>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <stxxl/mng>
+
+static const int SPILL_QUEUE_LENGTH = 64; /**< asynchronous requests in flight on the spill file */
+
+/**
+ * The directory the external sorter spills to by default: $TMPDIR, or /tmp if it is not set.
+ */
+inline std::string defaultSpillDirectory() {
+	char const *tmp = std::getenv("TMPDIR");
+	return (tmp != nullptr && *tmp != '\0') ? tmp : "/tmp";
+}
+
+/**
+ * The disk configuration file stxxl reads, searched in the same order as stxxl does: $STXXLCFG, then .stxxl.$HOSTNAME
+ * and .stxxl in the working directory, then the same in $HOME. Empty if there is none, in which case stxxl uses a
+ * default disk.
+ */
+inline std::string stxxlConfigFile() {
+	std::vector<std::string> candidates;
+	char const *config = std::getenv("STXXLCFG");
+	if (config != nullptr && *config != '\0') {
+		candidates.push_back(config);
+	}
+	char const *hostname = std::getenv("HOSTNAME");
+	char const *home = std::getenv("HOME");
+	std::vector<std::string> bases { "./.stxxl" };
+	if (home != nullptr) {
+		bases.push_back(std::string(home) + "/.stxxl");
+	}
+	for (std::string const &base : bases) {
+		if (hostname != nullptr) {
+			candidates.push_back(base + "." + hostname);
+		}
+		candidates.push_back(base);
+	}
+	for (std::string const &candidate : candidates) {
+		if (::access(candidate.c_str(), R_OK) == 0) {
+			return candidate;
+		}
+	}
+	return "";
+}
+
+/**
+ * Let stxxl spill into a file in the given directory instead of the disks of a .stxxl configuration file, so that
+ * node-local scratch space can be used without editing files. The file starts empty and grows as needed, and it is
+ * unlinked right after it is opened, so it is removed when the process exits, even after a crash. The file is
+ * accessed with kernel asynchronous I/O and a deep request queue where stxxl supports it, and with blocking system
+ * calls otherwise.
+ *
+ * stxxl reads its disk configuration once, so this has to be called before the first external sorter is created,
+ * and only the first call has an effect.
+ * @param directory an existing, writable directory
+ * @param log where to print the spill file and the free space
+ * @return false if the spill directory was already configured
+ */
+inline bool configureSpillDirectory(std::string const &directory, std::ostream &log) {
+	static bool configured = false;
+	if (configured) {
+		return false;
+	}
+	if (::access(directory.c_str(), W_OK | X_OK) != 0) {
+		throw std::runtime_error("Cannot spill to " + directory + ", which is not a writable directory.");
+	}
+	// concurrent jobs on a node may share the directory
+	std::string const path = directory + "/QuartetScores." + std::to_string(::getpid()) + ".spill";
+#ifdef STXXL_HAVE_LINUXAIO_FILE
+	stxxl::disk_config disk(path, 0, "linuxaio");
+	disk.queue_length = SPILL_QUEUE_LENGTH;
+#else
+	stxxl::disk_config disk(path, 0, "syscall");
+#endif
+	disk.autogrow = true;
+	disk.delete_on_exit = true;
+	disk.unlink_on_open = true;
+	stxxl::config::get_instance()->add_disk(disk);
+	configured = true;
+
+	struct statvfs space;
+	if (::statvfs(directory.c_str(), &space) == 0) {
+		log << "Spilling to " << path << " (" << static_cast<unsigned long long>(space.f_bavail) * space.f_frsize
+				<< " bytes free)\n";
+	}
+	return true;
+}
+
+/**
+ * Configure the spill directory if it was given explicitly, or if stxxl finds no configuration file. Otherwise, the
+ * disks of the configuration file are kept, as before the spill directory existed.
+ * @param directory an existing, writable directory
+ * @param given the directory was asked for, e.g. with --spill-dir
+ * @param log where to print the spill file, or the configuration file that is used instead
+ * @return true if the spill directory was configured
+ */
+inline bool configureSpillDisks(std::string const &directory, bool given, std::ostream &log) {
+	std::string const configFile = stxxlConfigFile();
+	if (!given && !configFile.empty()) {
+		log << "Spilling to the disks of " << configFile << "\n";
+		return false;
+	}
+	return configureSpillDirectory(directory, log);
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * A random tree on the taxa t0, ..., t(n-1), stored as a plain list of nodes.
+ * The root has three children for bifurcating trees, as in unrooted Newick trees.
+ */
+struct SyntheticTree {
+	struct Node {
+		std::vector<size_t> children; /**< indices of the child nodes, empty for leaves */
+		size_t taxon; /**< taxon of a leaf */
+	};
+
+	std::vector<Node> nodes;
+	size_t root;
+	size_t numTaxa;
+
+	static std::string taxonName(size_t taxon) {
+		return "t" + std::to_string(taxon);
+	}
+
+	/**
+	 * Return the tree in Newick format, without branch lengths.
+	 */
+	std::string toNewick() const {
+		std::string result;
+		appendNewick(root, result);
+		result += ";";
+		return result;
+	}
+
+	/**
+	 * Return the taxa below each non-root node as bit masks, indexed by taxon. Only for up to 64 taxa.
+	 */
+	std::vector<uint64_t> cladeMasks() const {
+		if (numTaxa > 64) {
+			throw std::runtime_error("Clade masks are only available for up to 64 taxa.");
+		}
+		std::vector<uint64_t> masks;
+		cladeMask(root, masks);
+		masks.pop_back(); // the root
+		return masks;
+	}
+
+private:
+	void appendNewick(size_t node, std::string &result) const {
+		if (nodes[node].children.empty()) {
+			result += taxonName(nodes[node].taxon);
+			return;
+		}
+		result += "(";
+		for (size_t i = 0; i < nodes[node].children.size(); ++i) {
+			if (i > 0) {
+				result += ",";
+			}
+			appendNewick(nodes[node].children[i], result);
+		}
+		result += ")";
+	}
+
+	uint64_t cladeMask(size_t node, std::vector<uint64_t> &masks) const {
+		uint64_t mask = 0;
+		if (nodes[node].children.empty()) {
+			mask = uint64_t(1) << nodes[node].taxon;
+		}
+		for (size_t child : nodes[node].children) {
+			mask |= cladeMask(child, masks);
+		}
+		masks.push_back(mask);
+		return mask;
+	}
+};
+
+/**
+ * Shapes of random reference trees.
+ */
+enum class TreeShape {
+	YULE, /**< random joining of subtrees, which gives the shape distribution of the Yule model */
+	CATERPILLAR /**< a single path with all taxa attached to it, the most unbalanced shape */
+};
+
+/**
+ * Parse a tree shape as given on the command line ("yule" or "caterpillar").
+ */
+inline TreeShape parseTreeShape(std::string const &shape) {
+	if (shape == "yule") {
+		return TreeShape::YULE;
+	} else if (shape == "caterpillar") {
+		return TreeShape::CATERPILLAR;
+	}
+	throw std::runtime_error("Invalid tree shape '" + shape + "'. Use yule or caterpillar.");
+}
+
+/**
+ * Generates random trees for benchmarks and scaling experiments. The same seed yields the same trees.
+ */
+class SyntheticTreeGenerator {
+public:
+	SyntheticTreeGenerator(size_t numTaxa, uint64_t seed) :
+			numTaxa(numTaxa), random(seed) {
+		if (numTaxa < 4) {
+			throw std::runtime_error("Synthetic trees need at least 4 taxa.");
+		}
+	}
+
+	/**
+	 * Return a random bifurcating tree of the given shape.
+	 */
+	SyntheticTree randomTree(TreeShape shape) {
+		return shape == TreeShape::CATERPILLAR ? caterpillarTree() : randomTree();
+	}
+
+	/**
+	 * Return a random bifurcating tree, built by joining random pairs of subtrees until three are left.
+	 */
+	SyntheticTree randomTree() {
+		SyntheticTree tree;
+		tree.numTaxa = numTaxa;
+		std::vector<size_t> subtrees;
+		for (size_t taxon = 0; taxon < numTaxa; ++taxon) {
+			tree.nodes.push_back(SyntheticTree::Node { { }, taxon });
+			subtrees.push_back(taxon);
+		}
+		while (subtrees.size() > 3) {
+			size_t const first = takeRandom(subtrees);
+			size_t const second = takeRandom(subtrees);
+			tree.nodes.push_back(SyntheticTree::Node { { first, second }, 0 });
+			subtrees.push_back(tree.nodes.size() - 1);
+		}
+		tree.nodes.push_back(SyntheticTree::Node { subtrees, 0 });
+		tree.root = tree.nodes.size() - 1;
+		return tree;
+	}
+
+	/**
+	 * Return a caterpillar tree with the taxa in random order.
+	 */
+	SyntheticTree caterpillarTree() {
+		SyntheticTree tree;
+		tree.numTaxa = numTaxa;
+		std::vector<size_t> order;
+		for (size_t taxon = 0; taxon < numTaxa; ++taxon) {
+			order.push_back(taxon);
+		}
+		std::shuffle(order.begin(), order.end(), random);
+		for (size_t taxon : order) {
+			tree.nodes.push_back(SyntheticTree::Node { { }, taxon });
+		}
+		size_t chain = 0;
+		for (size_t leaf = 1; leaf + 2 < numTaxa; ++leaf) {
+			tree.nodes.push_back(SyntheticTree::Node { { chain, leaf }, 0 });
+			chain = tree.nodes.size() - 1;
+		}
+		tree.nodes.push_back(SyntheticTree::Node { { chain, numTaxa - 2, numTaxa - 1 }, 0 });
+		tree.root = tree.nodes.size() - 1;
+		return tree;
+	}
+
+	/**
+	 * Return a copy of the tree in which the taxa of swaps random pairs of leaves are exchanged.
+	 * Few swaps give gene trees that mostly agree with the tree, as in real data sets.
+	 */
+	SyntheticTree perturb(SyntheticTree const &tree, size_t swaps) {
+		SyntheticTree result = tree;
+		std::uniform_int_distribution<size_t> leafDist(0, numTaxa - 1);
+		for (size_t i = 0; i < swaps; ++i) {
+			// the leaves are the first numTaxa nodes
+			std::swap(result.nodes[leafDist(random)].taxon, result.nodes[leafDist(random)].taxon);
+		}
+		return result;
+	}
+
+	/**
+	 * Return a copy of the tree without the leaves of randomly chosen taxa, each missing with the given
+	 * probability. Nodes with a single remaining child are suppressed. At least four taxa are kept.
+	 * The result cannot be perturbed any more, so this has to come after perturb().
+	 */
+	SyntheticTree removeTaxa(SyntheticTree const &tree, double missingRate) {
+		std::bernoulli_distribution missing(missingRate);
+		std::vector<bool> keep(numTaxa);
+		std::vector<size_t> removed;
+		for (size_t taxon = 0; taxon < numTaxa; ++taxon) {
+			keep[taxon] = !missing(random);
+			if (!keep[taxon]) {
+				removed.push_back(taxon);
+			}
+		}
+		while (numTaxa - removed.size() < 4) {
+			keep[takeRandom(removed)] = true;
+		}
+
+		SyntheticTree result;
+		result.numTaxa = numTaxa;
+		result.root = prune(tree, tree.root, keep, result);
+		return result;
+	}
+
+	/**
+	 * Contract each inner edge of the tree with the given probability, creating multifurcations.
+	 */
+	void collapse(SyntheticTree &tree, double probability) {
+		std::bernoulli_distribution contract(probability);
+		collapseBelow(tree, tree.root, contract);
+	}
+
+private:
+	size_t takeRandom(std::vector<size_t> &items) {
+		std::uniform_int_distribution<size_t> dist(0, items.size() - 1);
+		size_t const pos = dist(random);
+		size_t const item = items[pos];
+		items[pos] = items.back();
+		items.pop_back();
+		return item;
+	}
+
+	/**
+	 * Copy the subtree of node into result, without the leaves that are not kept.
+	 * Returns the index of the copy, or NONE if no leaf is left.
+	 */
+	static size_t prune(SyntheticTree const &tree, size_t node, std::vector<bool> const &keep, SyntheticTree &result) {
+		SyntheticTree::Node const &original = tree.nodes[node];
+		if (original.children.empty()) {
+			if (!keep[original.taxon]) {
+				return NONE;
+			}
+			result.nodes.push_back(original);
+			return result.nodes.size() - 1;
+		}
+		std::vector<size_t> children;
+		for (size_t child : original.children) {
+			size_t const copy = prune(tree, child, keep, result);
+			if (copy != NONE) {
+				children.push_back(copy);
+			}
+		}
+		if (children.empty()) {
+			return NONE;
+		}
+		if (children.size() == 1) {
+			return children[0];
+		}
+		result.nodes.push_back(SyntheticTree::Node { children, 0 });
+		return result.nodes.size() - 1;
+	}
+
+	void collapseBelow(SyntheticTree &tree, size_t node, std::bernoulli_distribution &contract) {
+		std::vector<size_t> children;
+		for (size_t child : tree.nodes[node].children) {
+			collapseBelow(tree, child, contract);
+			if (!tree.nodes[child].children.empty() && contract(random)) {
+				children.insert(children.end(), tree.nodes[child].children.begin(), tree.nodes[child].children.end());
+			} else {
+				children.push_back(child);
+			}
+		}
+		tree.nodes[node].children = children;
+	}
+
+	static const size_t NONE = static_cast<size_t>(-1);
+
+	size_t numTaxa;
+	std::mt19937_64 random;
+};
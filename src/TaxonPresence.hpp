@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "FlatGeneTree.hpp"
+
+/**
+ * For each taxon, the set of evaluation trees that contain it, as a bitset over the tree indices. The number of trees
+ * that contain all four taxa of a quartet is the popcount of the AND of their four bitsets, which takes one pass over
+ * numTrees / 64 words per taxon.
+ *
+ * The bitset of a taxon is stored contiguously, so the stride between taxa grows as trees are added.
+ */
+class TaxonPresence {
+public:
+	explicit TaxonPresence(size_t numTaxa) :
+			numTaxa(numTaxa), stride(0) {
+	}
+
+	/**
+	 * Mark the leaves of an evaluation tree as present in the tree with the given index.
+	 */
+	void add(FlatGeneTree const &tree, size_t treeIdx) {
+		size_t const word = treeIdx / 64;
+		if (word >= stride) {
+			grow(std::max(word + 1, 2 * stride));
+		}
+		uint64_t const bit = uint64_t(1) << (treeIdx % 64);
+		for (FlatGeneTree::LeafId leaf : tree.leaves) {
+			bits[leaf * stride + word] |= bit;
+		}
+	}
+
+	/**
+	 * The number of trees that contain all of the taxa a, b, c, and d.
+	 */
+	size_t common(size_t a, size_t b, size_t c, size_t d) const {
+		uint64_t const *wa = bits.data() + a * stride;
+		uint64_t const *wb = bits.data() + b * stride;
+		uint64_t const *wc = bits.data() + c * stride;
+		uint64_t const *wd = bits.data() + d * stride;
+		size_t count = 0;
+		for (size_t w = 0; w < stride; ++w) {
+			count += popcount(wa[w] & wb[w] & wc[w] & wd[w]);
+		}
+		return count;
+	}
+
+	/**
+	 * Size of the bitsets in bytes.
+	 */
+	size_t size() const {
+		return bits.size() * sizeof(uint64_t);
+	}
+
+private:
+	static size_t popcount(uint64_t word) {
+#if defined(__GNUC__)
+		return __builtin_popcountll(word);
+#else
+		size_t count = 0;
+		for (; word != 0; word &= word - 1) {
+			++count;
+		}
+		return count;
+#endif
+	}
+
+	void grow(size_t newStride) {
+		std::vector<uint64_t> grown(numTaxa * newStride, 0);
+		for (size_t taxon = 0; taxon < numTaxa; ++taxon) {
+			std::copy(bits.begin() + taxon * stride, bits.begin() + (taxon + 1) * stride,
+					grown.begin() + taxon * newStride);
+		}
+		bits.swap(grown);
+		stride = newStride;
+	}
+
+	size_t numTaxa;
+	size_t stride; /**< words per taxon */
+	std::vector<uint64_t> bits; /**< tree t contains taxon i if bit t % 64 of bits[i * stride + t / 64] is set */
+};
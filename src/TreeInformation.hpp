@@ -4,6 +4,9 @@
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
 
 using namespace genesis;
 using namespace tree;
@@ -11,7 +14,9 @@ using namespace utils;
 
 /**
  * Helper class that computes the lowest common ancestor of two nodes in respect to any given root node,
- * as well as the distance between any two nodes in number of edges.
+ * as well as the distance between any two nodes in number of edges. The parent of each node, the edge to it, and the
+ * links at both ends of that edge are stored in plain arrays, so that paths can be walked without following the links
+ * of the tree.
  */
 class TreeInformation {
 public:
@@ -23,6 +28,12 @@ public:
 	size_t lowestCommonAncestorIdx(size_t uIdx, size_t vIdx, size_t rootIdx);
 	unsigned distanceInEdges(size_t uIdx, size_t vIdx);
 	size_t getRootIdx();
+	size_t depth(size_t nodeIdx) const;
+	size_t parentIdx(size_t nodeIdx) const;
+	size_t parentEdgeIdx(size_t nodeIdx) const;
+	std::pair<size_t, size_t> pathInnerLinks(size_t uIdx, size_t vIdx, size_t lcaIdx) const;
+	template<typename Visit>
+	void forEachPathEdge(size_t uIdx, size_t vIdx, size_t lcaIdx, Visit visit) const;
 private:
 	size_t myRootIndex; /**< index of the root node */
 	std::unique_ptr<RangeMinimumQuery> rrmq; /**< pointer to a RangeMinimumQuery */
@@ -30,14 +41,35 @@ private:
 	std::vector<size_t> eulerTourNodes; /**< the nodes of the tree visited in an Eulerian tour order */
 	std::vector<size_t> firstOccurrenceInEulerTour; /**< the nodes' first occurrence in an Eulerian tour */
 	std::vector<size_t> dist_to_root; /**< distance of a given node to the root in terms of number of edges */
+	std::vector<size_t> parentNode; /**< ID of the parent of a given node, the maximum for the root */
+	std::vector<size_t> parentEdge; /**< index of the edge from a given node to its parent */
+	std::vector<size_t> downLink; /**< index of the link of the parent that points towards a given node */
+	std::vector<size_t> upLink; /**< index of the link of a given node that points towards its parent */
 };
 
+/**
+ * Call visit with the index of each edge on the path between the nodes at uIdx and vIdx, first those from u up to
+ * their lowest common ancestor, then those from v up to it.
+ * @param uIdx ID of the node u
+ * @param vIdx ID of the node v
+ * @param lcaIdx ID of the lowest common ancestor of u and v in respect to the tree's root node
+ */
+template<typename Visit>
+void TreeInformation::forEachPathEdge(size_t uIdx, size_t vIdx, size_t lcaIdx, Visit visit) const {
+	for (size_t node = uIdx; node != lcaIdx; node = parentNode[node]) {
+		visit(parentEdge[node]);
+	}
+	for (size_t node = vIdx; node != lcaIdx; node = parentNode[node]) {
+		visit(parentEdge[node]);
+	}
+}
+
 /**
  * Compute the distance in edges between two nodes, using their lowest common ancestor.
  * @param uIdx index of the first node in the tree
  * @param vIdx index of the second node in the tree
  */
-unsigned TreeInformation::distanceInEdges(size_t uIdx, size_t vIdx) {
+inline unsigned TreeInformation::distanceInEdges(size_t uIdx, size_t vIdx) {
 	size_t lcaIdx = lowestCommonAncestorIdx(uIdx, vIdx, myRootIndex);
 	return dist_to_root[uIdx] + dist_to_root[vIdx] - 2 * dist_to_root[lcaIdx];
 }
@@ -48,7 +80,7 @@ unsigned TreeInformation::distanceInEdges(size_t uIdx, size_t vIdx) {
  * @param i the starting position
  * @param j the ending position
  */
-size_t TreeInformation::rmqQueryCorrectOrder(size_t i, size_t j) {
+inline size_t TreeInformation::rmqQueryCorrectOrder(size_t i, size_t j) {
 	if (i <= j)
 		return rrmq->query(i, j);
 	else
@@ -58,17 +90,67 @@ size_t TreeInformation::rmqQueryCorrectOrder(size_t i, size_t j) {
 /**
  * Return the ID of the root node in the tree.
  */
-size_t TreeInformation::getRootIdx() {
+inline size_t TreeInformation::getRootIdx() {
 	return myRootIndex;
 }
 
+/**
+ * Return the distance of the node at nodeIdx to the root in number of edges.
+ */
+inline size_t TreeInformation::depth(size_t nodeIdx) const {
+	return dist_to_root[nodeIdx];
+}
+
+/**
+ * Return the ID of the parent of the node at nodeIdx, or the maximum size_t for the root.
+ */
+inline size_t TreeInformation::parentIdx(size_t nodeIdx) const {
+	return parentNode[nodeIdx];
+}
+
+/**
+ * Return the index of the edge between the node at nodeIdx and its parent.
+ */
+inline size_t TreeInformation::parentEdgeIdx(size_t nodeIdx) const {
+	return parentEdge[nodeIdx];
+}
+
+/**
+ * For a pair of distinct nodes and their lowest common ancestor in respect to the tree's root node, return the indices
+ * of the link of u that points towards v and of the link of v that points towards u.
+ * @param uIdx ID of the node u
+ * @param vIdx ID of the node v
+ * @param lcaIdx ID of the lowest common ancestor of u and v
+ */
+inline std::pair<size_t, size_t> TreeInformation::pathInnerLinks(size_t uIdx, size_t vIdx, size_t lcaIdx) const {
+	if (uIdx == vIdx) {
+		throw std::runtime_error("No inner links on a path between a node and itself.");
+	}
+	if (uIdx == lcaIdx) {
+		// u points towards its child on the path
+		size_t child = vIdx;
+		while (parentNode[child] != uIdx) {
+			child = parentNode[child];
+		}
+		return {downLink[child], upLink[vIdx]};
+	}
+	if (vIdx == lcaIdx) {
+		size_t child = uIdx;
+		while (parentNode[child] != vIdx) {
+			child = parentNode[child];
+		}
+		return {upLink[uIdx], downLink[child]};
+	}
+	return {upLink[uIdx], upLink[vIdx]};
+}
+
 /**
  * Return the ID of the lowest common ancestor of the nodes at uIdx and vIdx, using rootIdx as the root node ID.
  * @param uIdx ID of the node u
  * @param vIdx ID of the node v
  * @param rootIdx the ID of the node to be used as the root node
  */
-size_t TreeInformation::lowestCommonAncestorIdx(size_t uIdx, size_t vIdx, size_t rootIdx) {
+inline size_t TreeInformation::lowestCommonAncestorIdx(size_t uIdx, size_t vIdx, size_t rootIdx) {
 	size_t uEulerIdx = firstOccurrenceInEulerTour[uIdx];
 	size_t vEulerIdx = firstOccurrenceInEulerTour[vIdx];
 	size_t rootEulerIdx = firstOccurrenceInEulerTour[rootIdx];
@@ -92,11 +174,13 @@ size_t TreeInformation::lowestCommonAncestorIdx(size_t uIdx, size_t vIdx, size_t
 /**
  * @param tree the tree to build the TreeInformation for.
  */
-void TreeInformation::init(Tree const &tree) {
+inline void TreeInformation::init(Tree const &tree) {
 	dist_to_root = node_path_length_vector(tree);
 	// Arrays for LCA computation
 	std::vector<int> eulerTourLevels;
 
+	// the tree may be initialized again after its topology changed
+	eulerTourNodes.clear();
 	firstOccurrenceInEulerTour.resize(tree.node_count());
 	std::fill(firstOccurrenceInEulerTour.begin(), firstOccurrenceInEulerTour.end(), std::numeric_limits<size_t>::max());
 
@@ -110,11 +194,25 @@ void TreeInformation::init(Tree const &tree) {
 	myRootIndex = tree.root_node().index();
 
 	rrmq = make_unique<RangeMinimumQuery>(eulerTourLevels);
+
+	// the primary link of an edge is the one towards the root
+	parentNode.assign(tree.node_count(), std::numeric_limits<size_t>::max());
+	parentEdge.assign(tree.node_count(), std::numeric_limits<size_t>::max());
+	downLink.assign(tree.node_count(), std::numeric_limits<size_t>::max());
+	upLink.assign(tree.node_count(), std::numeric_limits<size_t>::max());
+	for (size_t i = 0; i < tree.edge_count(); ++i) {
+		TreeEdge const &edge = tree.edge_at(i);
+		size_t const child = edge.secondary_link().node().index();
+		parentNode[child] = edge.primary_link().node().index();
+		parentEdge[child] = i;
+		downLink[child] = edge.primary_link().index();
+		upLink[child] = edge.secondary_link().index();
+	}
 }
 
 /**
  * @param tree the tree to build the TreeInformation for.
  */
-TreeInformation::TreeInformation() {
+inline TreeInformation::TreeInformation() {
 	myRootIndex = 0;
 }
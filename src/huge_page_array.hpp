@@ -0,0 +1,294 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined( __linux__ )
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef GENESIS_OPENMP
+#	include <omp.h>
+#endif
+
+// =================================================================================================
+//     Huge Page Array
+// =================================================================================================
+
+/**
+ * How the memory of a HugePageArray is backed.
+ */
+enum class HugePageMode {
+	NONE, /**< plain pages */
+	TRANSPARENT, /**< ask the kernel for transparent huge pages via madvise */
+	EXPLICIT /**< use pages from the hugetlbfs pool, falling back to transparent huge pages if the pool is empty */
+};
+
+/**
+ * Parse a huge page mode as given on the command line ("none", "transparent" or "explicit").
+ */
+inline HugePageMode parseHugePageMode(std::string const& mode) {
+	if (mode == "none") {
+		return HugePageMode::NONE;
+	} else if (mode == "transparent") {
+		return HugePageMode::TRANSPARENT;
+	} else if (mode == "explicit") {
+		return HugePageMode::EXPLICIT;
+	}
+	throw std::runtime_error("Invalid huge page mode '" + mode + "'. Use none, transparent or explicit.");
+}
+
+/**
+ * Fixed-size, zero-initialized array for the large count tables.
+ *
+ * The memory is mapped directly, optionally backed by huge pages, and zeroed in parallel by the
+ * same threads that later read it. With a static schedule, each thread first-touches one
+ * contiguous slice, so the pages are spread over the NUMA nodes in proportion to the threads
+ * running there, instead of all landing on the node of the allocating thread.
+ * T needs to be trivially copyable, as no constructors are run.
+ */
+template<typename T>
+class HugePageArray {
+public:
+
+	// -------------------------------------------------------------------------
+	//     Constructors and Rule of Five
+	// -------------------------------------------------------------------------
+
+	HugePageArray() :
+			data_(nullptr), size_(0), bytes_(0), mapped_(false), huge_pages_(false) {
+	}
+
+	HugePageArray(size_t size, HugePageMode mode = HugePageMode::TRANSPARENT, int num_threads = 0) :
+			HugePageArray() {
+		allocate(size, mode, num_threads);
+	}
+
+	~HugePageArray() {
+		free_();
+	}
+
+	HugePageArray(HugePageArray const&) = delete;
+	HugePageArray& operator=(HugePageArray const&) = delete;
+
+	HugePageArray(HugePageArray&& other) :
+			HugePageArray() {
+		swap(other);
+	}
+
+	HugePageArray& operator=(HugePageArray&& other) {
+		if (this != &other) {
+			free_();
+			swap(other);
+		}
+		return *this;
+	}
+
+	void swap(HugePageArray& other) {
+		std::swap(data_, other.data_);
+		std::swap(size_, other.size_);
+		std::swap(bytes_, other.bytes_);
+		std::swap(mapped_, other.mapped_);
+		std::swap(huge_pages_, other.huge_pages_);
+	}
+
+	// -------------------------------------------------------------------------
+	//     Public Interface
+	// -------------------------------------------------------------------------
+
+	/**
+	 * Allocate and zero size elements. Previous contents are freed.
+	 * @param num_threads number of threads for the first-touch initialization, 0 for the OpenMP default
+	 */
+	void allocate(size_t size, HugePageMode mode, int num_threads) {
+		free_();
+		size_ = size;
+		bytes_ = round_up_(size * sizeof(T), HUGE_PAGE_SIZE);
+		if (size == 0) {
+			return;
+		}
+
+#if defined( __linux__ )
+		void* ptr = MAP_FAILED;
+		if (mode == HugePageMode::EXPLICIT) {
+			ptr = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			huge_pages_ = (ptr != MAP_FAILED);
+		}
+		if (ptr == MAP_FAILED) {
+			ptr = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (ptr == MAP_FAILED) {
+				throw std::bad_alloc();
+			}
+#	ifdef MADV_HUGEPAGE
+			if (mode != HugePageMode::NONE) {
+				huge_pages_ = (madvise(ptr, bytes_, MADV_HUGEPAGE) == 0);
+			}
+#	endif
+		}
+		data_ = static_cast<T*>(ptr);
+		mapped_ = true;
+#else
+		(void) mode;
+		data_ = static_cast<T*>(::operator new(bytes_));
+#endif
+		first_touch_(num_threads);
+	}
+
+	void clear() {
+		free_();
+	}
+
+	size_t size() const {
+		return size_;
+	}
+
+	bool empty() const {
+		return size_ == 0;
+	}
+
+	/**
+	 * Whether huge pages were requested successfully. For transparent huge pages, this only means
+	 * that the kernel accepted the advice.
+	 */
+	bool huge_pages() const {
+		return huge_pages_;
+	}
+
+	T& operator[](size_t i) {
+		assert(i < size_);
+		return data_[i];
+	}
+
+	T const& operator[](size_t i) const {
+		assert(i < size_);
+		return data_[i];
+	}
+
+	T* data() {
+		return data_;
+	}
+
+	T const* data() const {
+		return data_;
+	}
+
+	T* begin() {
+		return data_;
+	}
+
+	T* end() {
+		return data_ + size_;
+	}
+
+	T const* begin() const {
+		return data_;
+	}
+
+	T const* end() const {
+		return data_ + size_;
+	}
+
+	/**
+	 * Return how many of the sampled pages of the array reside on each NUMA node.
+	 * Index i of the result is the number of pages on node i. Empty if the placement cannot be queried.
+	 * @param max_samples maximum number of pages to query, spread evenly over the array
+	 */
+	std::vector<size_t> pages_per_node(size_t max_samples = 4096) const {
+		std::vector<size_t> result;
+#if defined( __linux__ ) && defined( SYS_move_pages )
+		if (!mapped_ || bytes_ == 0) {
+			return result;
+		}
+		size_t const page_size = sysconf(_SC_PAGE_SIZE);
+		size_t const num_pages = bytes_ / page_size;
+		size_t const step = num_pages > max_samples ? num_pages / max_samples : 1;
+
+		std::vector<void*> pages;
+		for (size_t p = 0; p < num_pages; p += step) {
+			pages.push_back(reinterpret_cast<char*>(data_) + p * page_size);
+		}
+		std::vector<int> status(pages.size(), -1);
+		// With nodes == nullptr, move_pages only reports the node of each page.
+		if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) != 0) {
+			return result;
+		}
+		for (int node : status) {
+			if (node < 0) {
+				continue;
+			}
+			if (static_cast<size_t>(node) >= result.size()) {
+				result.resize(node + 1, 0);
+			}
+			++result[node];
+		}
+#endif
+		return result;
+	}
+
+	// -------------------------------------------------------------------------
+	//     Private Members
+	// -------------------------------------------------------------------------
+
+private:
+
+	static const size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+	static size_t round_up_(size_t value, size_t multiple) {
+		return ((value + multiple - 1) / multiple) * multiple;
+	}
+
+	/**
+	 * Zero the memory in one contiguous slice per thread, in units of huge pages.
+	 */
+	void first_touch_(int num_threads) {
+		char* const bytes = reinterpret_cast<char*>(data_);
+		size_t const num_chunks = bytes_ / HUGE_PAGE_SIZE;
+#ifdef GENESIS_OPENMP
+		if (num_threads <= 0) {
+			num_threads = omp_get_max_threads();
+		}
+#pragma omp parallel for schedule(static) num_threads(num_threads)
+#else
+		(void) num_threads;
+#endif
+		for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
+			std::memset(bytes + chunk * HUGE_PAGE_SIZE, 0, HUGE_PAGE_SIZE);
+		}
+	}
+
+	void free_() {
+		if (data_ != nullptr) {
+#if defined( __linux__ )
+			if (mapped_) {
+				munmap(data_, bytes_);
+			}
+#else
+			::operator delete(data_);
+#endif
+		}
+		data_ = nullptr;
+		size_ = 0;
+		bytes_ = 0;
+		mapped_ = false;
+		huge_pages_ = false;
+	}
+
+	// -------------------------------------------------------------------------
+	//     Data Members
+	// -------------------------------------------------------------------------
+
+	T* data_;
+	size_t size_; /**< number of elements */
+	size_t bytes_; /**< mapped bytes, rounded up to full huge pages */
+	bool mapped_;
+	bool huge_pages_;
+
+};
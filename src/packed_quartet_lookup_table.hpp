@@ -0,0 +1,221 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "quartet_lookup_table.hpp"
+
+// =================================================================================================
+//     Packed Quartet Lookup Table
+// =================================================================================================
+
+/**
+ * Read-only, bit-packed copy of a QuartetLookupTable.
+ *
+ * The quartets are grouped into blocks of BLOCK_SIZE consecutive lookup IDs. Each block stores its
+ * 3 * BLOCK_SIZE counts with the bit width of the largest count in the block, starting at a word
+ * boundary so that blocks can be encoded in parallel. Blocks that only contain zeros take no space.
+ */
+template<typename LookupIntType>
+class PackedQuartetLookupTable {
+public:
+
+	// -------------------------------------------------------------------------
+	//     Typedefs and Enums
+	// -------------------------------------------------------------------------
+
+	using QuartetTuple = std::array< LookupIntType, 3 >;
+
+	static const size_t BLOCK_SIZE = 64;
+
+	// -------------------------------------------------------------------------
+	//     Constructors and Rule of Five
+	// -------------------------------------------------------------------------
+
+	PackedQuartetLookupTable() :
+			num_quartets_(0) {
+	}
+
+	PackedQuartetLookupTable(QuartetLookupTable<LookupIntType> const& table) {
+		init(table);
+	}
+
+	~PackedQuartetLookupTable() = default;
+
+	PackedQuartetLookupTable(PackedQuartetLookupTable const&) = default;
+	PackedQuartetLookupTable(PackedQuartetLookupTable&&) = default;
+
+	PackedQuartetLookupTable& operator=(PackedQuartetLookupTable const&) = default;
+	PackedQuartetLookupTable& operator=(PackedQuartetLookupTable&&) = default;
+
+	// -------------------------------------------------------------------------
+	//     Public Interface
+	// -------------------------------------------------------------------------
+
+	void init(QuartetLookupTable<LookupIntType> const& table) {
+		num_quartets_ = table.quartet_lookup_.size();
+		size_t const num_blocks = (num_quartets_ + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		std::vector<uint8_t> widths(num_blocks, 0);
+
+		// First pass: find the bit width of each block.
+#pragma omp parallel for schedule(static)
+		for (size_t block = 0; block < num_blocks; ++block) {
+			LookupIntType max_count = 0;
+			size_t const end = block_end_(block);
+			for (size_t id = block * BLOCK_SIZE; id < end; ++id) {
+				for (size_t k = 0; k < 3; ++k) {
+					max_count |= table.quartet_lookup_[id][k];
+				}
+			}
+			widths[block] = bit_width_(max_count);
+		}
+
+		// Word offsets of the blocks, as exclusive prefix sum over the block sizes.
+		block_info_.resize(num_blocks);
+		uint64_t offset = 0;
+		for (size_t block = 0; block < num_blocks; ++block) {
+			block_info_[block] = (offset << 8) | widths[block];
+			offset += (3 * (block_end_(block) - block * BLOCK_SIZE) * widths[block] + 63) / 64;
+		}
+		words_ = std::vector<uint64_t>(offset, 0);
+
+		// Second pass: encode. Blocks start at word boundaries, so there are no shared words.
+#pragma omp parallel for schedule(static)
+		for (size_t block = 0; block < num_blocks; ++block) {
+			unsigned const width = widths[block];
+			if (width == 0) {
+				continue;
+			}
+			uint64_t bit_pos = block_offset_(block) * 64;
+			size_t const end = block_end_(block);
+			for (size_t id = block * BLOCK_SIZE; id < end; ++id) {
+				for (size_t k = 0; k < 3; ++k) {
+					write_bits_(bit_pos, width, table.quartet_lookup_[id][k]);
+					bit_pos += width;
+				}
+			}
+		}
+	}
+
+	size_t num_quartets() const {
+		return num_quartets_;
+	}
+
+	size_t size() const {
+		return words_.size() * sizeof(uint64_t) + block_info_.size() * sizeof(uint64_t);
+	}
+
+	/**
+	 * Return the counts of the quartet with the given lookup ID, as given by QuartetLookupTable::get_tuple_id().
+	 */
+	QuartetTuple get_tuple(size_t id) const {
+		assert(id < num_quartets_);
+		size_t const block = id / BLOCK_SIZE;
+		unsigned const width = block_width_(block);
+		QuartetTuple tuple = {{ 0, 0, 0 }};
+		if (width == 0) {
+			return tuple;
+		}
+		uint64_t const bit_pos = block_offset_(block) * 64 + (id % BLOCK_SIZE) * 3 * width;
+		tuple[0] = static_cast<LookupIntType>(read_bits_(bit_pos, width));
+		tuple[1] = static_cast<LookupIntType>(read_bits_(bit_pos + width, width));
+		tuple[2] = static_cast<LookupIntType>(read_bits_(bit_pos + 2 * width, width));
+		return tuple;
+	}
+
+	/**
+	 * Decode all tuples of the block with the given index into out, which needs to have room for BLOCK_SIZE tuples.
+	 * Returns the number of decoded tuples, which is only smaller than BLOCK_SIZE for the last block.
+	 */
+	size_t decode_block(size_t block, QuartetTuple* out) const {
+		size_t const count = block_end_(block) - block * BLOCK_SIZE;
+		unsigned const width = block_width_(block);
+		if (width == 0) {
+			for (size_t i = 0; i < count; ++i) {
+				out[i] = {{ 0, 0, 0 }};
+			}
+			return count;
+		}
+		uint64_t bit_pos = block_offset_(block) * 64;
+		for (size_t i = 0; i < count; ++i) {
+			for (size_t k = 0; k < 3; ++k) {
+				out[i][k] = static_cast<LookupIntType>(read_bits_(bit_pos, width));
+				bit_pos += width;
+			}
+		}
+		return count;
+	}
+
+	/**
+	 * Return the address of the first word of the block that holds the quartet with the given lookup ID.
+	 */
+	uint64_t const* block_words(size_t id) const {
+		assert(id < num_quartets_);
+		return words_.data() + block_offset_(id / BLOCK_SIZE);
+	}
+
+	// -------------------------------------------------------------------------
+	//     Private Members
+	// -------------------------------------------------------------------------
+
+private:
+
+	size_t block_end_(size_t block) const {
+		size_t const end = (block + 1) * BLOCK_SIZE;
+		return end < num_quartets_ ? end : num_quartets_;
+	}
+
+	uint64_t block_offset_(size_t block) const {
+		return block_info_[block] >> 8;
+	}
+
+	unsigned block_width_(size_t block) const {
+		return static_cast<unsigned>(block_info_[block] & 0xff);
+	}
+
+	static uint8_t bit_width_(LookupIntType value) {
+		uint8_t width = 0;
+		uint64_t v = value;
+		while (v != 0) {
+			++width;
+			v >>= 1;
+		}
+		return width;
+	}
+
+	static uint64_t value_mask_(unsigned width) {
+		return width >= 64 ? std::numeric_limits<uint64_t>::max() : ((uint64_t(1) << width) - 1);
+	}
+
+	uint64_t read_bits_(uint64_t bit_pos, unsigned width) const {
+		size_t const word = bit_pos / 64;
+		unsigned const shift = bit_pos % 64;
+		uint64_t value = words_[word] >> shift;
+		if (shift + width > 64) {
+			value |= words_[word + 1] << (64 - shift);
+		}
+		return value & value_mask_(width);
+	}
+
+	void write_bits_(uint64_t bit_pos, unsigned width, uint64_t value) {
+		size_t const word = bit_pos / 64;
+		unsigned const shift = bit_pos % 64;
+		words_[word] |= value << shift;
+		if (shift + width > 64) {
+			words_[word + 1] |= value >> (64 - shift);
+		}
+	}
+
+	// -------------------------------------------------------------------------
+	//     Data Members
+	// -------------------------------------------------------------------------
+
+	std::vector<uint64_t> words_; /**> the packed counts of all blocks */
+	std::vector<uint64_t> block_info_; /**> per block: word offset in the upper 56 bits, bit width in the lower 8 bits */
+
+	size_t num_quartets_;
+
+};
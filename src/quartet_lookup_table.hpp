@@ -4,9 +4,12 @@
 
 #include <array>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
+#include "huge_page_array.hpp"
+
 #ifdef USE_STXXL
 #include <stxxl/vector>
 #endif
@@ -15,7 +18,11 @@
 //     Quartet Lookup Table
 // =================================================================================================
 
-template<typename LookupIntType>
+/**
+ * The counts of the three topologies of each quartet, indexed by the combinatorial rank of the quartet. With
+ * StoredCounts = 2, only the first two counts of each quartet are stored, for backends that derive the third one.
+ */
+template<typename LookupIntType, size_t StoredCounts = 3>
 class QuartetLookupTable {
 public:
 
@@ -23,7 +30,7 @@ public:
 	//     Typedefs and Enums
 	// -------------------------------------------------------------------------
 
-	using QuartetTuple = std::array< LookupIntType, 3 >;
+	using QuartetTuple = std::array< LookupIntType, StoredCounts >;
 
 	// -------------------------------------------------------------------------
 	//     Constructors and Rule of Five
@@ -55,10 +62,22 @@ public:
 	//     Public Interface
 	// -------------------------------------------------------------------------
 
-	void init(size_t num_taxa) {
+	/**
+	 * @param num_taxa number of taxa in the reference tree
+	 * @param huge_pages how to back the table memory
+	 * @param num_threads number of threads that zero the table, which should be the number of scoring threads
+	 */
+	void init(size_t num_taxa, HugePageMode huge_pages = HugePageMode::TRANSPARENT, int num_threads = 0) {
 		num_taxa_ = num_taxa;
 		// init_binom_lookup_(num_taxa);
-		init_quartet_lookup_(num_taxa);
+		init_quartet_lookup_(num_taxa, huge_pages, num_threads);
+	}
+
+	/**
+	 * Only set up the index computation, without allocating the counts, for callers that store them elsewhere.
+	 */
+	void init_index(size_t num_taxa) {
+		num_taxa_ = num_taxa;
 	}
 
 	size_t num_taxa() const {
@@ -66,7 +85,7 @@ public:
 	}
 
 	size_t size() const {
-		return (quartet_lookup_.size() * 3 * sizeof(LookupIntType)) + (binom_lookup_.size() + 1) * sizeof(size_t);
+		return (quartet_lookup_.size() * StoredCounts * sizeof(LookupIntType)) + (binom_lookup_.size() + 1) * sizeof(size_t);
 	}
 
 	QuartetTuple& get_tuple(size_t a, size_t b, size_t c, size_t d) {
@@ -81,13 +100,45 @@ public:
 		return quartet_lookup_[id];
 	}
 
-	size_t get_tuple_id(size_t a, size_t b, size_t c, size_t d) {
-		size_t id = lookup_index_(a, b, c, d);
+	/**
+	 * Return the counts of the quartet with the given lookup ID, as given by get_tuple_id().
+	 */
+	QuartetTuple& tuple_at(size_t id) {
 		assert(id < quartet_lookup_.size());
+		return quartet_lookup_[id];
+	}
+
+	size_t get_tuple_id(size_t a, size_t b, size_t c, size_t d) const {
+		size_t id = lookup_index_(a, b, c, d);
+		assert(id < num_quartets());
 		return id;
 	}
 
+	size_t num_quartets() const {
+		return (num_taxa_ * (num_taxa_ - 1) * (num_taxa_ - 2) * (num_taxa_ - 3)) / 24;
+	}
+
+	/**
+	 * Free the memory of the counts, but keep the index computation usable,
+	 * e.g. after the counts were moved into a PackedQuartetLookupTable.
+	 */
+	void release() {
+		quartet_lookup_.clear();
+	}
+
+	/**
+	 * Return the number of sampled table pages that reside on each NUMA node, see HugePageArray::pages_per_node().
+	 */
+	std::vector<size_t> pages_per_node() const {
+#ifdef USE_STXXL
+		return std::vector<size_t>();
+#else
+		return quartet_lookup_.pages_per_node();
+#endif
+	}
+
 	void update_quartet(size_t id, LookupIntType counter_q1, LookupIntType counter_q2, LookupIntType counter_q3){
+		static_assert(StoredCounts == 3, "update_quartet needs all three counts");
 		quartet_lookup_[id][0] += counter_q1;
 		quartet_lookup_[id][1] += counter_q2;
 		quartet_lookup_[id][2] += counter_q3;
@@ -141,10 +192,16 @@ public:
 		}
 	}
 
-	void init_quartet_lookup_(size_t num_taxa) {
+	void init_quartet_lookup_(size_t num_taxa, HugePageMode huge_pages, int num_threads) {
 		// calculate ncr(n, 4)
 		size_t const n = (num_taxa * (num_taxa - 1) * (num_taxa - 2) * (num_taxa - 3)) / 24;
-		quartet_lookup_ = std::vector<QuartetTuple>(n, {{ 0, 0, 0 }});
+#ifdef USE_STXXL
+		(void) huge_pages;
+		(void) num_threads;
+		quartet_lookup_.resize(n, QuartetTuple());
+#else
+		quartet_lookup_.allocate(n, huge_pages, num_threads);
+#endif
 	}
 
 	size_t binom_coefficient_sum_(size_t a, size_t b, size_t c, size_t d) const {
@@ -227,7 +284,7 @@ public:
 #ifdef USE_STXXL
 	stxxl::VECTOR_GENERATOR<QuartetTuple>::result quartet_lookup_;
 #else
-	std::vector<QuartetTuple> quartet_lookup_;
+	HugePageArray<QuartetTuple> quartet_lookup_;
 #endif
 
 	std::vector<size_t> binom_lookup_;
@@ -136,7 +136,7 @@ public:
         (void) broker;
         if( enable_lq_ic_scores_ && tree.edge_count() != lq_ic_scores_.size() ) {
             throw std::runtime_error(
-                "Size of QP-IC-Scores (" + std::to_string( lq_ic_scores_.size() ) +
+                "Size of LQ-IC-Scores (" + std::to_string( lq_ic_scores_.size() ) +
                 ") does not match numer of edges of the tree (" +
                 std::to_string( tree.edge_count() ) + ")."
             );
@@ -163,7 +163,7 @@ public:
 
         if (enable_qp_ic_scores_) {
             assert(edge.index() < qp_ic_scores_.size());
-            if (lq_ic_scores_[edge.index()] != std::numeric_limits<double>::infinity()) {
+            if (qp_ic_scores_[edge.index()] != std::numeric_limits<double>::infinity()) {
                 edge_comments.push_back( "qp-ic:" + std::to_string(qp_ic_scores_[edge.index()]) );
             }
         }